@@ -0,0 +1,227 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Benchmark.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+
+using namespace rmanconnect;
+
+namespace
+{
+    // a deque, so registerBenchmark() can hand out references to them
+    std::deque<Benchmark> &benchmarks()
+    {
+        static std::deque<Benchmark> all;
+        return all;
+    }
+
+    // the most iterations we'll try, and the most the count grows by
+    // between tries
+    const long MaxIterations = 1000000000L;
+    const double MaxGrowth = 10.0;
+
+    // formats a time in the units that suit it
+    std::string formatTime( double seconds )
+    {
+        char text[32];
+        if ( seconds<0.000001 )
+            sprintf( text, "%.1f ns", seconds * 1e9 );
+        else if ( seconds<0.001 )
+            sprintf( text, "%.2f us", seconds * 1e6 );
+        else if ( seconds<1.0 )
+            sprintf( text, "%.2f ms", seconds * 1e3 );
+        else
+            sprintf( text, "%.2f s", seconds );
+        return text;
+    }
+
+    // formats a rate with a k/M/G prefix
+    std::string formatRate( double perSecond, const char *units )
+    {
+        const char *prefixes[] = { "", "k", "M", "G", "T" };
+        int prefix = 0;
+        while ( perSecond>=1000.0 && prefix<4 )
+        {
+            perSecond /= 1000.0;
+            prefix++;
+        }
+        char text[32];
+        sprintf( text, "%.1f %s%s/s", perSecond, prefixes[prefix], units );
+        return text;
+    }
+}
+
+BenchmarkState::BenchmarkState( long iterations, int arg ) :
+        mIterations( iterations ),
+        mRemaining( iterations ),
+        mArg( arg ),
+        mStarted( false ),
+        mPaused( false ),
+        mSeconds( 0.0 ),
+        mBytes( 0.0 ),
+        mItems( 0.0 )
+{
+}
+
+bool BenchmarkState::keepRunning()
+{
+    if ( !mStarted )
+    {
+        mStarted = true;
+        mStart = boost::posix_time::microsec_clock::universal_time();
+    }
+    if ( mRemaining>0 )
+    {
+        mRemaining--;
+        return true;
+    }
+    pauseTiming();
+    return false;
+}
+
+void BenchmarkState::pauseTiming()
+{
+    if ( mPaused || !mStarted )
+        return;
+    mSeconds += ( boost::posix_time::microsec_clock::universal_time() - mStart ).total_microseconds() / 1000000.0;
+    mPaused = true;
+}
+
+void BenchmarkState::resumeTiming()
+{
+    if ( !mPaused )
+        return;
+    mStart = boost::posix_time::microsec_clock::universal_time();
+    mPaused = false;
+}
+
+Benchmark::Benchmark( const char *name, BenchmarkFunction function ) :
+        mName( name ),
+        mFunction( function )
+{
+}
+
+Benchmark &Benchmark::arg( int value )
+{
+    mArgs.push_back( value );
+    return *this;
+}
+
+Benchmark &rmanconnect::registerBenchmark( const char *name, BenchmarkFunction function )
+{
+    benchmarks().push_back( Benchmark(name, function) );
+    return benchmarks().back();
+}
+
+int rmanconnect::runBenchmarks( int argc, char **argv )
+{
+    std::string filter;
+    double minTime = 0.5;
+    bool list = false;
+    for ( int i=1; i<argc; ++i )
+    {
+        std::string arg = argv[i];
+        if ( arg.compare(0, 9, "--filter=")==0 )
+            filter = arg.substr( 9 );
+        else if ( arg.compare(0, 11, "--min_time=")==0 )
+            minTime = std::max( atof(arg.c_str() + 11), 0.0 );
+        else if ( arg=="--list" )
+            list = true;
+        else
+        {
+            std::cerr << "usage: " << argv[0] << " [--filter=text] [--min_time=seconds] [--list]" << std::endl;
+            return 1;
+        }
+    }
+
+    if ( !list )
+    {
+        printf( "%-32s %14s %12s %14s %16s\n", "Benchmark", "Time", "Iterations", "Bytes", "Items" );
+        printf( "%s\n", std::string(92, '-').c_str() );
+    }
+
+    int skipped = 0;
+    const std::deque<Benchmark> &all = benchmarks();
+    for ( size_t b=0; b<all.size(); ++b )
+    {
+        std::vector<int> args = all[b].args();
+        bool hasArgs = !args.empty();
+        if ( !hasArgs )
+            args.push_back( 0 );
+        for ( size_t a=0; a<args.size(); ++a )
+        {
+            char name[256];
+            if ( hasArgs )
+                snprintf( name, sizeof(name), "%s/%d", all[b].name().c_str(), args[a] );
+            else
+                snprintf( name, sizeof(name), "%s", all[b].name().c_str() );
+            if ( !filter.empty() && strstr(name, filter.c_str())==0 )
+                continue;
+            if ( list )
+            {
+                printf( "%s\n", name );
+                continue;
+            }
+
+            // keep trying more iterations until they take long enough
+            long iterations = 1;
+            while ( true )
+            {
+                BenchmarkState state( iterations, args[a] );
+                all[b].function()( state );
+                if ( !state.skipped().empty() )
+                {
+                    printf( "%-32s skipped: %s\n", name, state.skipped().c_str() );
+                    skipped++;
+                    break;
+                }
+                if ( state.seconds()>=minTime || iterations>=MaxIterations )
+                {
+                    double seconds = std::max( state.seconds(), 1e-9 );
+                    printf( "%-32s %14s %12ld %14s %16s\n", name,
+                            formatTime(seconds / iterations).c_str(), iterations,
+                            state.bytesProcessed()>0.0 ? formatRate(state.bytesProcessed() / seconds, "B").c_str() : "",
+                            state.itemsProcessed()>0.0 ? formatRate(state.itemsProcessed() / seconds, "").c_str() : "" );
+                    fflush( stdout );
+                    break;
+                }
+                double growth = state.seconds()>0.0 ? minTime * 1.4 / state.seconds() : MaxGrowth;
+                growth = std::min( std::max(growth, 2.0), MaxGrowth );
+                iterations = std::min( static_cast<long>(iterations * growth), MaxIterations );
+            }
+        }
+    }
+    return skipped>0 ? 1 : 0;
+}
@@ -0,0 +1,141 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RMAN_CONNECT_BENCHMARK_H_
+#define RMAN_CONNECT_BENCHMARK_H_
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <string>
+#include <vector>
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    /*! \class BenchmarkState
+     * \brief Times the loop of a benchmark.
+     *
+     * A benchmark function does any setup, then runs the code it measures
+     * in a loop while keepRunning() returns true, and reports how much work
+     * each iteration did:
+     *
+     * \code
+     * void benchCopy( BenchmarkState &state )
+     * {
+     *     std::vector<float> in( state.arg() ), out( state.arg() );
+     *     while ( state.keepRunning() )
+     *         std::copy( in.begin(), in.end(), out.begin() );
+     *     state.setBytesProcessed( state.iterations() * sizeof(float) * in.size() );
+     * }
+     * RMANCONNECT_BENCHMARK( benchCopy ).arg( 1024 ).arg( 65536 );
+     * \endcode
+     *
+     * The runner calls the function with more and more iterations until the
+     * loop takes long enough to time reliably.
+     */
+    class BenchmarkState
+    {
+    public:
+        BenchmarkState( long iterations, int arg );
+
+        //! Returns true until the loop has run iterations() times.
+        bool keepRunning();
+
+        //! Stops the clock, e.g. around per-iteration setup.
+        void pauseTiming();
+        //! Starts the clock again.
+        void resumeTiming();
+
+        //! The number of times the loop is being run
+        long iterations() const { return mIterations; }
+        //! The argument the benchmark was registered with
+        int arg() const { return mArg; }
+
+        //! Sets the bytes handled by the whole run, to report a rate.
+        void setBytesProcessed( double bytes ) { mBytes = bytes; }
+        //! Sets the items handled by the whole run, to report a rate.
+        void setItemsProcessed( double items ) { mItems = items; }
+        //! Reports that the benchmark couldn't run, and why.
+        void skip( const std::string &reason ) { mSkipped = reason; mRemaining = 0; }
+
+        double seconds() const { return mSeconds; }
+        double bytesProcessed() const { return mBytes; }
+        double itemsProcessed() const { return mItems; }
+        const std::string &skipped() const { return mSkipped; }
+
+    private:
+        long mIterations, mRemaining;
+        int mArg;
+        bool mStarted, mPaused;
+        boost::posix_time::ptime mStart;
+        double mSeconds, mBytes, mItems;
+        std::string mSkipped;
+    };
+
+    //! A benchmark function
+    typedef void (*BenchmarkFunction)( BenchmarkState& );
+
+    /*! \class Benchmark
+     * \brief A registered benchmark, run once for each of its arguments.
+     */
+    class Benchmark
+    {
+    public:
+        Benchmark( const char *name, BenchmarkFunction function );
+
+        //! Adds an argument to run the benchmark with.
+        Benchmark &arg( int value );
+
+        const std::string &name() const { return mName; }
+        BenchmarkFunction function() const { return mFunction; }
+        const std::vector<int> &args() const { return mArgs; }
+
+    private:
+        std::string mName;
+        BenchmarkFunction mFunction;
+        std::vector<int> mArgs;
+    };
+
+    //! Registers a benchmark function, returning it to add arguments to.
+    Benchmark &registerBenchmark( const char *name, BenchmarkFunction function );
+
+    /*! \brief Runs every registered benchmark, printing a line for each.
+     *
+     * Understands --filter=text (only run benchmarks whose name contains
+     * text), --min_time=seconds (how long to time each for, 0.5 by default)
+     * and --list. Returns a status for main() to return.
+     */
+    int runBenchmarks( int argc, char **argv );
+}
+
+//! Registers a benchmark function at startup
+#define RMANCONNECT_BENCHMARK( function ) \
+    static rmanconnect::Benchmark &function##Benchmark = rmanconnect::registerBenchmark( #function, function )
+
+#endif // RMAN_CONNECT_BENCHMARK_H_
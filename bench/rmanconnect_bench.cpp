@@ -0,0 +1,668 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// rmanconnect_bench
+//
+// Microbenchmarks of the transport and of the real display driver and Nuke
+// node code, built against the stand-in SDK headers in shims/ so they run
+// on any machine. The driver benchmarks call the DspyImage* functions just
+// as a renderer would, into a node made with Op::create() and listening on
+// RMANCONNECT_BENCH_PORT (9301 by default).
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include <ndspy.h>
+#include "DDImage/Iop.h"
+#include "DDImage/Knobs.h"
+#include "DDImage/Row.h"
+
+#include "Benchmark.h"
+#include "Client.h"
+#include "Codec.h"
+#include "Data.h"
+#include "Half.h"
+#include "Message.h"
+#include "PixelSink.h"
+#include "RenderHistory.h"
+#include "RmanBuffer.h"
+#include "Server.h"
+
+using namespace rmanconnect;
+
+namespace
+{
+    // the images rendered by the end-to-end benchmarks
+    const int ImageWidth = 1024;
+    const int ImageHeight = 768;
+
+    int benchPort()
+    {
+        const char *port = getenv( "RMANCONNECT_BENCH_PORT" );
+        return port && *port ? atoi( port ) : 9301;
+    }
+
+    // fills a bucket with a smooth ramp
+    void fillBucket( std::vector<float> &pixels, int width, int height, int channels, float offset )
+    {
+        pixels.resize( width * height * channels );
+        for ( int y=0; y<height; ++y )
+            for ( int x=0; x<width; ++x )
+                for ( int c=0; c<channels; ++c )
+                    pixels[( y * width + x ) * channels + c] = offset + x * 0.01f + y * 0.001f + c;
+    }
+
+    //=====
+    // core
+
+    // copying buckets into the node's buffer (what RmanConnect::pixels()
+    // does, without the locking)
+    void bucketCopy( BenchmarkState &state )
+    {
+        int size = state.arg();
+        RmanBuffer buffer;
+        buffer.init( 2048, 1556, 4 );
+        std::vector<float> pixels, rows;
+        std::vector<float*> scratch;
+        fillBucket( pixels, size, size, 4, 0.f );
+
+        int columns = 2048 / size, bucket = 0;
+        while ( state.keepRunning() )
+        {
+            Region region = { ( bucket % columns ) * size, ( bucket / columns ) * size % 1556, size, size, 4, 0, 1, { 0, 0, 0 } };
+            int left, right, top, bottom;
+            if ( buffer.clip(region, left, right, top, bottom) )
+                buffer.copy( region, &pixels[0], left, right, top, bottom, scratch );
+            bucket++;
+        }
+        state.setBytesProcessed( double(state.iterations()) * pixels.size() * sizeof(float) );
+        state.setItemsProcessed( state.iterations() );
+    }
+    RMANCONNECT_BENCHMARK( bucketCopy ).arg( 16 ).arg( 32 ).arg( 64 );
+
+    // encoding a bucket with zlib
+    void zlibEncode( BenchmarkState &state )
+    {
+        std::vector<float> pixels;
+        fillBucket( pixels, state.arg(), state.arg(), 4, 0.f );
+        std::vector<char> encoded;
+        while ( state.keepRunning() )
+            encodePayload( CodecZlib, &pixels[0], pixels.size() * sizeof(float), sizeof(float), encoded );
+        state.setBytesProcessed( double(state.iterations()) * pixels.size() * sizeof(float) );
+    }
+    RMANCONNECT_BENCHMARK( zlibEncode ).arg( 32 ).arg( 64 );
+
+    // decoding a zlib-encoded bucket
+    void zlibDecode( BenchmarkState &state )
+    {
+        std::vector<float> pixels, decoded;
+        fillBucket( pixels, state.arg(), state.arg(), 4, 0.f );
+        decoded.resize( pixels.size() );
+        std::vector<char> encoded, scratch;
+        encodePayload( CodecZlib, &pixels[0], pixels.size() * sizeof(float), sizeof(float), encoded );
+        while ( state.keepRunning() )
+            decodePayload( CodecZlib, &encoded[0], encoded.size(), sizeof(float),
+                           &decoded[0], decoded.size() * sizeof(float), scratch );
+        state.setBytesProcessed( double(state.iterations()) * pixels.size() * sizeof(float) );
+    }
+    RMANCONNECT_BENCHMARK( zlibDecode ).arg( 32 ).arg( 64 );
+
+    // converting a bucket to half floats, as the 'precision' parameter does
+    void floatToHalfBucket( BenchmarkState &state )
+    {
+        std::vector<float> pixels;
+        fillBucket( pixels, state.arg(), state.arg(), 4, 0.f );
+        std::vector<boost::uint16_t> halves( pixels.size() );
+        while ( state.keepRunning() )
+            floatToHalf( &pixels[0], &halves[0], pixels.size() );
+        state.setBytesProcessed( double(state.iterations()) * pixels.size() * sizeof(float) );
+    }
+    RMANCONNECT_BENCHMARK( floatToHalfBucket ).arg( 32 ).arg( 64 );
+
+    // reading a row of a finished render back from the history, compressed
+    // (arg 1) or not (arg 0)
+    void snapshotRow( BenchmarkState &state )
+    {
+        std::vector<std::string> names;
+        names.push_back( "r" );
+        names.push_back( "g" );
+        names.push_back( "b" );
+        names.push_back( "a" );
+        Snapshot snapshot( 2048, 1556, names );
+        for ( unsigned int c=0; c<4; ++c )
+            for ( unsigned int y=0; y<1556; ++y )
+                for ( unsigned int x=0; x<2048; ++x )
+                    snapshot.row( c, y )[x] = x * 0.01f + y * 0.001f + c;
+        if ( state.arg() )
+            snapshot.compress();
+
+        std::vector<float> row( 2048 );
+        unsigned int y = 0;
+        while ( state.keepRunning() )
+        {
+            for ( unsigned int c=0; c<4; ++c )
+                snapshot.readRow( c, y, 0, 2048, &row[0] );
+            y = ( y + 1 ) % 1556;
+        }
+        state.setBytesProcessed( double(state.iterations()) * 4 * 2048 * sizeof(float) );
+    }
+    RMANCONNECT_BENCHMARK( snapshotRow ).arg( 0 ).arg( 1 );
+
+    //=====
+    // transport
+
+    // how a Client reaches the bench Server
+    enum Transport
+    {
+        TransportTcp,
+        TransportLocal,
+        TransportSharedMemory
+    };
+
+    // throws away everything a Server receives, counting the blocks
+    class DiscardingSink : public PixelSink
+    {
+    public:
+        DiscardingSink() : mBlocks( 0 ) {}
+
+        void pixels( int /*imageId*/, const Region &/*region*/, const float * /*data*/ )
+        {
+            boost::mutex::scoped_lock lock( mMutex );
+            mBlocks++;
+            mBlockCondition.notify_all();
+        }
+
+        unsigned long blocks()
+        {
+            boost::mutex::scoped_lock lock( mMutex );
+            return mBlocks;
+        }
+
+        // waits until more than blocks blocks have arrived
+        void waitForBlocks( unsigned long blocks )
+        {
+            boost::mutex::scoped_lock lock( mMutex );
+            while ( mBlocks<=blocks )
+                mBlockCondition.wait( lock );
+        }
+
+    private:
+        boost::mutex mMutex;
+        boost::condition_variable mBlockCondition;
+        unsigned long mBlocks;
+    };
+
+    // a Server listening on its own thread, on our port or (for
+    // TransportLocal) a Unix socket as well
+    class ServerThread
+    {
+    public:
+        ServerThread( Transport transport = TransportTcp ) : mTransport( transport ), mClosed( 0 )
+        {
+            std::string path;
+            if ( transport==TransportLocal )
+            {
+                std::stringstream ss;
+                ss << "/tmp/rmanconnect_bench." << getpid();
+                path = ss.str();
+            }
+            mServer.setPixelSink( &mSink );
+            mServer.connect( benchPort(), true, path );
+            mThread = boost::thread( boost::bind(&ServerThread::listen, this) );
+        }
+
+        ~ServerThread()
+        {
+            mServer.quit();
+            mThread.join();
+        }
+
+        int port() { return mServer.getPort(); }
+        DiscardingSink &sink() { return mSink; }
+
+        // points a Client at us over our transport
+        void attach( Client &client )
+        {
+            if ( mTransport==TransportLocal )
+                client.setSocketPath( mServer.getSocketPath() );
+            client.setSharedMemory( mTransport==TransportSharedMemory );
+        }
+
+        unsigned long closed()
+        {
+            boost::mutex::scoped_lock lock( mMutex );
+            return mClosed;
+        }
+
+        // waits until more than closed images have been closed
+        void waitForClose( unsigned long closed )
+        {
+            boost::mutex::scoped_lock lock( mMutex );
+            while ( mClosed<=closed )
+                mClosedCondition.wait( lock );
+        }
+
+    private:
+        void listen()
+        {
+            while ( true )
+            {
+                Data d = mServer.listen();
+                if ( d.type()==MsgQuit )
+                    break;
+                if ( d.type()==MsgCloseImage )
+                {
+                    boost::mutex::scoped_lock lock( mMutex );
+                    mClosed++;
+                    mClosedCondition.notify_all();
+                }
+            }
+        }
+
+        Transport mTransport;
+        Server mServer;
+        DiscardingSink mSink;
+        boost::thread mThread;
+        boost::mutex mMutex;
+        boost::condition_variable mClosedCondition;
+        unsigned long mClosed;
+    };
+
+    // sending whole images from a Client to a Server, with the given
+    // bucket size. The Client keeps its connection (and ring) between
+    // images, as the display driver does.
+    void sendImages( BenchmarkState &state, Transport transport )
+    {
+        int size = state.arg();
+        ServerThread server( transport );
+        std::vector<float> pixels;
+        fillBucket( pixels, size, size, 4, 0.f );
+        unsigned long buckets = 0;
+        Client client( "localhost", server.port() );
+        server.attach( client );
+        client.setPersistent( true );
+        while ( state.keepRunning() )
+        {
+            unsigned long closed = server.closed();
+            Data header( 0, 0, ImageWidth, ImageHeight, 4 );
+            client.openImage( header );
+            for ( int y=0; y<ImageHeight; y+=size )
+                for ( int x=0; x<ImageWidth; x+=size )
+                {
+                    Data data( x, y, std::min(size, ImageWidth - x), std::min(size, ImageHeight - y), 4, &pixels[0] );
+                    client.sendPixels( data );
+                    buckets++;
+                }
+            client.closeImage();
+            server.waitForClose( closed );
+        }
+        state.setBytesProcessed( double(state.iterations()) * ImageWidth * ImageHeight * 4 * sizeof(float) );
+        state.setItemsProcessed( buckets );
+    }
+
+    // one bucket at a time, waiting for each to arrive, so the time taken
+    // is a bucket's latency from sendPixels() to the Server's sink
+    void sendBuckets( BenchmarkState &state, Transport transport )
+    {
+        int size = state.arg();
+        ServerThread server( transport );
+        std::vector<float> pixels;
+        fillBucket( pixels, size, size, 4, 0.f );
+        Client client( "localhost", server.port() );
+        server.attach( client );
+        Data header( 0, 0, ImageWidth, ImageHeight, 4 );
+        client.openImage( header );
+        Data data( 0, 0, size, size, 4, &pixels[0] );
+        while ( state.keepRunning() )
+        {
+            unsigned long blocks = server.sink().blocks();
+            client.sendPixels( data );
+            server.sink().waitForBlocks( blocks );
+        }
+        client.closeImage();
+        state.setBytesProcessed( double(state.iterations()) * size * size * 4 * sizeof(float) );
+        state.setItemsProcessed( state.iterations() );
+    }
+
+    // the same over TCP loopback, over a Unix domain socket, and through a
+    // shared memory ring (with just the headers going over TCP)
+    void transport( BenchmarkState &state )
+    {
+        sendImages( state, TransportTcp );
+    }
+    RMANCONNECT_BENCHMARK( transport ).arg( 16 ).arg( 32 ).arg( 64 );
+
+    void transportLocal( BenchmarkState &state )
+    {
+        sendImages( state, TransportLocal );
+    }
+    RMANCONNECT_BENCHMARK( transportLocal ).arg( 16 ).arg( 32 ).arg( 64 );
+
+    void transportSharedMemory( BenchmarkState &state )
+    {
+        sendImages( state, TransportSharedMemory );
+    }
+    RMANCONNECT_BENCHMARK( transportSharedMemory ).arg( 16 ).arg( 32 ).arg( 64 );
+
+    void transportLatency( BenchmarkState &state )
+    {
+        sendBuckets( state, TransportTcp );
+    }
+    RMANCONNECT_BENCHMARK( transportLatency ).arg( 16 ).arg( 64 );
+
+    void transportLatencyLocal( BenchmarkState &state )
+    {
+        sendBuckets( state, TransportLocal );
+    }
+    RMANCONNECT_BENCHMARK( transportLatencyLocal ).arg( 16 ).arg( 64 );
+
+    void transportLatencySharedMemory( BenchmarkState &state )
+    {
+        sendBuckets( state, TransportSharedMemory );
+    }
+    RMANCONNECT_BENCHMARK( transportLatencySharedMemory ).arg( 16 ).arg( 64 );
+
+    //=====
+    // display driver and Nuke node
+
+    // an RmanConnect node, listening on our port
+    class NodeFixture
+    {
+    public:
+        NodeFixture() : mIop( static_cast<DD::Image::Iop*>(DD::Image::Op::create("RmanConnect")) )
+        {
+            mIop->knob( "port_number" )->set_value( benchPort() );
+            mIop->knob( "history_size" )->set_value( 0 );
+            mIop->attach();
+            mIop->validate();
+        }
+
+        ~NodeFixture()
+        {
+            mIop->detach();
+            delete mIop;
+        }
+
+        bool ok() const { return mIop->errors()==0; }
+        DD::Image::Iop *iop() { return mIop; }
+
+        /*! Renders an image through the display driver a bucket at a time,
+         * with marker in the red of every pixel, and waits for the node to
+         * have all of it. Returns the number of buckets. */
+        int render( int channels, int size, float marker,
+                    int width = ImageWidth, int height = ImageHeight )
+        {
+            std::vector<std::string> names;
+            std::vector<PtDspyDevFormat> formats( channels );
+            const char *rgba[] = { "r", "g", "b", "a" };
+            for ( int c=0; c<channels; ++c )
+            {
+                char name[32];
+                if ( c<4 )
+                    strcpy( name, rgba[c] );
+                else
+                    sprintf( name, "aov%d", c );
+                names.push_back( name );
+            }
+            for ( int c=0; c<channels; ++c )
+            {
+                formats[c].name = const_cast<char*>(names[c].c_str());
+                formats[c].type = PkDspyFloat32;
+            }
+            int port = benchPort();
+            UserParameter parameter = { "port", 'i', 1, &port, sizeof(int) };
+            PtFlagStuff flags = { 0 };
+
+            PtDspyImageHandle image = 0;
+            if ( DspyImageOpen(&image, "rmanconnect", "bench", width, height,
+                               1, &parameter, channels, &formats[0], &flags)!=PkDspyErrorNone )
+                return 0;
+            std::vector<float> pixels( size * size * channels, marker );
+            int buckets = 0, last_x = 0, last_y = 0;
+            for ( int y=0; y<height; y+=size )
+                for ( int x=0; x<width; x+=size )
+                {
+                    DspyImageData( image, x, std::min(x + size, width), y, std::min(y + size, height),
+                                   channels * sizeof(float), reinterpret_cast<unsigned char*>(&pixels[0]) );
+                    last_x = x;
+                    last_y = y;
+                    buckets++;
+                }
+            DspyImageClose( image );
+
+            // the node has everything once the last bucket shows up
+            DD::Image::Row row( last_x, last_x + 1 );
+            DD::Image::ChannelSet red( DD::Image::Chan_Red );
+            while ( true )
+            {
+                mIop->engine( height - 1 - last_y, last_x, last_x + 1, red, row );
+                if ( row[DD::Image::Chan_Red][last_x]==marker )
+                    break;
+                boost::this_thread::yield();
+            }
+            return buckets;
+        }
+
+    private:
+        DD::Image::Iop *mIop;
+    };
+
+    // the node the benchmarks below share, so it only has to start
+    // listening once
+    NodeFixture &sharedNode()
+    {
+        static NodeFixture node;
+        return node;
+    }
+
+    // a new marker for each image rendered into the shared node
+    float nextMarker()
+    {
+        static float marker = 0.f;
+        return ++marker;
+    }
+
+    // rendering whole images through DspyImageOpen(), DspyImageData() and
+    // DspyImageClose() into a node, with the given bucket size
+    void dspyImage( BenchmarkState &state )
+    {
+        NodeFixture &node = sharedNode();
+        if ( !node.ok() )
+        {
+            state.skip( "the node couldn't listen" );
+            return;
+        }
+        unsigned long buckets = 0;
+        while ( state.keepRunning() )
+            buckets += node.render( 4, state.arg(), nextMarker() );
+        state.setBytesProcessed( double(state.iterations()) * ImageWidth * ImageHeight * 4 * sizeof(float) );
+        state.setItemsProcessed( buckets );
+    }
+    RMANCONNECT_BENCHMARK( dspyImage ).arg( 16 ).arg( 32 ).arg( 64 );
+
+    // reads rows of a width x height image out of the node with
+    // RmanConnect::engine(), rendering it first with the given number of
+    // channels
+    void readEngine( BenchmarkState &state, int channels, int width, int height )
+    {
+        NodeFixture &node = sharedNode();
+        if ( !node.ok() )
+        {
+            state.skip( "the node couldn't listen" );
+            return;
+        }
+        node.render( channels, 64, nextMarker(), width, height );
+        node.iop()->validate();
+        const DD::Image::ChannelSet &mask = node.iop()->info().channels();
+
+        DD::Image::Row row( 0, width );
+        int y = 0;
+        while ( state.keepRunning() )
+        {
+            node.iop()->engine( y, 0, width, mask, row );
+            y = ( y + 1 ) % height;
+        }
+        state.setBytesProcessed( double(state.iterations()) * width * channels * sizeof(float) );
+    }
+
+    // reading rows of a 1024x768 image with the given number of channels
+    void engine( BenchmarkState &state )
+    {
+        readEngine( state, state.arg(), ImageWidth, ImageHeight );
+    }
+    RMANCONNECT_BENCHMARK( engine ).arg( 4 ).arg( 16 );
+
+    // reading rows of a 4 channel image of the given height: 1024x768,
+    // 4096x2160 (4K UHD) or 8192x4320 (8K UHD), to see how engine() copes
+    // once the image no longer fits in cache
+    void engineImageSize( BenchmarkState &state )
+    {
+        int height = state.arg();
+        int width = height==4320 ? 8192 : height==2160 ? 4096 : ImageWidth;
+        readEngine( state, 4, width, height );
+    }
+    RMANCONNECT_BENCHMARK( engineImageSize ).arg( 768 ).arg( 2160 ).arg( 4320 );
+
+    // reads rows of the node's 1024x768 image with engine(), starting at
+    // row y, until told to stop
+    void readRows( DD::Image::Iop *iop, int y, const volatile bool *stop )
+    {
+        const DD::Image::ChannelSet &mask = iop->info().channels();
+        DD::Image::Row row( 0, ImageWidth );
+        while ( !*stop )
+        {
+            iop->engine( y, 0, ImageWidth, mask, row );
+            y = ( y + 1 ) % ImageHeight;
+        }
+    }
+
+    // images rendered into the node one after another, as fast as the
+    // driver can send them, on a thread of their own
+    class IngestThread
+    {
+    public:
+        IngestThread( NodeFixture &node ) : mNode( node ), mRunning( true ), mBuckets( 0 )
+        {
+            mThread = boost::thread( boost::bind(&IngestThread::run, this) );
+        }
+
+        ~IngestThread()
+        {
+            {
+                boost::mutex::scoped_lock lock( mMutex );
+                mRunning = false;
+            }
+            mThread.join();
+        }
+
+        unsigned long buckets()
+        {
+            boost::mutex::scoped_lock lock( mMutex );
+            return mBuckets;
+        }
+
+    private:
+        void run()
+        {
+            while ( true )
+            {
+                int buckets = mNode.render( 4, 32, nextMarker() );
+                boost::mutex::scoped_lock lock( mMutex );
+                mBuckets += buckets;
+                if ( !mRunning )
+                    break;
+            }
+        }
+
+        NodeFixture &mNode;
+        boost::thread mThread;
+        boost::mutex mMutex;
+        bool mRunning;
+        unsigned long mBuckets;
+    };
+
+    // reading rows with engine() on the given number of threads while
+    // images are rendered into the node as fast as they can be, as when
+    // Nuke draws the viewer during a render. Bytes are what one of the
+    // reading threads got through, and items are the buckets received
+    // in the meantime.
+    void engineContention( BenchmarkState &state )
+    {
+        NodeFixture &node = sharedNode();
+        if ( !node.ok() )
+        {
+            state.skip( "the node couldn't listen" );
+            return;
+        }
+        node.render( 4, 64, nextMarker() );
+        node.iop()->validate();
+        const DD::Image::ChannelSet &mask = node.iop()->info().channels();
+
+        // the other readers start halfway down the image, out of step
+        // with this one
+        int readers = state.arg();
+        volatile bool stop = false;
+        boost::thread_group threads;
+        for ( int i=1; i<readers; ++i )
+            threads.create_thread( boost::bind(&readRows, node.iop(), ImageHeight * i / readers, &stop) );
+        unsigned long buckets = 0;
+        {
+            IngestThread ingest( node );
+            DD::Image::Row row( 0, ImageWidth );
+            int y = 0;
+            unsigned long first = ingest.buckets();
+            while ( state.keepRunning() )
+            {
+                node.iop()->engine( y, 0, ImageWidth, mask, row );
+                y = ( y + 1 ) % ImageHeight;
+            }
+            buckets = ingest.buckets() - first;
+        }
+        stop = true;
+        threads.join_all();
+
+        state.setBytesProcessed( double(state.iterations()) * ImageWidth * 4 * sizeof(float) );
+        state.setItemsProcessed( buckets );
+    }
+    RMANCONNECT_BENCHMARK( engineContention ).arg( 1 ).arg( 4 ).arg( 16 );
+}
+
+int main( int argc, char **argv )
+{
+    return runBenchmarks( argc, argv );
+}
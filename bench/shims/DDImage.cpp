@@ -0,0 +1,238 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "DDImage/Iop.h"
+#include "DDImage/Knobs.h"
+#include "DDImage/Thread.h"
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <map>
+
+using namespace DD::Image;
+
+namespace
+{
+    // every channel name we've been asked for, indexed by Channel. Call
+    // with gChannelMutex locked.
+    boost::mutex gChannelMutex;
+    std::deque<std::string> &channelNames()
+    {
+        static std::deque<std::string> names;
+        if ( names.empty() )
+        {
+            const char *builtIn[] = { "black", "rgba.red", "rgba.green", "rgba.blue", "rgba.alpha", "depth.Z" };
+            names.insert( names.end(), builtIn, builtIn + 6 );
+        }
+        return names;
+    }
+
+    // the classes registered with Iop::Description
+    std::vector<Iop::Description*> &descriptions()
+    {
+        static std::vector<Iop::Description*> all;
+        return all;
+    }
+
+    // the threads started by Thread::spawn(), by the data they were given
+    boost::mutex gThreadMutex;
+    std::map<void*, boost::thread_group*> gThreads;
+}
+
+Channel DD::Image::getChannel( const char *name, bool sort )
+{
+    boost::mutex::scoped_lock lock( gChannelMutex );
+    std::deque<std::string> &names = channelNames();
+    for ( size_t c=0; c<names.size(); ++c )
+        if ( names[c]==name )
+            return Channel(c);
+    if ( names.size()>=static_cast<size_t>(ChannelSet::MaxChannels) )
+        return Chan_Black;
+    names.push_back( name );
+    return Channel(names.size() - 1);
+}
+
+const char *DD::Image::getName( Channel channel )
+{
+    boost::mutex::scoped_lock lock( gChannelMutex );
+    const std::deque<std::string> &names = channelNames();
+    return static_cast<size_t>(channel)<names.size() ? names[channel].c_str() : "";
+}
+
+Op::~Op()
+{
+    for ( size_t i=0; i<mKnobs.size(); ++i )
+        delete mKnobs[i];
+}
+
+Op *Op::create( const char *name, Node *node )
+{
+    const std::vector<Iop::Description*> &all = descriptions();
+    for ( size_t i=0; i<all.size(); ++i )
+        if ( strcmp(all[i]->name, name)==0 )
+            return all[i]->constructor( node );
+    return 0;
+}
+
+Knob *Op::knob( const char *name )
+{
+    if ( mKnobs.empty() )
+        knobs( &mKnobs );
+    for ( size_t i=0; i<mKnobs.size(); ++i )
+        if ( strcmp(mKnobs[i]->name(), name)==0 )
+            return mKnobs[i];
+    return 0;
+}
+
+void Op::error( const char *format, ... )
+{
+    va_list args;
+    va_start( args, format );
+    fprintf( stderr, "%s: ", Class() );
+    vfprintf( stderr, format, args );
+    fprintf( stderr, "\n" );
+    va_end( args );
+    mErrors++;
+}
+
+Iop::Description::Description( const char *name_, const char *menu, Iop *(*constructor_)( Node* ) ) :
+        name( name_ ),
+        constructor( constructor_ )
+{
+    descriptions().push_back( this );
+}
+
+void Knob::set_value( double value )
+{
+    switch ( mType )
+    {
+        case IntKnob:
+            *static_cast<int*>(mValue) = static_cast<int>(value);
+            break;
+        case FloatKnob:
+            *static_cast<float*>(mValue) = static_cast<float>(value);
+            break;
+        case BoolKnob:
+            *static_cast<bool*>(mValue) = value!=0.0;
+            break;
+        default:
+            break;
+    }
+}
+
+void Knob::set_text( const char *text )
+{
+    if ( mType!=StringKnob )
+        return;
+    mText = text ? text : "";
+    *static_cast<const char**>(mValue) = mText.c_str();
+}
+
+namespace
+{
+    Knob *addKnob( Knob_Callback f, Knob::Type type, void *value, const char *name )
+    {
+        if ( !f )
+            return 0;
+        f->push_back( new Knob(type, value, name) );
+        return f->back();
+    }
+}
+
+Knob *DD::Image::Format_knob( Knob_Callback f, FormatPair *value, const char *name, const char *label )
+{
+    return addKnob( f, Knob::FormatKnob, value, name );
+}
+
+Knob *DD::Image::Int_knob( Knob_Callback f, int *value, const char *name, const char *label )
+{
+    return addKnob( f, Knob::IntKnob, value, name );
+}
+
+Knob *DD::Image::Float_knob( Knob_Callback f, float *value, const char *name, const char *label )
+{
+    return addKnob( f, Knob::FloatKnob, value, name );
+}
+
+Knob *DD::Image::Bool_knob( Knob_Callback f, bool *value, const char *name, const char *label )
+{
+    return addKnob( f, Knob::BoolKnob, value, name );
+}
+
+Knob *DD::Image::String_knob( Knob_Callback f, const char **value, const char *name, const char *label )
+{
+    return addKnob( f, Knob::StringKnob, value, name );
+}
+
+Knob *DD::Image::File_knob( Knob_Callback f, const char **value, const char *name, const char *label )
+{
+    return addKnob( f, Knob::StringKnob, value, name );
+}
+
+Knob *DD::Image::Multiline_Eval_String_knob( Knob_Callback f, const char **value, const char *name, const char *label )
+{
+    return addKnob( f, Knob::StringKnob, value, name );
+}
+
+void DD::Image::SetFlags( Knob_Callback f, int flags )
+{
+}
+
+void DD::Image::Tooltip( Knob_Callback f, const char *text )
+{
+}
+
+void DD::Image::Thread::spawn( void (*function)( unsigned, unsigned, void* ), int threads, void *data )
+{
+    boost::mutex::scoped_lock lock( gThreadMutex );
+    boost::thread_group *&group = gThreads[data];
+    if ( !group )
+        group = new boost::thread_group;
+    for ( int i=0; i<threads; ++i )
+        group->create_thread( boost::bind(function, i, threads, data) );
+}
+
+void DD::Image::Thread::wait( void *data )
+{
+    boost::thread_group *group = 0;
+    {
+        boost::mutex::scoped_lock lock( gThreadMutex );
+        std::map<void*, boost::thread_group*>::iterator it = gThreads.find( data );
+        if ( it==gThreads.end() )
+            return;
+        group = it->second;
+        gThreads.erase( it );
+    }
+    group->join_all();
+    delete group;
+}
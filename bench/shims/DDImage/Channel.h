@@ -0,0 +1,64 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// A stand-in for Nuke's DDImage/Channel.h, see Iop.h.
+
+#ifndef RMAN_CONNECT_SHIM_DDIMAGE_CHANNEL_H_
+#define RMAN_CONNECT_SHIM_DDIMAGE_CHANNEL_H_
+
+namespace DD
+{
+    namespace Image
+    {
+        //! A channel, numbered as Nuke numbers its built-in ones
+        enum Channel
+        {
+            Chan_Black = 0,
+            Chan_Red,
+            Chan_Green,
+            Chan_Blue,
+            Chan_Alpha,
+            Chan_Z,
+            //! Further channels are made by getChannel(), up to this one
+            Chan_Last = 1023
+        };
+
+        /*! \brief Returns the channel with a name like "layer.channel".
+         *
+         * As in Nuke, a new channel is made the first time a name is used.
+         */
+        Channel getChannel( const char *name, bool sort=true );
+
+        //! Returns a channel's full name, e.g. "rgba.red"
+        const char *getName( Channel channel );
+    }
+}
+
+#endif // RMAN_CONNECT_SHIM_DDIMAGE_CHANNEL_H_
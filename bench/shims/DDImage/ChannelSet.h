@@ -0,0 +1,85 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// A stand-in for Nuke's DDImage/ChannelSet.h, see Iop.h.
+
+#ifndef RMAN_CONNECT_SHIM_DDIMAGE_CHANNELSET_H_
+#define RMAN_CONNECT_SHIM_DDIMAGE_CHANNELSET_H_
+
+#include "Channel.h"
+#include <bitset>
+
+namespace DD
+{
+    namespace Image
+    {
+        //! A set of channels
+        class ChannelSet
+        {
+        public:
+            //! The most channels the stand-in can hold
+            static const int MaxChannels = Chan_Last + 1;
+
+            ChannelSet() {}
+            ChannelSet( Channel channel ) { insert( channel ); }
+
+            void insert( Channel channel ) { mBits.set( channel ); }
+            void clear() { mBits.reset(); }
+            bool contains( Channel channel ) const { return mBits.test( channel ); }
+            unsigned int size() const { return mBits.count(); }
+            bool empty() const { return mBits.none(); }
+
+            ChannelSet &operator+=( Channel channel ) { insert( channel ); return *this; }
+
+            //! The first channel in the set, or Chan_Black if it's empty
+            Channel first() const { return next( Chan_Black ); }
+
+            //! The channel after z in the set, or Chan_Black if there isn't one
+            Channel next( Channel z ) const
+            {
+                for ( int c=z + 1; c<MaxChannels; ++c )
+                    if ( mBits.test(c) )
+                        return Channel(c);
+                return Chan_Black;
+            }
+
+        private:
+            std::bitset<MaxChannels> mBits;
+        };
+
+        typedef const ChannelSet &ChannelMask;
+
+        //! Loops over every channel in a set
+#define foreach(VAR, CHANNELS) \
+        for ( DD::Image::Channel VAR=(CHANNELS).first(); VAR; VAR=(CHANNELS).next(VAR) )
+    }
+}
+
+#endif // RMAN_CONNECT_SHIM_DDIMAGE_CHANNELSET_H_
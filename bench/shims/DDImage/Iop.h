@@ -0,0 +1,211 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* A stand-in for the parts of Nuke's DDImage library that
+ * nk_rmanConnect.cpp uses, so the node can be built and benchmarked
+ * without Nuke. The classes keep Nuke's names and signatures but only do
+ * what the node relies on: Iop::Description registers a node so it can be
+ * made with Op::create(), knobs can be looked up with Op::knob() and set,
+ * validate() calls _validate(), and Thread::spawn() starts real threads.
+ * Viewer updates and errors are just counted.
+ */
+
+#ifndef RMAN_CONNECT_SHIM_DDIMAGE_IOP_H_
+#define RMAN_CONNECT_SHIM_DDIMAGE_IOP_H_
+
+#include "Channel.h"
+#include "ChannelSet.h"
+#include "Row.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+namespace DD
+{
+    namespace Image
+    {
+        class Knob;
+        class Op;
+        typedef std::vector<Knob*> *Knob_Callback;
+
+        //! Nuke's node in the DAG (never used by the stand-in)
+        class Node;
+
+        //! A rectangle from (x, y) up to but not including (r, t)
+        class Box
+        {
+        public:
+            Box() : mX( 0 ), mY( 0 ), mR( 1 ), mT( 1 ) {}
+            Box( int x, int y, int r, int t ) : mX( x ), mY( y ), mR( r ), mT( t ) {}
+
+            int x() const { return mX; }
+            int y() const { return mY; }
+            int r() const { return mR; }
+            int t() const { return mT; }
+            int w() const { return mR - mX; }
+            int h() const { return mT - mY; }
+
+            void set( int x, int y, int r, int t ) { mX = x; mY = y; mR = r; mT = t; }
+
+            //! Grows the box to include another one
+            void merge( int x, int y, int r, int t )
+            {
+                if ( x<mX ) mX = x;
+                if ( y<mY ) mY = y;
+                if ( r>mR ) mR = r;
+                if ( t>mT ) mT = t;
+            }
+
+            void merge( const Box &box ) { merge( box.mX, box.mY, box.mR, box.mT ); }
+
+        private:
+            int mX, mY, mR, mT;
+        };
+
+        //! The hash Nuke uses to spot an Op's output changing
+        class Hash
+        {
+        public:
+            Hash() : mValue( 0 ) {}
+            void append( unsigned int value ) { mValue = mValue * 31 + value; }
+            unsigned long long value() const { return mValue; }
+
+        private:
+            unsigned long long mValue;
+        };
+
+        //! An image format
+        class Format : public Box
+        {
+        public:
+            Format( int width=640, int height=480 ) : Box( 0, 0, width, height ) {}
+            int width() const { return w(); }
+            int height() const { return h(); }
+        };
+
+        //! The values of a Format_knob
+        class FormatPair
+        {
+        public:
+            Format *fullSizeFormat() { return &mFullSizeFormat; }
+            Format *format() { return &mFormat; }
+
+        private:
+            Format mFullSizeFormat, mFormat;
+        };
+
+        //! What an Iop outputs, set up by _validate()
+        class Info : public Box
+        {
+        public:
+            void format( const Format &format ) { mFormat = format; }
+            const Format &format() const { return mFormat; }
+            void full_size_format( const Format &format ) { mFullSizeFormat = format; }
+            const Format &full_size_format() const { return mFullSizeFormat; }
+            void channels( const ChannelSet &channels ) { mChannels = channels; }
+            const ChannelSet &channels() const { return mChannels; }
+            void set( const Box &box ) { Box::set( box.x(), box.y(), box.r(), box.t() ); }
+
+        private:
+            Format mFormat, mFullSizeFormat;
+            ChannelSet mChannels;
+        };
+
+        //! An operator
+        class Op
+        {
+        public:
+            Op() : mUpdates( 0 ), mErrors( 0 ) {}
+            virtual ~Op();
+
+            //! Makes an Op of a class registered with an Iop::Description
+            static Op *create( const char *name, Node *node=0 );
+
+            virtual const char *Class() const = 0;
+            virtual const char *node_help() const = 0;
+            virtual const char *displayName() const { return Class(); }
+            virtual void knobs( Knob_Callback f ) {}
+            virtual int knob_changed( Knob *knob ) { return 0; }
+            virtual void attach() {}
+            virtual void detach() {}
+            virtual void append( Hash &hash ) {}
+
+            //! Finds one of the knobs made by knobs(), or 0
+            Knob *knob( const char *name );
+
+            //! Sets up the Op's outputs
+            void validate( bool for_real=true ) { _validate( for_real ); }
+
+            void inputs( int n ) {}
+            void asapUpdate() { mUpdates++; }
+            void asapUpdate( const Box &box, int direction=0 ) { mUpdates++; }
+            void error( const char *format, ... );
+            void print_name( std::ostream &o ) const { o << Class(); }
+
+            //! The number of times asapUpdate() and error() have been called
+            unsigned long updates() const { return mUpdates; }
+            unsigned long errors() const { return mErrors; }
+
+        protected:
+            virtual void _validate( bool for_real ) {}
+
+        private:
+            std::vector<Knob*> mKnobs;
+            unsigned long mUpdates, mErrors;
+        };
+
+        //! An image operator
+        class Iop : public Op
+        {
+        public:
+            //! Registers an Iop class for Op::create()
+            class Description
+            {
+            public:
+                Description( const char *name, const char *menu, Iop *(*constructor)( Node* ) );
+
+                const char *name;
+                Iop *(*constructor)( Node* );
+            };
+
+            Iop( Node *node ) {}
+
+            const Info &info() const { return info_; }
+
+            //! Fills in channels of row y from x to r-1
+            virtual void engine( int y, int x, int r, ChannelMask channels, Row &row ) = 0;
+
+        protected:
+            Info info_;
+        };
+    }
+}
+
+#endif // RMAN_CONNECT_SHIM_DDIMAGE_IOP_H_
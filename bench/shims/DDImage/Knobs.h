@@ -0,0 +1,98 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// A stand-in for Nuke's DDImage/Knobs.h, see Iop.h.
+
+#ifndef RMAN_CONNECT_SHIM_DDIMAGE_KNOBS_H_
+#define RMAN_CONNECT_SHIM_DDIMAGE_KNOBS_H_
+
+#include "Iop.h"
+#include <string>
+
+namespace DD
+{
+    namespace Image
+    {
+        //! A knob, pointing at the value in its Op it controls
+        class Knob
+        {
+        public:
+            enum Type
+            {
+                IntKnob,
+                FloatKnob,
+                BoolKnob,
+                StringKnob,
+                FormatKnob
+            };
+
+            //! Flags for SetFlags(), which the shim ignores
+            enum Flags
+            {
+                READ_ONLY = 1,
+                NO_ANIMATION = 2,
+                DO_NOT_WRITE = 4,
+                NO_RERENDER = 8
+            };
+
+            Knob( Type type, void *value, const char *name ) :
+                mType( type ),
+                mValue( value ),
+                mName( name )
+            {
+            }
+
+            const char *name() const { return mName.c_str(); }
+
+            //! Sets an int, float or bool knob
+            void set_value( double value );
+
+            //! Sets a string or file knob
+            void set_text( const char *text );
+
+        private:
+            Type mType;
+            void *mValue;
+            std::string mName, mText;
+        };
+
+        Knob *Format_knob( Knob_Callback f, FormatPair *value, const char *name, const char *label=0 );
+        Knob *Int_knob( Knob_Callback f, int *value, const char *name, const char *label=0 );
+        Knob *Float_knob( Knob_Callback f, float *value, const char *name, const char *label=0 );
+        Knob *Bool_knob( Knob_Callback f, bool *value, const char *name, const char *label=0 );
+        Knob *String_knob( Knob_Callback f, const char **value, const char *name, const char *label=0 );
+        Knob *File_knob( Knob_Callback f, const char **value, const char *name, const char *label=0 );
+        Knob *Multiline_Eval_String_knob( Knob_Callback f, const char **value, const char *name, const char *label=0 );
+        void SetFlags( Knob_Callback f, int flags );
+        void Tooltip( Knob_Callback f, const char *text );
+    }
+}
+
+#endif // RMAN_CONNECT_SHIM_DDIMAGE_KNOBS_H_
@@ -0,0 +1,79 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// A stand-in for Nuke's DDImage/Row.h, see Iop.h.
+
+#ifndef RMAN_CONNECT_SHIM_DDIMAGE_ROW_H_
+#define RMAN_CONNECT_SHIM_DDIMAGE_ROW_H_
+
+#include "ChannelSet.h"
+#include <map>
+#include <vector>
+
+namespace DD
+{
+    namespace Image
+    {
+        //! One row of pixels from x to r-1, for any number of channels
+        class Row
+        {
+        public:
+            Row( int x, int r ) : mX( x ), mR( r ) {}
+
+            /*! \brief Somewhere to write a channel of the row.
+             *
+             * As in Nuke, the pointer is indexed by x, so only
+             * [x, r) of it may be used.
+             */
+            float *writable( Channel z )
+            {
+                std::vector<float> &samples = mChannels[z];
+                samples.resize( mR - mX + 1 );
+                return &samples[0] - mX;
+            }
+
+            //! The samples written to a channel, indexed by x (0 if none were)
+            const float *operator[]( Channel z ) const
+            {
+                std::map<Channel, std::vector<float> >::const_iterator it = mChannels.find( z );
+                return it==mChannels.end() ? 0 : &it->second[0] - mX;
+            }
+
+            int getLeft() const { return mX; }
+            int getRight() const { return mR; }
+
+        private:
+            int mX, mR;
+            std::map<Channel, std::vector<float> > mChannels;
+        };
+    }
+}
+
+#endif // RMAN_CONNECT_SHIM_DDIMAGE_ROW_H_
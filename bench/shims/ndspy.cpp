@@ -0,0 +1,117 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "ndspy.h"
+#include <cstdarg>
+#include <cstdio>
+#include <cstring>
+
+namespace
+{
+    const UserParameter *findParameter( const char *name, char vtype,
+                                        int paramCount, const UserParameter *parameters )
+    {
+        for ( int i=0; i<paramCount; ++i )
+            if ( parameters[i].name && strcmp(parameters[i].name, name)==0 &&
+                 parameters[i].vtype==vtype && parameters[i].vcount>0 )
+                return &parameters[i];
+        return 0;
+    }
+}
+
+extern "C"
+{
+    PtDspyError DspyFindStringInParamList( const char *name, char **result,
+                                           int paramCount, const UserParameter *parameters )
+    {
+        const UserParameter *parameter = findParameter( name, 's', paramCount, parameters );
+        if ( !parameter )
+            return PkDspyErrorNoResource;
+        *result = *static_cast<char**>(parameter->value);
+        return PkDspyErrorNone;
+    }
+
+    PtDspyError DspyFindIntInParamList( const char *name, int *result,
+                                        int paramCount, const UserParameter *parameters )
+    {
+        int count = 1;
+        return DspyFindIntsInParamList( name, &count, result, paramCount, parameters );
+    }
+
+    PtDspyError DspyFindFloatInParamList( const char *name, float *result,
+                                          int paramCount, const UserParameter *parameters )
+    {
+        int count = 1;
+        return DspyFindFloatsInParamList( name, &count, result, paramCount, parameters );
+    }
+
+    // like the renderers, these accept either type and convert it
+    PtDspyError DspyFindIntsInParamList( const char *name, int *resultCount, int *result,
+                                         int paramCount, const UserParameter *parameters )
+    {
+        const UserParameter *parameter = findParameter( name, 'i', paramCount, parameters );
+        if ( !parameter )
+            parameter = findParameter( name, 'f', paramCount, parameters );
+        if ( !parameter )
+            return PkDspyErrorNoResource;
+        int count = *resultCount < parameter->vcount ? *resultCount : parameter->vcount;
+        for ( int i=0; i<count; ++i )
+            result[i] = parameter->vtype=='i' ? static_cast<int*>(parameter->value)[i] :
+                        static_cast<int>(static_cast<float*>(parameter->value)[i]);
+        *resultCount = count;
+        return PkDspyErrorNone;
+    }
+
+    PtDspyError DspyFindFloatsInParamList( const char *name, int *resultCount, float *result,
+                                           int paramCount, const UserParameter *parameters )
+    {
+        const UserParameter *parameter = findParameter( name, 'f', paramCount, parameters );
+        if ( !parameter )
+            parameter = findParameter( name, 'i', paramCount, parameters );
+        if ( !parameter )
+            return PkDspyErrorNoResource;
+        int count = *resultCount < parameter->vcount ? *resultCount : parameter->vcount;
+        for ( int i=0; i<count; ++i )
+            result[i] = parameter->vtype=='f' ? static_cast<float*>(parameter->value)[i] :
+                        static_cast<float>(static_cast<int*>(parameter->value)[i]);
+        *resultCount = count;
+        return PkDspyErrorNone;
+    }
+
+    void DspyError( const char *module, const char *format, ... )
+    {
+        va_list args;
+        va_start( args, format );
+        fprintf( stderr, "%s: ", module );
+        vfprintf( stderr, format, args );
+        fprintf( stderr, "\n" );
+        va_end( args );
+    }
+}
@@ -0,0 +1,129 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+/* A stand-in for the parts of the RenderMan display driver interface
+ * (ndspy.h) that d_rmanConnect.cpp uses, so the driver can be built and
+ * benchmarked without a renderer. The types match the real header, and
+ * ndspy.cpp implements the parameter lookups the renderer would provide.
+ */
+
+#ifndef RMAN_CONNECT_SHIM_NDSPY_H_
+#define RMAN_CONNECT_SHIM_NDSPY_H_
+
+typedef void *PtDspyImageHandle;
+
+typedef enum
+{
+    PkDspyErrorNone = 0,
+    PkDspyErrorNoMemory,
+    PkDspyErrorUnsupported,
+    PkDspyErrorBadParams,
+    PkDspyErrorNoResource,
+    PkDspyErrorUndefined,
+    PkDspyErrorStop
+} PtDspyError;
+
+typedef enum
+{
+    PkSizeQuery,
+    PkOverwriteQuery
+} PtDspyQueryType;
+
+#define PkDspyNone      0
+#define PkDspyFloat32   1
+#define PkDspyUnsigned32 2
+#define PkDspySigned32  3
+#define PkDspyUnsigned16 4
+#define PkDspySigned16  5
+#define PkDspyUnsigned8 6
+#define PkDspySigned8   7
+
+typedef struct
+{
+    char *name;
+    unsigned type;
+} PtDspyDevFormat;
+
+typedef struct
+{
+    int flags;
+} PtFlagStuff;
+
+typedef struct
+{
+    unsigned width;
+    unsigned height;
+    float aspectRatio;
+} PtDspySizeInfo;
+
+/* A display parameter. vtype is 'i', 'f' or 's' and value points at vcount
+ * of them. */
+typedef struct
+{
+    const char *name;
+    char vtype, vcount;
+    void *value;
+    int nbytes;
+} UserParameter;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+PtDspyError DspyFindStringInParamList( const char *name, char **result,
+                                       int paramCount, const UserParameter *parameters );
+PtDspyError DspyFindIntInParamList( const char *name, int *result,
+                                    int paramCount, const UserParameter *parameters );
+PtDspyError DspyFindFloatInParamList( const char *name, float *result,
+                                      int paramCount, const UserParameter *parameters );
+PtDspyError DspyFindIntsInParamList( const char *name, int *resultCount, int *result,
+                                     int paramCount, const UserParameter *parameters );
+PtDspyError DspyFindFloatsInParamList( const char *name, int *resultCount, float *result,
+                                       int paramCount, const UserParameter *parameters );
+void DspyError( const char *module, const char *format, ... );
+
+/* The entry points a display driver provides */
+PtDspyError DspyImageOpen( PtDspyImageHandle *image, const char *drivername,
+                           const char *filename, int width, int height,
+                           int paramCount, const UserParameter *parameters,
+                           int formatCount, PtDspyDevFormat *format,
+                           PtFlagStuff *flagstuff );
+PtDspyError DspyImageData( PtDspyImageHandle image, int xmin, int xmax_plusone,
+                           int ymin, int ymax_plusone, int entrysize,
+                           const unsigned char *data );
+PtDspyError DspyImageClose( PtDspyImageHandle image );
+PtDspyError DspyImageQuery( PtDspyImageHandle image, PtDspyQueryType querytype,
+                            int datalen, void *data );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RMAN_CONNECT_SHIM_NDSPY_H_ */
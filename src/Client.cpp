@@ -29,24 +29,181 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
 #include "Client.h"
+#include "Message.h"
+#include "Half.h"
+#include "Trace.h"
 #include <boost/lexical_cast.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <algorithm>
 #include <stdexcept>
 #include <iostream>
+#include <vector>
+#include <cstring>
+#include <poll.h>
 
 using namespace rmanconnect;
 using boost::asio::ip::tcp;
 
+namespace
+{
+	// box-filters a block of pixels down by scale in each direction
+	void reduce( const float *in, int width, int height, int spp, int scale, float *out )
+	{
+		int out_width = ( width + scale - 1 ) / scale;
+		int out_height = ( height + scale - 1 ) / scale;
+		for ( int oy=0; oy<out_height; ++oy )
+		{
+			int y0 = oy*scale, y1 = std::min( y0 + scale, height );
+			for ( int ox=0; ox<out_width; ++ox )
+			{
+				int x0 = ox*scale, x1 = std::min( x0 + scale, width );
+				float *pixel = out + ( oy*out_width + ox )*spp;
+				for ( int s=0; s<spp; ++s )
+					pixel[s] = 0.f;
+				for ( int y=y0; y<y1; ++y )
+					for ( const float *p=in + ( y*width + x0 )*spp; p<in + ( y*width + x1 )*spp; p+=spp )
+						for ( int s=0; s<spp; ++s )
+							pixel[s] += p[s];
+				float weight = 1.f / ( ( y1 - y0 ) * ( x1 - x0 ) );
+				for ( int s=0; s<spp; ++s )
+					pixel[s] *= weight;
+			}
+		}
+	}
+
+	// transfers everything, like transfer_all(), counting the writes
+	// it takes
+	class CountWrites
+	{
+	public:
+		CountWrites( unsigned long &count ) : mCount( &count ) {}
+
+		template<typename Error>
+		size_t operator()( const Error &error, size_t transferred )
+		{
+			size_t size = boost::asio::transfer_all()( error, transferred );
+			if ( size>0 )
+				++*mCount;
+			return size;
+		}
+
+	private:
+		unsigned long *mCount;
+	};
+}
+
 Client::Client( std::string hostname, int port ) :
         		mHost( hostname ),
         		mPort( port ),
         		mImageId( -1 ),
-        		mSocket( mIoService )
+        		mImageWidth( 0 ),
+        		mImageHeight( 0 ),
+        		mSentArea( 0.0 ),
+        		mNoDelay( true ),
+        		mSendBufferSize( 0 ),
+        		mReceiveBufferSize( 0 ),
+        		mSocket( mIoService ),
+        		mLocalSocket( mIoService ),
+        		mPreviewScale( 0 ),
+        		mQueuedBytes( 0 ),
+        		mMaxQueuedBytes( 64*1024*1024 ),
+        		mBatchBytes( 64*1024 ),
+        		mBatchMilliseconds( 0.f ),
+        		mRequestedCodec( CodecNone ),
+        		mCodec( CodecNone ),
+        		mRequestedFormat( FormatFloat32 ),
+        		mFormat( FormatFloat32 ),
+        		mUseSharedMemory( true ),
+        		mTracing( false ),
+        		mPersistent( false ),
+        		mDropWhenFull( false ),
+        		mStopping( false )
+{
+}
+
+void Client::setQueueOptions( unsigned long maxBytes, bool dropWhenFull )
+{
+	boost::mutex::scoped_lock lock( mQueueMutex );
+	mMaxQueuedBytes = maxBytes;
+	mDropWhenFull = dropWhenFull;
+}
+
+void Client::setBatchOptions( unsigned long maxBytes, float maxMilliseconds )
+{
+	boost::mutex::scoped_lock lock( mQueueMutex );
+	mBatchBytes = maxBytes;
+	mBatchMilliseconds = maxMilliseconds;
+}
+
+void Client::setCodec( PayloadCodec codec )
+{
+	mRequestedCodec = codec;
+}
+
+void Client::setPrecision( SampleFormat format )
+{
+	mRequestedFormat = format;
+}
+
+void Client::setSocketPath( std::string path )
 {
+	mSocketPath = path;
+}
+
+void Client::setSharedMemory( bool enabled )
+{
+	mUseSharedMemory = enabled;
+}
+
+void Client::setPreview( unsigned int scale )
+{
+	mPreviewScale = scale>1 ? scale : 0;
+}
+
+void Client::setRecording( const std::string &path )
+{
+	if ( path.empty() )
+		mRecorder.close();
+	else
+		mRecorder.open( path );
+}
+
+void Client::setTracing( bool enabled )
+{
+	mTracing = enabled;
+}
+
+void Client::setPersistent( bool enabled )
+{
+	mPersistent = enabled;
+}
+
+SendStats Client::stats()
+{
+	boost::mutex::scoped_lock lock( mQueueMutex );
+	SendStats result = mStats;
+	result.queueDepth = mQueue.size() + mPreviewQueue.size();
+	return result;
+}
+
+void Client::setSocketOptions( bool noDelay, int sendBufferSize, int receiveBufferSize )
+{
+	mNoDelay = noDelay;
+	mSendBufferSize = sendBufferSize;
+	mReceiveBufferSize = receiveBufferSize;
 }
 
 void Client::connect( std::string hostname, int port )
 {
-	bool result = true;
+	// connect to a local socket if we've been given one
+	if ( !mSocketPath.empty() )
+	{
+		mLocalSocket.close();
+		mLocalSocket.connect( boost::asio::local::stream_protocol::endpoint(mSocketPath) );
+		return;
+	}
+
 	tcp::resolver resolver(mIoService);
 	tcp::resolver::query query( hostname.c_str(), boost::lexical_cast<std::string>(port).c_str() );
 	tcp::resolver::iterator endpoint_iterator = resolver.resolve(query);
@@ -59,33 +216,490 @@ void Client::connect( std::string hostname, int port )
 	}
 	if (error)
 		throw boost::system::system_error(error);
+
+	// apply our socket options
+	mSocket.set_option( tcp::no_delay(mNoDelay) );
+	if ( mSendBufferSize>0 )
+		mSocket.set_option( boost::asio::socket_base::send_buffer_size(mSendBufferSize) );
+	if ( mReceiveBufferSize>0 )
+		mSocket.set_option( boost::asio::socket_base::receive_buffer_size(mReceiveBufferSize) );
+}
+
+bool Client::isLocal()
+{
+	if ( mLocalSocket.is_open() )
+		return true;
+	return mSocket.local_endpoint().address()==mSocket.remote_endpoint().address();
+}
+
+int Client::nativeHandle()
+{
+	if ( mLocalSocket.is_open() )
+		return mLocalSocket.native_handle();
+	return mSocket.native_handle();
+}
+
+void Client::write( const std::vector<boost::asio::const_buffer> &buffers, boost::system::error_code &error )
+{
+	unsigned long writes = 0;
+	if ( mLocalSocket.is_open() )
+		boost::asio::write( mLocalSocket, buffers, CountWrites(writes), error );
+	else
+		boost::asio::write( mSocket, buffers, CountWrites(writes), error );
+
+	boost::mutex::scoped_lock lock( mQueueMutex );
+	mStats.socketWrites += writes;
+}
+
+void Client::write( const boost::asio::const_buffer &buffer )
+{
+	std::vector<boost::asio::const_buffer> buffers( 1, buffer );
+	boost::system::error_code error;
+	write( buffers, error );
+	if ( error )
+		throw boost::system::system_error(error);
+}
+
+void Client::read( const boost::asio::mutable_buffer &buffer )
+{
+	if ( mLocalSocket.is_open() )
+		boost::asio::read( mLocalSocket, boost::asio::mutable_buffers_1(buffer) );
+	else
+		boost::asio::read( mSocket, boost::asio::mutable_buffers_1(buffer) );
 }
 
 void Client::disconnect()
 {
+	mRing.close();
 	mSocket.close();
+	mLocalSocket.close();
+}
+
+bool Client::isConnected()
+{
+	return mSocket.is_open() || mLocalSocket.is_open();
+}
+
+bool Client::hungUp()
+{
+	// the server never sends us anything unasked, so if the socket is
+	// readable it has gone away
+	pollfd fd;
+	fd.fd = nativeHandle();
+	fd.events = POLLIN;
+	fd.revents = 0;
+	return ::poll( &fd, 1, 0 )!=0;
 }
 
 Client::~Client()
 {
+	stopSender();
 	disconnect();
+	for ( unsigned int i=0; i<mPool.size(); ++i )
+		delete mPool[i];
+}
+
+void Client::startSender()
+{
+	mStopping = false;
+	mSendError = "";
+	mSender = boost::thread( boost::bind(&Client::sendLoop, this) );
+}
+
+void Client::stopSender()
+{
+	if ( mSender.joinable() )
+	{
+		{
+			boost::mutex::scoped_lock lock( mQueueMutex );
+			mStopping = true;
+		}
+		mQueueNotEmpty.notify_all();
+		mSender.join();
+	}
+}
+
+std::vector<char> *Client::takeBuffer()
+{
+	// called with mQueueMutex held
+	if ( mPool.empty() )
+		return new std::vector<char>();
+	std::vector<char> *buffer = mPool.back();
+	mPool.pop_back();
+	return buffer;
+}
+
+void Client::releaseBuffer( std::vector<char> *buffer )
+{
+	// called with mQueueMutex held
+	mPool.push_back( buffer );
+}
+
+void Client::queueBucket( const QueuedBucket &bucket )
+{
+	// called with mQueueMutex held
+	mQueue.push_back( bucket );
+	mStats.bucketsQueued++;
+	if ( mQueue.size() + mPreviewQueue.size() > mStats.maxQueueDepth )
+		mStats.maxQueueDepth = mQueue.size() + mPreviewQueue.size();
+	if ( mQueuedBytes > mStats.maxQueuedBytes )
+		mStats.maxQueuedBytes = mQueuedBytes;
+	mQueueNotEmpty.notify_one();
+}
+
+void Client::releaseBucket( const QueuedBucket &bucket )
+{
+	// called with mQueueMutex held. Buckets in the shared memory ring
+	// weren't counted against the queue.
+	if ( !bucket.pixels )
+		return;
+	mQueuedBytes -= bucket.header.payloadSize;
+	releaseBuffer( bucket.pixels );
+}
+
+bool Client::queueShared( Data &data, QueuedBucket &bucket )
+{
+	// holding the ring lock until the bucket is queued keeps the headers
+	// in the same order as the records
+	boost::mutex::scoped_lock ring_lock( mRingMutex );
+	unsigned int size = bucket.header.payloadSize;
+	char *record = mRing.fits( size ) ? mRing.reserve( size ) : 0;
+	if ( !record )
+		return false;
+	if ( mFormat==FormatFloat16 )
+		floatToHalf( data.mpData, reinterpret_cast<boost::uint16_t*>(record), data.mWidth * data.mHeight * data.mSpp );
+	else
+		memcpy( record, data.mpData, size );
+	mRing.commit( size );
+	bucket.header.flags |= MsgFlagSharedMemory;
+	bucket.pixels = 0;
+	bucket.shared = record;
+
+	boost::mutex::scoped_lock lock( mQueueMutex );
+	if ( !mSendError.empty() )
+		throw std::runtime_error( "Could not send data - " + mSendError );
+	queueBucket( bucket );
+	return true;
+}
+
+bool Client::sendBatch( const std::vector<QueuedBucket> &batch )
+{
+	// encode each bucket with our negotiated codec, except those sendPixels()
+	// already wrote into the shared memory ring
+	unsigned long raw_bytes = 0, sent_bytes = 0, shared_bytes = 0;
+	unsigned long batched_raw_bytes = 0, batched_bytes = 0;
+	unsigned int shared = 0;
+	boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+	if ( mEncoded.size()<batch.size() )
+		mEncoded.resize( batch.size() );
+	mBatchHeaders.resize( batch.size() );
+	for ( unsigned int i=0; i<batch.size(); ++i )
+	{
+		mBatchHeaders[i] = batch[i].header;
+		raw_bytes += batch[i].header.payloadSize;
+		if ( !batch[i].pixels )
+		{
+			shared_bytes += batch[i].header.payloadSize;
+			shared++;
+			continue;
+		}
+		batched_raw_bytes += batch[i].header.payloadSize;
+		size_t sample_size = batch[i].header.format==FormatFloat16 ? sizeof(boost::uint16_t) : sizeof(float);
+		if ( encodePayload( mCodec, &(*batch[i].pixels)[0], batch[i].header.payloadSize, sample_size, mEncoded[i] ) )
+		{
+			mBatchHeaders[i].codec = mCodec;
+			mBatchHeaders[i].payloadSize = mEncoded[i].size();
+		}
+		batched_bytes += mBatchHeaders[i].payloadSize;
+	}
+	sent_bytes = shared_bytes + batched_bytes;
+	boost::posix_time::time_duration encode_time = boost::posix_time::microsec_clock::universal_time() - start;
+
+	// buckets in the ring only need their headers sent, which go first,
+	// batched if there's more than one. They're recorded now, with their
+	// pixels, as the Server may reuse the ring space as soon as it has
+	// their headers.
+	std::vector<boost::asio::const_buffer> buffers, shared_recorded;
+	MessageHeader shared_msg( MsgBatch );
+	if ( shared>1 )
+	{
+		shared_msg.imageId = mImageId;
+		shared_msg.format = mFormat;
+		shared_msg.payloadSize = shared*sizeof(MessageHeader);
+		shared_msg.flags |= MsgFlagSharedMemory;
+		if ( mTracing )
+		{
+			shared_msg.flags |= MsgFlagTraced;
+			shared_msg.sent = traceClock();
+		}
+		buffers.push_back( boost::asio::buffer(reinterpret_cast<const char*>(&shared_msg), sizeof(shared_msg)) );
+	}
+	for ( unsigned int i=0; i<batch.size(); ++i )
+	{
+		if ( batch[i].pixels )
+			continue;
+		if ( shared==1 && ( mBatchHeaders[i].flags & MsgFlagTraced ) )
+			mBatchHeaders[i].sent = traceClock();
+		buffers.push_back( boost::asio::buffer(reinterpret_cast<const char*>(&mBatchHeaders[i]), sizeof(MessageHeader)) );
+		if ( mRecorder.isOpen() )
+		{
+			if ( shared>1 )
+				shared_recorded.push_back( buffers.back() );
+			shared_recorded.push_back( boost::asio::buffer(batch[i].shared, mBatchHeaders[i].payloadSize) );
+			if ( shared==1 )
+				mRecorder.record( mBatchHeaders[i], shared_recorded );
+		}
+	}
+	if ( shared>1 && mRecorder.isOpen() )
+	{
+		// as an ordinary batch, with the pixels following each header
+		MessageHeader recorded_msg = shared_msg;
+		recorded_msg.payloadSize = shared*sizeof(MessageHeader) + shared_bytes;
+		mRecorder.record( recorded_msg, shared_recorded );
+	}
+	unsigned int shared_buffers = buffers.size();
+
+	// then every other header and bucket, gathered into a batch
+	unsigned int batched = batch.size() - shared;
+	MessageHeader msg( MsgBatch );
+	if ( batched>1 )
+	{
+		msg.imageId = mImageId;
+		msg.codec = batched_bytes<batched_raw_bytes ? mCodec : CodecNone;
+		msg.format = mFormat;
+		msg.payloadSize = batched*sizeof(MessageHeader) + batched_bytes;
+		if ( mTracing )
+			msg.flags |= MsgFlagTraced;
+		buffers.push_back( boost::asio::buffer(reinterpret_cast<const char*>(&msg), sizeof(msg)) );
+	}
+	MessageHeader *head = batched>1 ? &msg : 0;
+	for ( unsigned int i=0; i<batch.size(); ++i )
+	{
+		if ( !batch[i].pixels )
+			continue;
+		const char *payload = mBatchHeaders[i].codec==CodecNone ?
+			reinterpret_cast<const char*>(&(*batch[i].pixels)[0]) : &mEncoded[i][0];
+		buffers.push_back( boost::asio::buffer(reinterpret_cast<const char*>(&mBatchHeaders[i]), sizeof(MessageHeader)) );
+		buffers.push_back( boost::asio::buffer(payload, mBatchHeaders[i].payloadSize) );
+		if ( !head )
+			head = &mBatchHeaders[i];
+	}
+
+	// remember the payload as it would go on the socket, for the recording
+	std::vector<boost::asio::const_buffer> recorded;
+	if ( head && mRecorder.isOpen() )
+		recorded.assign( buffers.begin() + shared_buffers + 1, buffers.end() );
+
+	boost::system::error_code error;
+	if ( head && ( head->flags & MsgFlagTraced ) )
+		head->sent = traceClock();
+	write( buffers, error );
+	if ( !error && head )
+		mRecorder.record( *head, recorded );
+
+	boost::mutex::scoped_lock lock( mQueueMutex );
+	if ( error )
+	{
+		mSendError = error.message();
+		return false;
+	}
+	mStats.messagesSent += ( shared>0 ? 1 : 0 ) + ( batched>0 ? 1 : 0 );
+	mStats.rawBytes += raw_bytes;
+	mStats.sentBytes += sent_bytes;
+	mStats.encodeSeconds += encode_time.total_microseconds() / 1000000.0;
+	countCoverage( batch );
+	return true;
+}
+
+void Client::countCoverage( const std::vector<QueuedBucket> &batch )
+{
+	// called with mQueueMutex held. With previews on, the image has been
+	// covered once every bucket's preview is sent, otherwise once every
+	// bucket is.
+	int type = mPreviewScale ? MsgPreview : MsgPixels;
+	for ( unsigned int i=0; i<batch.size(); ++i )
+	{
+		const MessageHeader &header = batch[i].header;
+		if ( header.type==MsgPreview )
+			mStats.previewsSent++;
+		if ( header.type!=type )
+			continue;
+		int width = std::min( header.x + header.width, mImageWidth ) - std::max( header.x, 0 );
+		int height = std::min( header.y + header.height, mImageHeight ) - std::max( header.y, 0 );
+		if ( width>0 && height>0 )
+			mSentArea += static_cast<double>(width) * height;
+	}
+
+	double area = static_cast<double>(mImageWidth) * mImageHeight;
+	if ( mStats.firstFrameSeconds==0.0 && area>0.0 && mSentArea>=area )
+	{
+		boost::posix_time::time_duration elapsed = boost::posix_time::microsec_clock::universal_time() - mOpenTime;
+		mStats.firstFrameSeconds = std::max( elapsed.total_microseconds() / 1000000.0, 0.000001 );
+	}
+}
+
+void Client::sendLoop()
+{
+	std::vector<QueuedBucket> batch;
+	for (;;)
+	{
+		{
+			boost::mutex::scoped_lock lock( mQueueMutex );
+			while ( mQueue.empty() && mPreviewQueue.empty() && !mStopping )
+				mQueueNotEmpty.wait( lock );
+			if ( mQueue.empty() && mPreviewQueue.empty() )
+				return;
+
+			// previews go first, so a backed-up queue still gets a coarse
+			// version of every bucket through before the full ones
+			std::deque<QueuedBucket> &queue = mPreviewQueue.empty() ? mQueue : mPreviewQueue;
+
+			// take queued buckets until the batch is full, waiting until
+			// the deadline for more to arrive
+			boost::system_time deadline = boost::get_system_time() +
+				boost::posix_time::microseconds( static_cast<long>(mBatchMilliseconds*1000.f) );
+			unsigned long batch_bytes = 0;
+			while ( !queue.empty() )
+			{
+				batch.push_back( queue.front() );
+				batch_bytes += queue.front().pixels ? queue.front().header.payloadSize : sizeof(MessageHeader);
+				queue.pop_front();
+				if ( batch_bytes >= mBatchBytes )
+					break;
+				if ( queue.empty() && !mStopping && mBatchMilliseconds>0.f )
+					mQueueNotEmpty.timed_wait( lock, deadline );
+			}
+		}
+
+		bool sent = sendBatch( batch );
+
+		boost::mutex::scoped_lock lock( mQueueMutex );
+		for ( unsigned int i=0; i<batch.size(); ++i )
+			releaseBucket( batch[i] );
+		batch.clear();
+		if ( !sent )
+		{
+			// drop anything still queued and let the producer know
+			while ( !mQueue.empty() )
+			{
+				releaseBucket( mQueue.front() );
+				mQueue.pop_front();
+			}
+			while ( !mPreviewQueue.empty() )
+			{
+				releaseBucket( mPreviewQueue.front() );
+				mPreviewQueue.pop_front();
+			}
+			mQueueNotFull.notify_all();
+			return;
+		}
+		mQueueNotFull.notify_all();
+	}
 }
 
 void Client::openImage( Data &header )
 {
-	// connect to port!
-	connect(mHost, mPort);
+	// connect to port, unless we kept our connection from the last image
+	// and the server is still there
+	bool reused = mPersistent && isConnected() && !hungUp();
+	if ( !reused )
+	{
+		disconnect();
+		connect(mHost, mPort);
+	}
+	mImageWidth = header.mWidth;
+	mImageHeight = header.mHeight;
+
+	try
+	{
+		sendOpenImage( header );
+	}
+	catch( ... )
+	{
+		if ( !reused )
+			throw;
+
+		// the server may have gone away without us noticing, so try again
+		// on a new connection
+		disconnect();
+		connect(mHost, mPort);
+		sendOpenImage( header );
+	}
+
+	// start sending pixels in the background
+	{
+		boost::mutex::scoped_lock lock( mQueueMutex );
+		mStats = SendStats();
+		mOpenTime = boost::posix_time::microsec_clock::universal_time();
+		mSentArea = 0.0;
+	}
+	startSender();
+}
 
+void Client::sendOpenImage( Data &header )
+{
 	// send image header message with image desc information
-	int key = 0;
-	boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&key), sizeof(int)) );
+	MessageHeader msg( MsgOpenImage );
+	msg.width = header.mWidth;
+	msg.height = header.mHeight;
+	msg.spp = header.mSpp;
+	msg.codec = mRequestedCodec;
+	msg.format = mRequestedFormat;
+	if ( mUseSharedMemory && isLocal() )
+		msg.flags |= MsgFlagSharedMemory;
+
+	// followed by the channel names
+	std::string names;
+	for ( unsigned int i=0; i<header.mChannels.size(); ++i )
+	{
+		names += header.mChannels[i];
+		names += '\0';
+	}
+	msg.payloadSize = names.size();
+	std::vector<boost::asio::const_buffer> buffers;
+	buffers.push_back( boost::asio::buffer(reinterpret_cast<const char*>(&msg), sizeof(msg)) );
+	buffers.push_back( boost::asio::buffer(names) );
+	boost::system::error_code error;
+	write( buffers, error );
+	if ( error )
+		throw boost::system::system_error(error);
+	buffers.erase( buffers.begin() );
+	mRecorder.record( msg, buffers );
 
 	// read our imageid
-	boost::asio::read( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&mImageId), sizeof(int)) );
+	MessageHeader reply;
+	read( boost::asio::buffer(reinterpret_cast<char*>(&reply), sizeof(reply)) );
+	if ( !reply.valid() || reply.type!=MsgOpenImage )
+	{
+		disconnect();
+		throw std::runtime_error( "Server replied with an incompatible protocol version!" );
+	}
+	mImageId = reply.imageId;
+	mCodec = static_cast<PayloadCodec>(reply.codec);
+	mFormat = static_cast<SampleFormat>(reply.format);
 
-	// send our width & height
-	boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&header.mWidth), sizeof(int)) );
-	boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&header.mHeight), sizeof(int)) );
+	// attach to the server's shared memory ring, if it made one (or is
+	// still using the one from our last image)
+	if ( reply.flags & MsgFlagSharedMemory )
+	{
+		std::string name( reply.payloadSize, '\0' );
+		read( boost::asio::buffer(&name[0], name.size()) );
+		if ( !mRing.isOpen() || mRing.name()!=name )
+		{
+			mRing.close();
+			try
+			{
+				mRing.attach( name );
+			}
+			catch( ... )
+			{
+				// fall back to sending pixels over the socket
+			}
+			mRing.unlink();
+		}
+	}
+	else
+		mRing.close();
 }
 
 void Client::sendPixels( Data &data )
@@ -95,38 +709,150 @@ void Client::sendPixels( Data &data )
 		throw std::runtime_error( "Could not send data - image id is not valid!" );
 	}
 
-	// send data for image_id
-	int key = 1;
-	boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&key), sizeof(int)) );
-	boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&mImageId), sizeof(int)) );
-
-	// send pixel data
+	// describe the block of pixels for image_id
 	int num_samples = data.mWidth * data.mHeight * data.mSpp;
-	boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&data.mX), sizeof(int)) );
-	boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&data.mY), sizeof(int)) );
-	boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&data.mWidth), sizeof(int)) );
-	boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&data.mHeight), sizeof(int)) );
-	boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&data.mSpp), sizeof(int)) );
-	boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&data.mpData[0]), sizeof(float)*num_samples) );
+	QueuedBucket bucket;
+	bucket.header = MessageHeader( MsgPixels );
+	if ( mTracing )
+	{
+		bucket.header.flags |= MsgFlagTraced;
+		bucket.header.enqueued = traceClock();
+	}
+	bucket.header.imageId = mImageId;
+	bucket.header.x = data.mX;
+	bucket.header.y = data.mY;
+	bucket.header.width = data.mWidth;
+	bucket.header.height = data.mHeight;
+	bucket.header.spp = data.mSpp;
+	bucket.header.format = mFormat;
+	bucket.header.payloadSize = num_samples * ( mFormat==FormatFloat16 ? sizeof(boost::uint16_t) : sizeof(float) );
+	bucket.shared = 0;
+
+	// on the same host the pixels can be written straight into the shared
+	// memory ring, leaving the sender just the header to send. Buckets that
+	// need encoding or a preview, or that the ring has no room for, are
+	// queued as normal.
+	if ( mRing.isOpen() && mCodec==CodecNone && mPreviewScale<=1 && queueShared( data, bucket ) )
+		return;
+
+	// and its preview, if we're sending them
+	QueuedBucket preview;
+	preview.pixels = 0;
+	preview.shared = 0;
+	int preview_samples = 0;
+	if ( mPreviewScale>1 )
+	{
+		int scale = mPreviewScale;
+		preview_samples = ( ( data.mWidth + scale - 1 ) / scale ) * ( ( data.mHeight + scale - 1 ) / scale ) * data.mSpp;
+		preview.header = bucket.header;
+		preview.header.type = MsgPreview;
+		preview.header.scale = scale;
+		preview.header.payloadSize = preview_samples * ( mFormat==FormatFloat16 ? sizeof(boost::uint16_t) : sizeof(float) );
+	}
+	unsigned long bytes = bucket.header.payloadSize + ( preview_samples>0 ? preview.header.payloadSize : 0 );
+
+	boost::mutex::scoped_lock lock( mQueueMutex );
+	if ( !mSendError.empty() )
+		throw std::runtime_error( "Could not send data - " + mSendError );
+
+	// wait for room in the queue (always allow one bucket through)
+	if ( mQueuedBytes + bytes > mMaxQueuedBytes && !( mQueue.empty() && mPreviewQueue.empty() ) )
+	{
+		if ( mDropWhenFull )
+		{
+			mStats.bucketsDropped++;
+			return;
+		}
+
+		boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+		while ( mQueuedBytes + bytes > mMaxQueuedBytes && !( mQueue.empty() && mPreviewQueue.empty() ) && mSendError.empty() )
+			mQueueNotFull.wait( lock );
+		boost::posix_time::time_duration stall = boost::posix_time::microsec_clock::universal_time() - start;
+		mStats.stalls++;
+		mStats.stallSeconds += stall.total_microseconds() / 1000000.0;
+		if ( !mSendError.empty() )
+			throw std::runtime_error( "Could not send data - " + mSendError );
+	}
+
+	// take pooled buffers and reserve our place in the queue
+	bucket.pixels = takeBuffer();
+	if ( preview_samples>0 )
+		preview.pixels = takeBuffer();
+	mQueuedBytes += bytes;
+
+	// copy the pixels without holding up the sender
+	lock.unlock();
+	bucket.pixels->resize( bucket.header.payloadSize );
+	if ( mFormat==FormatFloat16 )
+		floatToHalf( data.mpData, reinterpret_cast<boost::uint16_t*>(&(*bucket.pixels)[0]), num_samples );
+	else
+		memcpy( &(*bucket.pixels)[0], data.mpData, bucket.header.payloadSize );
+	if ( preview.pixels )
+	{
+		preview.pixels->resize( preview.header.payloadSize );
+		if ( mFormat==FormatFloat16 )
+		{
+			std::vector<float> reduced( preview_samples );
+			reduce( data.mpData, data.mWidth, data.mHeight, data.mSpp, mPreviewScale, &reduced[0] );
+			floatToHalf( &reduced[0], reinterpret_cast<boost::uint16_t*>(&(*preview.pixels)[0]), preview_samples );
+		}
+		else
+		{
+			reduce( data.mpData, data.mWidth, data.mHeight, data.mSpp, mPreviewScale,
+					reinterpret_cast<float*>(&(*preview.pixels)[0]) );
+		}
+	}
+	lock.lock();
+	if ( !mSendError.empty() )
+	{
+		mQueuedBytes -= bytes;
+		releaseBuffer( bucket.pixels );
+		if ( preview.pixels )
+			releaseBuffer( preview.pixels );
+		throw std::runtime_error( "Could not send data - " + mSendError );
+	}
+
+	// and queue them
+	if ( preview.pixels )
+		mPreviewQueue.push_back( preview );
+	queueBucket( bucket );
 }
 
 void Client::closeImage( )
 {
-	// send image complete message for image_id
-	int key = 2;
-	boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&key), sizeof(int)) );
+	// drain the send queue
+	stopSender();
+	if ( !mSendError.empty() )
+	{
+		disconnect();
+		throw std::runtime_error( "Could not send data - " + mSendError );
+	}
 
-	// tell the server which image we're closing
-	boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&mImageId), sizeof(int)) );
+	// send image complete message for image_id
+	MessageHeader msg( MsgCloseImage );
+	msg.imageId = mImageId;
+	mImageId = -1;
+	try
+	{
+		write( boost::asio::buffer(reinterpret_cast<const char*>(&msg), sizeof(msg)) );
+	}
+	catch( ... )
+	{
+		disconnect();
+		throw;
+	}
+	mRecorder.record( msg, std::vector<boost::asio::const_buffer>() );
 
-	// disconnect from port!
-	disconnect();
+	// disconnect from port, unless we're keeping the connection for the
+	// next image
+	if ( !mPersistent )
+		disconnect();
 }
 
 void Client::quit()
 {
 	connect(mHost, mPort);
-	int key = 9;
-	boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&key), sizeof(int)) );
+	MessageHeader msg( MsgQuit );
+	write( boost::asio::buffer(reinterpret_cast<const char*>(&msg), sizeof(msg)) );
 	disconnect();
 }
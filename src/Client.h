@@ -31,13 +31,75 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef RMAN_CONNECT_CLIENT_H_
 #define RMAN_CONNECT_CLIENT_H_
 
+#include "Codec.h"
 #include "Data.h"
+#include "Message.h"
+#include "Recording.h"
+#include "SharedRing.h"
 #include <boost/asio.hpp>
+#include <boost/thread.hpp>
+#include <deque>
 #include <string>
+#include <vector>
 
 //! \namespace rmanconnect
 namespace rmanconnect
 {
+    /*! \struct SendStats
+     * \brief Counters describing the behaviour of a Client's send queue.
+     */
+    struct SendStats
+    {
+        SendStats() :
+            bucketsQueued(0),
+            bucketsDropped(0),
+            messagesSent(0),
+            rawBytes(0),
+            sentBytes(0),
+            encodeSeconds(0.0),
+            queueDepth(0),
+            maxQueueDepth(0),
+            maxQueuedBytes(0),
+            stalls(0),
+            stallSeconds(0.0),
+            previewsSent(0),
+            firstFrameSeconds(0.0),
+            socketWrites(0)
+        {
+        }
+
+        //! Buckets accepted by sendPixels()
+        unsigned long bucketsQueued;
+        //! Buckets thrown away because the queue was full
+        unsigned long bucketsDropped;
+        //! Messages written to the socket (a batch counts once)
+        unsigned long messagesSent;
+        //! Pixel bytes sent, before encoding
+        double rawBytes;
+        //! Pixel bytes sent, after encoding
+        double sentBytes;
+        //! Total time spent encoding pixels
+        double encodeSeconds;
+        //! Buckets currently waiting to be sent
+        unsigned long queueDepth;
+        //! The deepest the queue has been
+        unsigned long maxQueueDepth;
+        //! The most payload memory the queue has held, in bytes
+        unsigned long maxQueuedBytes;
+        //! Number of times sendPixels() blocked on a full queue
+        unsigned long stalls;
+        //! Total time sendPixels() spent blocked on a full queue
+        double stallSeconds;
+        //! Bucket previews sent
+        unsigned long previewsSent;
+        /*! Time from openImage() until the whole image had been sent at
+         *  some resolution, or 0 if it hasn't been yet. This assumes each
+         *  bucket is only sent once. */
+        double firstFrameSeconds;
+        //! Writes made to the socket, each a single system call
+        unsigned long socketWrites;
+    };
+
     /*! \class Client
      * \brief Used to send an image to a Server
      *
@@ -45,6 +107,14 @@ namespace rmanconnect
      * an image to the Server. Once it is instantiated the application should
      * call openImage(), send(), and closeImage() to send an image to the
      * Server.
+     *
+     * Pixels are sent from a background thread. sendPixels() copies each
+     * bucket into a pooled buffer and queues it, so the caller never waits
+     * on the network unless the queue has reached its memory limit.
+     *
+     * Normally each image gets a connection of its own, but a persistent
+     * Client (see setPersistent()) keeps its connection, and any shared
+     * memory ring, open between images.
      */
     class Client
     {
@@ -73,29 +143,213 @@ namespace rmanconnect
          * pixel blocks to the Server. The Data object passed must correctly
          * specify the block position and dimensions as well as provide a
          * pointer to pixel data.
+         *
+         * The pixels are copied so the caller may reuse its memory as soon
+         * as this returns. Any error from the sending thread is rethrown
+         * here.
          */
         void sendPixels( Data &data );
 
         /*! \brief Sends a message to the Server that the Clients has finished
          *
          * This tells the Server that a Client has finished sending pixel
-         * information for an image.
+         * information for an image. Any queued pixels are sent first.
          */
         void closeImage();
+
+        /*! \brief Sets the socket options used when connecting.
+         *
+         * noDelay disables Nagle's algorithm on the connection. A buffer
+         * size of zero leaves the operating system default in place. These
+         * must be set before openImage() is called.
+         */
+        void setSocketOptions( bool noDelay, int sendBufferSize=0,
+                               int receiveBufferSize=0 );
+
+        /*! \brief Sets the limits of the send queue.
+         *
+         * maxBytes caps the amount of pixel memory that may be waiting to be
+         * sent. When the cap is reached sendPixels() will block until there
+         * is room, or if dropWhenFull is true it will discard the bucket.
+         */
+        void setQueueOptions( unsigned long maxBytes, bool dropWhenFull=false );
+
+        /*! \brief Sets how queued buckets are gathered into batches.
+         *
+         * The sender packs queued buckets into a single message until it
+         * holds maxBytes of pixels, waiting up to maxMilliseconds after the
+         * first bucket for more to arrive. With maxMilliseconds at zero only
+         * buckets that are already queued are batched. A maxBytes of zero
+         * sends every bucket on its own.
+         */
+        void setBatchOptions( unsigned long maxBytes, float maxMilliseconds=0.f );
+
+        /*! \brief Asks the Server to accept pixels encoded with a codec.
+         *
+         * The codec is negotiated when the next image is opened. If the
+         * Server doesn't support it the pixels are sent unencoded.
+         */
+        void setCodec( PayloadCodec codec );
+
+        /*! \brief Asks the Server to accept pixels in a given sample format.
+         *
+         * With FormatFloat16 each sample is converted to a half-precision
+         * float as it is queued, halving the bandwidth and queue memory at
+         * the cost of precision. The format is negotiated when the next
+         * image is opened.
+         */
+        void setPrecision( SampleFormat format );
+
+        /*! \brief Connects to a Server's local socket instead of host/port.
+         *
+         * If path is not empty the Client will connect to the Unix domain
+         * socket at that path (see Server::connect()) rather than over TCP.
+         * Socket options do not apply to local sockets.
+         */
+        void setSocketPath( std::string path );
+
+        /*! \brief Sets whether pixels may be sent through shared memory.
+         *
+         * When enabled (the default) and the Server turns out to be on the
+         * same host, sendPixels() writes each bucket straight into a
+         * SharedRing the Server provides, and only its header is sent over
+         * the socket. Otherwise, or if the ring can't be set up, the socket
+         * is used as normal. Buckets that are compressed or have previews,
+         * or that the ring has no room for, are queued and sent over the
+         * socket too.
+         */
+        void setSharedMemory( bool enabled );
+
+        /*! \brief Sets whether a preview of each bucket is sent ahead of it.
+         *
+         * With a scale of 2 or more, sendPixels() also queues a copy of each
+         * bucket box-filtered down by scale in each direction. Previews are
+         * sent before any full-resolution buckets that are waiting, so when
+         * the connection can't keep up with the renderer the Server sees a
+         * coarse version of everything rendered so far, which the full
+         * buckets then refine. A scale of 0 or 1 (the default) sends no
+         * previews. This must be set before openImage() is called.
+         */
+        void setPreview( unsigned int scale );
+
+        /*! \brief Records every message sent to the Server in a file.
+         *
+         * The recording holds the exact message stream, with timestamps,
+         * so it can be played back into a Server later by the
+         * rmanconnect_replay tool. Throws a std::runtime_error if the file
+         * can't be written. This must be set before openImage() is called.
+         * An empty path stops any recording being made.
+         */
+        void setRecording( const std::string &path );
+
+        /*! \brief Sets whether the latency of each bucket is traced.
+         *
+         * When enabled, each bucket carries the times at which sendPixels()
+         * queued it and the sender wrote it, so the Server can work out how
+         * long each stage took (see TraceLog). Off by default.
+         */
+        void setTracing( bool enabled );
+
+        /*! \brief Sets whether the connection outlives each image.
+         *
+         * When enabled, closeImage() leaves the connection (and shared
+         * memory ring) open and the next openImage() sends its image down
+         * it, saving a connect and handshake per image. If the Server has
+         * gone away in the meantime openImage() connects again. The
+         * connection is closed when the Client is destroyed. Off by
+         * default.
+         */
+        void setPersistent( bool enabled );
+
+        //! Returns a snapshot of the send queue counters.
+        SendStats stats();
         
     private:
+        // a bucket waiting to be sent
+        struct QueuedBucket
+        {
+            MessageHeader header;
+            // the pixels, or 0 if they were written into the shared memory
+            // ring, at shared
+            std::vector<char> *pixels;
+            const char *shared;
+        };
+
         void connect( std::string host, int port );
         void disconnect();
+        bool isConnected();
+        bool hungUp();
+        void sendOpenImage( Data &header );
+
+        // socket-agnostic I/O on whichever socket is connected
+        bool isLocal();
+        int nativeHandle();
+        void write( const std::vector<boost::asio::const_buffer> &buffers, boost::system::error_code &error );
+        void write( const boost::asio::const_buffer &buffer );
+        void read( const boost::asio::mutable_buffer &buffer );
         void quit();
 
-        // store the port we should connect to
-        std::string mHost;
+        // the background sender
+        void startSender();
+        void stopSender();
+        void sendLoop();
+        bool sendBatch( const std::vector<QueuedBucket> &batch );
+        void countCoverage( const std::vector<QueuedBucket> &batch );
+        std::vector<char> *takeBuffer();
+        void releaseBuffer( std::vector<char> *buffer );
+        void queueBucket( const QueuedBucket &bucket );
+        void releaseBucket( const QueuedBucket &bucket );
+        bool queueShared( Data &data, QueuedBucket &bucket );
+
+        // store the port (or local socket) we should connect to
+        std::string mHost, mSocketPath;
         int mPort, mImageId;
+
+        // the size of the open image, when it was opened and how much of
+        // it has been sent (at any resolution)
+        int mImageWidth, mImageHeight;
+        boost::posix_time::ptime mOpenTime;
+        double mSentArea;
         bool mIsConnected;
 
+        // socket options
+        bool mNoDelay;
+        int mSendBufferSize, mReceiveBufferSize;
+
         // tcp stuff
         boost::asio::io_service mIoService;
         boost::asio::ip::tcp::socket mSocket;
+        boost::asio::local::stream_protocol::socket mLocalSocket;
+
+        // shared memory transport (written by sendPixels())
+        SharedRing mRing;
+        boost::mutex mRingMutex;
+
+        // send queue, and the previews that jump it
+        std::deque<QueuedBucket> mQueue, mPreviewQueue;
+        unsigned int mPreviewScale;
+        std::vector<std::vector<char>*> mPool;
+        unsigned long mQueuedBytes, mMaxQueuedBytes;
+        unsigned long mBatchBytes;
+        float mBatchMilliseconds;
+        PayloadCodec mRequestedCodec, mCodec;
+        SampleFormat mRequestedFormat, mFormat;
+        bool mUseSharedMemory;
+        bool mTracing;
+        bool mPersistent;
+        bool mDropWhenFull, mStopping;
+        std::string mSendError;
+        SendStats mStats;
+        boost::mutex mQueueMutex;
+        boost::condition_variable mQueueNotEmpty, mQueueNotFull;
+        boost::thread mSender;
+
+        // records what we send, if asked to
+        Recorder mRecorder;
+
+        // sender-owned encoding buffers
+        std::vector<MessageHeader> mBatchHeaders;
+        std::vector<std::vector<char> > mEncoded;
     };
 }
 
@@ -0,0 +1,125 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "Codec.h"
+#include <zlib.h>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+using namespace rmanconnect;
+
+namespace
+{
+    // split samples into byte planes
+    void shuffle( const unsigned char *in, size_t bytes, size_t sampleSize, unsigned char *out )
+    {
+        size_t count = bytes / sampleSize;
+        for ( size_t b=0; b<sampleSize; ++b )
+        {
+            unsigned char *plane = out + b*count;
+            const unsigned char *src = in + b;
+            for ( size_t i=0; i<count; ++i, src+=sampleSize )
+                plane[i] = *src;
+        }
+    }
+
+    // interleave byte planes back into samples
+    void unshuffle( const unsigned char *in, size_t bytes, size_t sampleSize, unsigned char *out )
+    {
+        size_t count = bytes / sampleSize;
+        for ( size_t b=0; b<sampleSize; ++b )
+        {
+            const unsigned char *plane = in + b*count;
+            unsigned char *dst = out + b;
+            for ( size_t i=0; i<count; ++i, dst+=sampleSize )
+                *dst = plane[i];
+        }
+    }
+}
+
+PayloadCodec rmanconnect::codecFromName( const char *name )
+{
+    if ( name && std::string(name)=="zlib" )
+        return CodecZlib;
+    return CodecNone;
+}
+
+bool rmanconnect::encodePayload( PayloadCodec codec, const void *data, size_t bytes,
+                                 size_t sampleSize, std::vector<char> &out )
+{
+    if ( codec!=CodecZlib || bytes==0 || bytes%sampleSize!=0 )
+        return false;
+
+    // shuffle into the back half of our output buffer...
+    uLongf bound = compressBound( bytes );
+    out.resize( bound + bytes );
+    unsigned char *shuffled = reinterpret_cast<unsigned char*>(&out[bound]);
+    shuffle( reinterpret_cast<const unsigned char*>(data), bytes, sampleSize, shuffled );
+
+    // ...and deflate into the front half
+    uLongf encoded = bound;
+    if ( compress2( reinterpret_cast<Bytef*>(&out[0]), &encoded, shuffled, bytes, Z_BEST_SPEED )!=Z_OK ||
+         encoded>=bytes )
+        return false;
+    out.resize( encoded );
+    return true;
+}
+
+void rmanconnect::decodePayload( PayloadCodec codec, const char *data, size_t bytes,
+                                 size_t sampleSize, void *out, size_t outBytes,
+                                 std::vector<char> &scratch )
+{
+    switch( codec )
+    {
+        case CodecNone:
+        {
+            if ( bytes!=outBytes )
+                throw std::runtime_error( "Unexpected payload size!" );
+            memcpy( out, data, bytes );
+            break;
+        }
+        case CodecZlib:
+        {
+            scratch.resize( outBytes );
+            unsigned char *shuffled = reinterpret_cast<unsigned char*>(&scratch[0]);
+            uLongf decoded = outBytes;
+            if ( outBytes==0 || outBytes%sampleSize!=0 ||
+                 uncompress( shuffled, &decoded, reinterpret_cast<const Bytef*>(data), bytes )!=Z_OK ||
+                 decoded!=outBytes )
+                throw std::runtime_error( "Could not decode payload!" );
+            unshuffle( shuffled, outBytes, sampleSize, reinterpret_cast<unsigned char*>(out) );
+            break;
+        }
+        default:
+            throw std::runtime_error( "Unknown payload codec!" );
+    }
+}
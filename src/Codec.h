@@ -0,0 +1,77 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef RMAN_CONNECT_CODEC_H_
+#define RMAN_CONNECT_CODEC_H_
+
+#include <vector>
+#include <cstddef>
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    /*! \brief The lossless codecs a pixel payload can be encoded with.
+     *
+     * CodecZlib splits the payload into byte planes (all the first bytes of
+     * each sample, then all the second bytes, etc.) and deflates the result
+     * at the fastest compression level. Grouping the sign/exponent bytes
+     * together makes float images compress far better than deflating the
+     * raw samples.
+     */
+    enum PayloadCodec
+    {
+        CodecNone = 0,
+        CodecZlib = 1
+    };
+
+    //! Returns the codec with the given name ("none" or "zlib"), or CodecNone.
+    PayloadCodec codecFromName( const char *name );
+
+    /*! \brief Encodes a payload of samples each sampleSize bytes wide.
+     *
+     * Returns false, leaving out untouched, if the codec is CodecNone or the
+     * encoded payload would not be any smaller than the original.
+     */
+    bool encodePayload( PayloadCodec codec, const void *data, size_t bytes,
+                        size_t sampleSize, std::vector<char> &out );
+
+    /*! \brief Decodes a payload produced by encodePayload().
+     *
+     * out must point to exactly outBytes of memory, the size of the original
+     * payload. scratch is used as working memory and may be reused between
+     * calls. Throws std::runtime_error if the payload is corrupt.
+     */
+    void decodePayload( PayloadCodec codec, const char *data, size_t bytes,
+                        size_t sampleSize, void *out, size_t outBytes,
+                        std::vector<char> &scratch );
+}
+
+#endif // RMAN_CONNECT_CODEC_H_
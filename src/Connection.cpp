@@ -0,0 +1,790 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Connection.h"
+#include "Server.h"
+#include "Codec.h"
+#include "Half.h"
+#include "Trace.h"
+#include <boost/bind.hpp>
+#include <boost/make_shared.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <sstream>
+#include <cstring>
+#include <unistd.h>
+#include <stdexcept>
+
+using namespace rmanconnect;
+using boost::asio::ip::tcp;
+
+namespace
+{
+    // the size of the shared memory ring offered to local clients
+    const unsigned int SharedRingCapacity = 32*1024*1024;
+
+    // the largest payload we'll allocate memory for
+    const unsigned int MaxPayloadSize = 512*1024*1024;
+
+    // transfers everything, like transfer_all(), counting the reads it
+    // takes (our read handlers all run on the Server's strand, so the
+    // count needs no lock)
+    class CountReads
+    {
+    public:
+        CountReads( unsigned long &count ) : mCount( &count ) {}
+
+        template<typename Error>
+        size_t operator()( const Error &error, size_t transferred )
+        {
+            size_t size = boost::asio::transfer_all()( error, transferred );
+            if ( size>0 )
+                ++*mCount;
+            return size;
+        }
+
+    private:
+        unsigned long *mCount;
+    };
+
+    // is this message's payload waiting in the shared memory ring? (an
+    // open-image message uses the flag to ask for a ring instead, and a
+    // batch to say its blocks' pixels are there)
+    bool inRing( const MessageHeader &msg )
+    {
+        return ( msg.flags & MsgFlagSharedMemory ) && msg.type!=MsgOpenImage && msg.type!=MsgBatch;
+    }
+
+    // is this a batch of headers whose pixels are in the shared memory ring?
+    bool sharedBatch( const MessageHeader &msg )
+    {
+        return ( msg.flags & MsgFlagSharedMemory ) && msg.type==MsgBatch;
+    }
+
+    // can this message's pixels be read straight into a Data object?
+    bool readInPlace( const MessageHeader &msg )
+    {
+        return ( msg.type==MsgPixels || msg.type==MsgPreview || msg.type==MsgBatch ) &&
+               msg.codec==CodecNone && msg.format==FormatFloat32 && !sharedBatch( msg );
+    }
+
+    // the block of pixels a pixels or preview message carries
+    Region messageRegion( const MessageHeader &msg, unsigned int offset )
+    {
+        BlockTimes times = { msg.enqueued, msg.sent, 0 };
+        Region region = { msg.x, msg.y, msg.width, msg.height, msg.spp, offset,
+                          msg.type==MsgPreview ? static_cast<int>(msg.scale) : 1, times };
+        return region;
+    }
+
+    // the number of samples in a block of pixels (fewer for a preview), or
+    // 0 if it makes no sense or would decode to more than MaxPayloadSize.
+    // The size comes from the client, so it's worked out in 64 bits before
+    // we trust it.
+    int numSamples( const Region &region )
+    {
+        if ( region.width<=0 || region.height<=0 || region.spp<=0 || region.scale<1 )
+            return 0;
+        boost::uint64_t scale = region.scale;
+        boost::uint64_t samples = ( ( region.width + scale - 1 ) / scale ) *
+                                  ( ( region.height + scale - 1 ) / scale ) *
+                                  static_cast<boost::uint64_t>(region.spp);
+        if ( samples * sizeof(float) > MaxPayloadSize )
+            return 0;
+        return static_cast<int>(samples);
+    }
+
+    // reads and checks the header of the block at pos in a batch, leaving
+    // pos at the next block. Returns the block's payload, or 0 if it's in
+    // the shared memory ring.
+    const char *nextBlock( const MessageHeader &msg, const char *payload, unsigned int &pos, MessageHeader &sub )
+    {
+        if ( pos + sizeof(sub) > msg.payloadSize )
+            throw std::runtime_error( "Truncated batch!" );
+        memcpy( &sub, payload + pos, sizeof(sub) );
+        pos += sizeof(sub);
+        bool shared = sharedBatch( msg );
+        size_t sample_size = msg.format==FormatFloat16 ? sizeof(boost::uint16_t) : sizeof(float);
+        int sub_samples = numSamples( messageRegion(sub, 0) );
+        if ( !sub.valid() || ( sub.type!=MsgPixels && sub.type!=MsgPreview ) || sub_samples<=0 ||
+             sub.format!=msg.format || ( !shared && pos + sub.payloadSize > msg.payloadSize ) ||
+             ( sub.codec==CodecNone && sub.payloadSize!=sample_size*sub_samples ) ||
+             ( msg.codec==CodecNone && sub.codec!=CodecNone ) )
+            throw std::runtime_error( "Malformed batch!" );
+        if ( shared )
+            return 0;
+        pos += sub.payloadSize;
+        return payload + pos - sub.payloadSize;
+    }
+
+    // a buffer sequence that refers to a vector of buffers, so an
+    // asynchronous read doesn't take a copy of it
+    struct BufferRef
+    {
+        typedef boost::asio::mutable_buffer value_type;
+        typedef std::vector<boost::asio::mutable_buffer>::const_iterator const_iterator;
+
+        BufferRef( const std::vector<boost::asio::mutable_buffer> &buffers ) : buffers(&buffers) {}
+        const_iterator begin() const { return buffers->begin(); }
+        const_iterator end() const { return buffers->end(); }
+
+        const std::vector<boost::asio::mutable_buffer> *buffers;
+    };
+}
+
+Connection::Connection( Server &server ) :
+        mServer( server ),
+        mSocket( server.mIoService ),
+        mLocalSocket( server.mIoService ),
+        mReceived( 0 ),
+        mImageId( -1 ),
+        mUndelivered( 0 ),
+        mPaused( false ),
+        mSpanned( false ),
+        mSinking( false )
+{
+    mServer.addPending();
+}
+
+Connection::~Connection()
+{
+    close();
+    mServer.removePending();
+}
+
+void Connection::close()
+{
+    boost::system::error_code error;
+    mSocket.close( error );
+    mLocalSocket.close( error );
+    if ( mRing.isOpen() )
+    {
+        mRing.unlink();
+        mRing.close();
+    }
+    mImageId = -1;
+}
+
+template<typename Buffers, typename Handler>
+void Connection::asyncRead( const Buffers &buffers, Handler handler )
+{
+    // (our handlers run on the Server's strand, like all of its others)
+    if ( mLocalSocket.is_open() )
+        boost::asio::async_read( mLocalSocket, buffers, CountReads(mStats.socketReads),
+                                 mServer.mStrand.wrap(handler) );
+    else
+        boost::asio::async_read( mSocket, buffers, CountReads(mStats.socketReads),
+                                 mServer.mStrand.wrap(handler) );
+}
+
+template<typename Buffers, typename Handler>
+void Connection::asyncWrite( const Buffers &buffers, Handler handler )
+{
+    if ( mLocalSocket.is_open() )
+        boost::asio::async_write( mLocalSocket, buffers, mServer.mStrand.wrap(handler) );
+    else
+        boost::asio::async_write( mSocket, buffers, mServer.mStrand.wrap(handler) );
+}
+
+template<typename T>
+void Connection::reserve( std::vector<T> &buffer, size_t size )
+{
+    if ( size>buffer.capacity() )
+        mStats.allocations++;
+    buffer.resize( size );
+}
+
+void Connection::allocate( Data &d, size_t size )
+{
+    bool allocated = false;
+    d.mPixelStore = mServer.mPool.acquire( size, &allocated );
+    if ( allocated )
+        mStats.allocations++;
+}
+
+void Connection::start()
+{
+    if ( mSocket.is_open() )
+    {
+        boost::system::error_code error;
+        mSocket.set_option( tcp::no_delay(true), error );
+    }
+    readHeader();
+}
+
+void Connection::fail()
+{
+    // let the consumer know the image it was receiving has gone
+    if ( mImageId>=0 )
+    {
+        boost::shared_ptr<Data> d( new Data );
+        d->mType = MsgCloseImage;
+        d->mImageId = mImageId;
+        mServer.deliver( shared_from_this(), d );
+    }
+    close();
+    mServer.finished( shared_from_this() );
+}
+
+void Connection::readHeader()
+{
+    if ( !mSocket.is_open() && !mLocalSocket.is_open() )
+        return;
+
+    asyncRead( boost::asio::buffer(reinterpret_cast<char*>(&mHeader), sizeof(mHeader)),
+               boost::bind(&Connection::handleHeader, shared_from_this(),
+                           boost::asio::placeholders::error) );
+}
+
+void Connection::handleHeader( const boost::system::error_code &error )
+{
+    if ( error || !mHeader.valid() || mHeader.payloadSize>MaxPayloadSize )
+    {
+        fail();
+        return;
+    }
+
+    // pixels go to the server's sink if it has one, anything else
+    // becomes a Data object
+    mSinking = mServer.mSink!=0 &&
+               ( mHeader.type==MsgPixels || mHeader.type==MsgPreview || mHeader.type==MsgBatch );
+    mSpanned = false;
+    if ( !mSinking )
+    {
+        // reuse our last Data object if listen() has finished with it
+        if ( mData && mData.unique() )
+            *mData = Data();
+        else
+        {
+            mData = boost::make_shared<Data>();
+            mStats.allocations++;
+        }
+    }
+
+    // payloads in the shared memory ring can be used where they are
+    if ( mHeader.payloadSize==0 || inRing(mHeader) )
+    {
+        handlePayload( boost::system::error_code() );
+        return;
+    }
+
+    // otherwise read the payload, straight into place if we can
+    char *payload = 0;
+    if ( mSinking && mHeader.type==MsgPixels && readInPlace(mHeader) )
+    {
+        Region region = messageRegion( mHeader, 0 );
+        int num_samples = numSamples( region );
+        if ( mImageId<0 || num_samples<=0 ||
+             mHeader.payloadSize!=sizeof(float)*num_samples )
+        {
+            fail();
+            return;
+        }
+
+        // a single block can go straight into the sink's span, a row at
+        // a time
+        if ( mServer.mSink->span( mImageId, region, mSpan ) )
+        {
+            size_t row_size = sizeof(float) * mHeader.width * mHeader.spp;
+            reserve( mRows, mHeader.height );
+            for ( int i=0; i<mHeader.height; ++i )
+                mRows[i] = boost::asio::buffer( mSpan.data + i*mSpan.rowStride, row_size );
+            mSpanned = true;
+            asyncRead( BufferRef(mRows),
+                       boost::bind(&Connection::handlePayload, shared_from_this(),
+                                   boost::asio::placeholders::error) );
+            return;
+        }
+
+        // or into our staging memory
+        reserve( mStaging, num_samples );
+        payload = reinterpret_cast<char*>( &mStaging[0] );
+    }
+    else if ( !mSinking && readInPlace(mHeader) )
+    {
+        if ( mHeader.payloadSize%sizeof(float)!=0 )
+        {
+            fail();
+            return;
+        }
+        allocate( *mData, mHeader.payloadSize/sizeof(float) );
+        payload = reinterpret_cast<char*>( mData->mPixelStore.data() );
+    }
+    else
+    {
+        reserve( mEncoded, mHeader.payloadSize );
+        payload = &mEncoded[0];
+    }
+    asyncRead( boost::asio::buffer(payload, mHeader.payloadSize),
+               boost::bind(&Connection::handlePayload, shared_from_this(),
+                           boost::asio::placeholders::error) );
+}
+
+void Connection::handlePayload( const boost::system::error_code &error )
+{
+    // (the server may have closed us while this was waiting to be run)
+    if ( error || ( !mSocket.is_open() && !mLocalSocket.is_open() ) )
+    {
+        fail();
+        return;
+    }
+
+    // note when a traced message arrived
+    mReceived = ( mHeader.flags & MsgFlagTraced ) ? traceClock() : 0;
+
+    const char *payload = 0;
+    try
+    {
+        if ( inRing(mHeader) )
+        {
+            payload = ringPayload( mHeader.payloadSize );
+        }
+        else if ( mSinking && mHeader.type==MsgPixels && readInPlace(mHeader) )
+        {
+            if ( !mSpanned )
+                payload = reinterpret_cast<const char*>( &mStaging[0] );
+        }
+        else if ( !mSinking && readInPlace(mHeader) )
+        {
+            payload = reinterpret_cast<const char*>( mData->mPixelStore.data() );
+        }
+        else if ( mHeader.payloadSize>0 )
+        {
+            payload = &mEncoded[0];
+        }
+    }
+    catch( ... )
+    {
+        fail();
+        return;
+    }
+
+    // hand pixels straight to the sink, then carry on reading
+    if ( mSinking )
+    {
+        try
+        {
+            if ( mHeader.type==MsgBatch )
+                sinkBatch( payload );
+            else
+                sinkPixels( payload );
+            if ( inRing(mHeader) )
+                mRing.release( mHeader.payloadSize );
+        }
+        catch( ... )
+        {
+            fail();
+            return;
+        }
+        mServer.sunk( *this, mImageId );
+        readHeader();
+        return;
+    }
+
+    Data &d = *mData;
+    try
+    {
+        switch( mHeader.type )
+        {
+            case MsgOpenImage: // open image
+                openImage( d, payload );
+                break;
+            case MsgPixels: // image data
+            case MsgPreview: // a preview of some image data
+                pixels( d, payload );
+                break;
+            case MsgBatch: // several blocks of image data
+                batch( d, payload );
+                break;
+            case MsgCloseImage: // close image
+                d.mType = mHeader.type;
+                d.mImageId = mImageId;
+                mImageId = -1;
+                break;
+            case MsgQuit: // quit
+                d.mType = mHeader.type;
+                break;
+            default:
+                throw std::runtime_error( "Unknown message type!" );
+        }
+
+        // let the client reuse the ring space
+        if ( inRing(mHeader) && mRing.isOpen() )
+            mRing.release( mHeader.payloadSize );
+    }
+    catch( ... )
+    {
+        fail();
+        return;
+    }
+
+    // reply to an open-image message before handing it over, so the
+    // consumer never sees pixels for an image before it's been opened
+    if ( mHeader.type==MsgOpenImage )
+    {
+        std::vector<boost::asio::const_buffer> buffers;
+        buffers.push_back( boost::asio::buffer(reinterpret_cast<const char*>(&mReply), sizeof(mReply)) );
+        buffers.push_back( boost::asio::buffer(mRingName) );
+        asyncWrite( buffers, boost::bind(&Connection::handleReply, shared_from_this(),
+                                         boost::asio::placeholders::error) );
+        return;
+    }
+
+    handleReply( boost::system::error_code() );
+}
+
+void Connection::handleReply( const boost::system::error_code &error )
+{
+    if ( error )
+    {
+        fail();
+        return;
+    }
+
+    // carry on reading unless the consumer has fallen too far behind, in
+    // which case the Server will restart us once it's caught up
+    if ( mServer.deliver( shared_from_this(), mData ) )
+        readHeader();
+}
+
+void Connection::openImage( Data &d, const char *payload )
+{
+    // start a new image, dropping any the client left open. A client that
+    // keeps its connection between images keeps its ring too.
+    bool keep_ring = mRing.isOpen() && ( mHeader.flags & MsgFlagSharedMemory );
+    if ( mRing.isOpen() && !keep_ring )
+    {
+        mRing.unlink();
+        mRing.close();
+        mRingName = "";
+    }
+    mImageId = mServer.nextImageId();
+
+    // send back the image id
+    mReply = MessageHeader( MsgOpenImage );
+    mReply.imageId = mImageId;
+    mReply.codec = mHeader.codec<=CodecZlib ? mHeader.codec : static_cast<boost::uint16_t>(CodecNone);
+    mReply.format = mHeader.format<=FormatFloat16 ? mHeader.format : static_cast<boost::uint16_t>(FormatFloat32);
+
+    // if the client is on this host offer it a shared memory ring to send
+    // pixels through
+    if ( keep_ring )
+    {
+        mReply.flags |= MsgFlagSharedMemory;
+        mReply.payloadSize = mRingName.size();
+    }
+    else if ( mHeader.flags & MsgFlagSharedMemory )
+    {
+        std::stringstream ss;
+        ss << "/rmanconnect." << getpid() << "." << mServer.getPort() << "." << mImageId;
+        try
+        {
+            mRing.create( ss.str(), SharedRingCapacity );
+            mRingName = ss.str();
+            mReply.flags |= MsgFlagSharedMemory;
+            mReply.payloadSize = mRingName.size();
+        }
+        catch( ... )
+        {
+            // the client will fall back to the socket
+        }
+    }
+
+    // create data object
+    d.mType = mHeader.type;
+    d.mImageId = mImageId;
+    d.mWidth = mHeader.width;
+    d.mHeight = mHeader.height;
+    d.mSpp = mHeader.spp;
+
+    // along with its channel names, if there's one for every sample
+    std::vector<std::string> names;
+    unsigned int pos = 0;
+    while ( pos < mHeader.payloadSize )
+    {
+        const char *name = payload + pos;
+        const char *end = static_cast<const char*>( memchr(name, '\0', mHeader.payloadSize - pos) );
+        if ( !end )
+            break;
+        names.push_back( std::string(name, end) );
+        pos += names.back().size() + 1;
+    }
+    if ( names.size()==d.mSpp )
+        d.mChannels.swap( names );
+}
+
+void Connection::decode( int codec, int format, const char *data, unsigned int size, float *out, unsigned int num_samples )
+{
+    mStats.buckets++;
+    mStats.receivedBytes += size;
+    mStats.decodedBytes += sizeof(float)*num_samples;
+    if ( codec!=CodecNone )
+        mStats.encodedBuckets++;
+
+    size_t scratch_size = mDecodeScratch.capacity();
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    if ( format==FormatFloat16 )
+    {
+        // decode the halfs then expand them back to floats
+        reserve( mHalfs, num_samples );
+        decodePayload( static_cast<PayloadCodec>(codec), data, size, sizeof(boost::uint16_t),
+                       &mHalfs[0], sizeof(boost::uint16_t)*num_samples, mDecodeScratch );
+        halfToFloat( &mHalfs[0], out, num_samples );
+    }
+    else
+    {
+        decodePayload( static_cast<PayloadCodec>(codec), data, size, sizeof(float),
+                       out, sizeof(float)*num_samples, mDecodeScratch );
+    }
+    mStats.decodeSeconds += (boost::posix_time::microsec_clock::universal_time() - start).total_microseconds() / 1000000.0;
+    if ( mDecodeScratch.capacity()!=scratch_size )
+        mStats.allocations++;
+}
+
+void Connection::pixels( Data &d, const char *payload )
+{
+    if ( mImageId<0 )
+        throw std::runtime_error( "Pixels sent without an open image!" );
+
+    // get data info
+    d.mType = mHeader.type;
+    d.mImageId = mImageId;
+    d.mX = mHeader.x;
+    d.mY = mHeader.y;
+    d.mWidth = mHeader.width;
+    d.mHeight = mHeader.height;
+    d.mSpp = mHeader.spp;
+
+    // get pixels
+    Region region = messageRegion( mHeader, 0 );
+    stamp( region );
+    int num_samples = numSamples( region );
+    if ( num_samples<=0 )
+        throw std::runtime_error( "Unexpected payload size!" );
+    if ( readInPlace(mHeader) )
+    {
+        if ( mHeader.payloadSize!=sizeof(float)*num_samples )
+            throw std::runtime_error( "Unexpected payload size!" );
+        if ( inRing(mHeader) )
+        {
+            allocate( d, num_samples );
+            memcpy( d.mPixelStore.data(), payload, mHeader.payloadSize );
+            mStats.copiedBytes += mHeader.payloadSize;
+        }
+        mStats.buckets++;
+        mStats.receivedBytes += mHeader.payloadSize;
+        mStats.decodedBytes += mHeader.payloadSize;
+    }
+    else
+    {
+        allocate( d, num_samples );
+        decode( mHeader.codec, mHeader.format, payload, mHeader.payloadSize, d.mPixelStore.data(), num_samples );
+    }
+
+    mStats.allocations++;
+    d.mRegions.push_back( region );
+}
+
+void Connection::batch( Data &d, const char *payload )
+{
+    if ( mImageId<0 )
+        throw std::runtime_error( "Pixels sent without an open image!" );
+
+    // the whole batch has been read in one go, headers and all. If nothing
+    // is encoded the pixels can stay where they landed.
+    const MessageHeader &msg = mHeader;
+    d.mImageId = mImageId;
+    bool in_place = readInPlace( msg );
+
+    // walk the packed headers once to check them and count the blocks,
+    // which must all be pixels or all previews
+    unsigned int pos = 0, num_blocks = 0, num_samples = 0;
+    MessageHeader sub;
+    d.mType = MsgPixels;
+    while ( pos < msg.payloadSize )
+    {
+        nextBlock( msg, payload, pos, sub );
+        if ( num_blocks==0 )
+            d.mType = sub.type;
+        else if ( sub.type!=d.mType )
+            throw std::runtime_error( "Malformed batch!" );
+        num_samples += numSamples( messageRegion(sub, 0) );
+        if ( num_samples > MaxPayloadSize/sizeof(float) )
+            throw std::runtime_error( "Batch too large!" );
+        num_blocks++;
+    }
+    if ( num_blocks>d.mRegions.capacity() )
+        mStats.allocations++;
+    d.mRegions.reserve( num_blocks );
+    if ( !in_place )
+        allocate( d, num_samples );
+
+    // then again to find each block, decoding it into our pixel store if
+    // it's not already there
+    pos = 0;
+    num_samples = 0;
+    while ( pos < msg.payloadSize )
+    {
+        const char *data = nextBlock( msg, payload, pos, sub );
+        Region region = messageRegion( sub, in_place ? ( data - payload )/sizeof(float) : num_samples );
+        stamp( region );
+        int sub_samples = numSamples( region );
+        d.mRegions.push_back( region );
+        if ( in_place )
+        {
+            mStats.buckets++;
+            mStats.receivedBytes += sizeof(float)*sub_samples;
+            mStats.decodedBytes += sizeof(float)*sub_samples;
+        }
+        else if ( !data )
+        {
+            // each block's pixels are the next record in the ring
+            decode( sub.codec, sub.format, ringPayload( sub.payloadSize ), sub.payloadSize,
+                    d.mPixelStore.data() + region.offset, sub_samples );
+            mRing.release( sub.payloadSize );
+            mStats.copiedBytes += sub.payloadSize;
+        }
+        else
+        {
+            decode( sub.codec, sub.format, data, sub.payloadSize,
+                    d.mPixelStore.data() + region.offset, sub_samples );
+        }
+        num_samples += sub_samples;
+    }
+    if ( !d.mRegions.empty() )
+    {
+        d.mX = d.mRegions[0].x;
+        d.mY = d.mRegions[0].y;
+        d.mWidth = d.mRegions[0].width;
+        d.mHeight = d.mRegions[0].height;
+        d.mSpp = d.mRegions[0].spp;
+    }
+}
+
+void Connection::stamp( Region &region )
+{
+    // only trust the times of a message that says it's traced, and give
+    // the blocks in a batch the time the batch was sent
+    if ( !( mHeader.flags & MsgFlagTraced ) )
+    {
+        region.times.enqueued = region.times.sent = 0;
+        return;
+    }
+    if ( region.times.sent==0 )
+        region.times.sent = mHeader.sent;
+    region.times.received = mReceived;
+}
+
+void Connection::sinkPixels( const char *payload )
+{
+    if ( mImageId<0 )
+        throw std::runtime_error( "Pixels sent without an open image!" );
+    Region region = messageRegion( mHeader, 0 );
+    stamp( region );
+    if ( numSamples(region)<=0 )
+        throw std::runtime_error( "Unexpected payload size!" );
+
+    if ( mSpanned )
+    {
+        // it's already been read into place
+        mStats.buckets++;
+        mStats.receivedBytes += mHeader.payloadSize;
+        mStats.decodedBytes += mHeader.payloadSize;
+        mServer.mSink->written( mImageId, region );
+    }
+    else
+        sinkBlock( region, mHeader.codec, mHeader.format, payload, mHeader.payloadSize );
+}
+
+void Connection::sinkBatch( const char *payload )
+{
+    if ( mImageId<0 )
+        throw std::runtime_error( "Pixels sent without an open image!" );
+
+    unsigned int pos = 0;
+    MessageHeader sub;
+    while ( pos < mHeader.payloadSize )
+    {
+        const char *data = nextBlock( mHeader, payload, pos, sub );
+        Region region = messageRegion( sub, 0 );
+        stamp( region );
+        if ( data )
+            sinkBlock( region, sub.codec, sub.format, data, sub.payloadSize );
+        else
+        {
+            sinkBlock( region, sub.codec, sub.format, ringPayload( sub.payloadSize ), sub.payloadSize );
+            mRing.release( sub.payloadSize );
+        }
+    }
+}
+
+const char *Connection::ringPayload( unsigned int size )
+{
+    if ( !mRing.isOpen() || !mRing.fits(size) )
+        throw std::runtime_error( "No shared memory ring for payload!" );
+    return mRing.front( size );
+}
+
+void Connection::sinkBlock( const Region &region, int codec, int format, const char *data, unsigned int size )
+{
+    // use the pixels where they are if we can, otherwise decode them into
+    // our staging memory
+    unsigned int num_samples = numSamples( region );
+    const float *pixels = reinterpret_cast<const float*>( data );
+    if ( codec==CodecNone && format==FormatFloat32 )
+    {
+        if ( size!=sizeof(float)*num_samples )
+            throw std::runtime_error( "Unexpected payload size!" );
+        mStats.buckets++;
+        mStats.receivedBytes += size;
+        mStats.decodedBytes += size;
+    }
+    else
+    {
+        reserve( mStaging, num_samples );
+        decode( codec, format, data, size, &mStaging[0], num_samples );
+        pixels = &mStaging[0];
+    }
+
+    // previews never go into a span
+    PixelSink &sink = *mServer.mSink;
+    PixelSpan span;
+    if ( region.scale!=1 )
+        sink.preview( mImageId, region, pixels );
+    else if ( sink.span( mImageId, region, span ) )
+    {
+        size_t row_size = region.width * region.spp;
+        for ( int i=0; i<region.height; ++i )
+            memcpy( span.data + i*span.rowStride, pixels + i*row_size, sizeof(float)*row_size );
+        mStats.copiedBytes += sizeof(float)*num_samples;
+        sink.written( mImageId, region );
+    }
+    else
+        sink.pixels( mImageId, region, pixels );
+}
@@ -0,0 +1,170 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RMAN_CONNECT_CONNECTION_H_
+#define RMAN_CONNECT_CONNECTION_H_
+
+#include "Data.h"
+#include "Message.h"
+#include "PixelSink.h"
+#include "Server.h"
+#include "SharedRing.h"
+#include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/shared_ptr.hpp>
+#include <string>
+#include <vector>
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    /*! \class Connection
+     * \brief One Client connected to a Server.
+     *
+     * Each Connection reads its Client's messages asynchronously while the
+     * Server is listening, turns each one into a Data object and hands it to
+     * the Server to be returned from Server::listen() (or given to its
+     * Listener). Connections never block one another: a Client that sends
+     * slowly only delays its own messages, and a Connection with too many
+     * messages waiting to be listened to stops reading until the consumer
+     * catches up, which pushes back on that Client alone.
+     *
+     * If the Server has a PixelSink, pixels skip the Data object and are
+     * read straight into the span the sink gives for them, or into
+     * memory the Connection reuses for every message.
+     */
+    class Connection : public boost::enable_shared_from_this<Connection>
+    {
+    public:
+        //! Constructor
+        Connection( Server &server );
+        //! Destructor. Closes the connection.
+        ~Connection();
+
+        //! The socket a TCP Client is accepted on.
+        boost::asio::ip::tcp::socket &socket(){ return mSocket; }
+        //! The socket a local Client is accepted on.
+        boost::asio::local::stream_protocol::socket &localSocket(){ return mLocalSocket; }
+
+        //! Starts reading messages once a socket has been accepted.
+        void start();
+        //! Closes the sockets and any shared memory ring.
+        void close();
+
+    private:
+        friend class Server;
+
+        // the asynchronous read loop
+        void readHeader();
+        void handleHeader( const boost::system::error_code &error );
+        void handlePayload( const boost::system::error_code &error );
+        void handleReply( const boost::system::error_code &error );
+        void fail();
+
+        // turn the message just read into a Data object
+        void openImage( Data &d, const char *payload );
+        void pixels( Data &d, const char *payload );
+        void batch( Data &d, const char *payload );
+        void decode( int codec, int format, const char *data, unsigned int size, float *out, unsigned int num_samples );
+
+        // fill in when a block of the message just read was sent and received
+        void stamp( Region &region );
+
+        // hand pixels to the Server's PixelSink instead
+        void sinkPixels( const char *payload );
+        void sinkBatch( const char *payload );
+        void sinkBlock( const Region &region, int codec, int format, const char *data, unsigned int size );
+
+        // the next record in the shared memory ring, which must be size long
+        const char *ringPayload( unsigned int size );
+
+        // sizes a buffer we reuse, counting any allocation
+        template<typename T>
+        void reserve( std::vector<T> &buffer, size_t size );
+
+        // gives a Data object pixel storage from the Server's pool
+        void allocate( Data &d, size_t size );
+
+        // socket-agnostic asynchronous I/O on whichever socket is connected
+        template<typename Buffers, typename Handler>
+        void asyncRead( const Buffers &buffers, Handler handler );
+        template<typename Buffers, typename Handler>
+        void asyncWrite( const Buffers &buffers, Handler handler );
+
+        // the server that accepted us
+        Server &mServer;
+
+        // boost::asio sockets, only one of which is ever open
+        boost::asio::ip::tcp::socket mSocket;
+        boost::asio::local::stream_protocol::socket mLocalSocket;
+
+        // the message being read and the Data object it's becoming, and
+        // when it arrived if it's being traced
+        MessageHeader mHeader;
+        boost::shared_ptr<Data> mData;
+        boost::uint64_t mReceived;
+
+        // our reply to an open-image message
+        MessageHeader mReply;
+        std::string mRingName;
+
+        // the image this client has open, or -1
+        int mImageId;
+
+        // messages delivered to the Server that haven't been listened to yet,
+        // and whether we've stopped reading until they are (guarded by the
+        // Server's queue mutex)
+        unsigned int mUndelivered;
+        bool mPaused;
+
+        // shared memory ring for a client on this host
+        SharedRing mRing;
+
+        // scratch memory for reading and decoding payloads
+        std::vector<char> mEncoded, mDecodeScratch;
+        std::vector<boost::uint16_t> mHalfs;
+
+        // pixels waiting for our sink, and the rows of the span they're
+        // being read into (if mSpanned)
+        std::vector<float> mStaging;
+        std::vector<boost::asio::mutable_buffer> mRows;
+        PixelSpan mSpan;
+        bool mSpanned;
+
+        // is the message being read going to the Server's PixelSink?
+        bool mSinking;
+
+        // counters for this message, added to the Server's once it's read
+        ReceiveStats mStats;
+    };
+}
+
+#endif // RMAN_CONNECT_CONNECTION_H_
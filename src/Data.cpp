@@ -38,11 +38,13 @@ Data::Data( int x, int y,
             int width, int height, 
             int spp, const float *data ) :
     mType(-1),
+    mImageId(-1),
     mX(x),
     mY(y),
     mWidth(width),
     mHeight(height),
-    mSpp(spp)
+    mSpp(spp),
+    mpData(0)
 {
     if ( data!=0 )
         mpData = const_cast<float*>(data);
@@ -31,11 +31,50 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #ifndef RMAN_CONNECT_DATA_H_
 #define RMAN_CONNECT_DATA_H_
 
+#include "PayloadPool.h"
+#include <boost/cstdint.hpp>
+#include <string>
 #include <vector>
 
 //! \namespace rmanconnect
 namespace rmanconnect
 {
+    /*! \struct BlockTimes
+     * \brief When a traced block of pixels passed each stage on its way to a Server.
+     *
+     * Each is a traceClock() time, or 0 if the block wasn't traced (see
+     * Client::setTracing()).
+     */
+    struct BlockTimes
+    {
+        //! Queued by Client::sendPixels()
+        boost::uint64_t enqueued;
+        //! Written to the socket (or shared memory ring)
+        boost::uint64_t sent;
+        //! Read by the Server
+        boost::uint64_t received;
+    };
+
+    /*! \struct Region
+     * \brief Describes one block of pixels within a server-side Data object.
+     *
+     * offset is the index into Data::pixels() of the region's first sample.
+     *
+     * scale is 1 for full-resolution pixels. A preview region covers the
+     * same part of the image at 1/scale of the resolution, so it holds
+     * ceil(width/scale) by ceil(height/scale) pixels.
+     *
+     * times says when the block was sent and received, if it was traced.
+     */
+    struct Region
+    {
+        int x, y;
+        int width, height, spp;
+        unsigned int offset;
+        int scale;
+        BlockTimes times;
+    };
+
     /*! \class Data
      * \brief Represents image information passed from Client to Server
      *
@@ -51,6 +90,7 @@ namespace rmanconnect
     class Data
     {
     friend class Client;
+    friend class Connection;
     friend class Server;
     public:
         //! Constructor
@@ -65,9 +105,18 @@ namespace rmanconnect
          * 0: image open
          * 1: pixels
          * 2: image close
+         * 4: preview pixels (see Region::scale)
          */
         const int type() const { return mType; }
 
+        /*! \brief The image this Data belongs to (server-side).
+         *
+         * A Server can receive several images at once, from different
+         * Clients. Each image opened is given a unique id, and every Data
+         * returned by Server::listen() for it carries the same id.
+         */
+        int imageId() const { return mImageId; }
+
         //! X position
         int x() const { return mX; }
         //! y position
@@ -78,26 +127,59 @@ namespace rmanconnect
         int height() const { return mHeight; }
         //! Samples-per-pixel, aka channel depth
         int spp() const { return mSpp; }
+        /*! \brief The names of the image's channels, one per sample.
+         *
+         * Set on the Data passed to Client::openImage() and returned with the
+         * image open message by Server::listen(). May be empty if the
+         * Client didn't name them.
+         */
+        const std::vector<std::string> &channels() const { return mChannels; }
+        //! Sets the names of the image's channels (client-side)
+        void setChannels( const std::vector<std::string> &channels ){ mChannels = channels; }
         //! Pointer to pixel data owned by the display driver (client-side)
         const float *data() const { return mpData; }
-        //! Pointer to pixel data owned by this object (server-side)
-        const float *pixels() const { return &mPixelStore[0]; }
+        /*! \brief Pointer to pixel data owned by this object (server-side)
+         *
+         * The pixels are held in a Payload from the Server's PayloadPool,
+         * so copying a Data shares them rather than copying them, and they
+         * go back to the pool once the last copy is gone.
+         */
+        const float *pixels() const { return mPixelStore.data(); }
+
+        /*! \brief The number of pixel blocks held by this object.
+         *
+         * A pixels message received by the Server may carry a batch of
+         * several blocks. Each one is described by region() and can be
+         * found at pixels() + region(i).offset.
+         */
+        unsigned int numRegions() const { return mRegions.size(); }
+        //! Position, size and pixel offset of block i (server-side)
+        const Region &region( unsigned int i ) const { return mRegions[i]; }
 
     private:
         // what type of data is this?
         int mType;
 
+        // the image this data belongs to
+        int mImageId;
+
         // x & y position
         int mX, mY; 
         
         // width, height, num channels (samples)
         unsigned int mWidth, mHeight, mSpp;
 
+        // the name of each channel
+        std::vector<std::string> mChannels;
+
         // our pixel data pointer (for driver-owned pixels)
         float *mpData; 
 
-        // our persistent pixel storage (for Data-owned pixels)
-        std::vector<float> mPixelStore;
+        // our pooled pixel storage (for Data-owned pixels)
+        Payload mPixelStore;
+
+        // the blocks of pixels held in mPixelStore
+        std::vector<Region> mRegions;
     };
 }
 
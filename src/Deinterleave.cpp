@@ -0,0 +1,165 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Deinterleave.h"
+#include <cstring>
+
+#ifdef __SSE2__
+#define RMAN_CONNECT_SSE
+#include <emmintrin.h>
+#endif
+
+using namespace rmanconnect;
+
+namespace
+{
+    // the generic loop, unrolled by the compiler when SPP is known
+    template<unsigned int SPP>
+    void deinterleaveScalar( const float *in, unsigned int spp,
+                             float *const *out, unsigned int channels, size_t count )
+    {
+        if ( SPP!=0 )
+            spp = channels = SPP;
+        for ( unsigned int c=0; c<channels; ++c )
+        {
+            const float *src = in + c;
+            float *dst = out[c];
+            for ( size_t i=0; i<count; ++i )
+                dst[i] = src[i*spp];
+        }
+    }
+
+    template<unsigned int SPP>
+    void deinterleaveSIMD( const float *in, float *const *out, size_t count )
+    {
+        deinterleaveScalar<SPP>( in, SPP, out, SPP, count );
+    }
+
+#ifdef RMAN_CONNECT_SSE
+    template<>
+    void deinterleaveSIMD<4>( const float *in, float *const *out, size_t count )
+    {
+        float *r = out[0], *g = out[1], *b = out[2], *a = out[3];
+        size_t i = 0;
+        for ( ; i+4<=count; i+=4, in+=16 )
+        {
+            __m128 p0 = _mm_loadu_ps( in );
+            __m128 p1 = _mm_loadu_ps( in + 4 );
+            __m128 p2 = _mm_loadu_ps( in + 8 );
+            __m128 p3 = _mm_loadu_ps( in + 12 );
+            _MM_TRANSPOSE4_PS( p0, p1, p2, p3 );
+            _mm_storeu_ps( r + i, p0 );
+            _mm_storeu_ps( g + i, p1 );
+            _mm_storeu_ps( b + i, p2 );
+            _mm_storeu_ps( a + i, p3 );
+        }
+        for ( ; i<count; ++i, in+=4 )
+        {
+            r[i] = in[0];
+            g[i] = in[1];
+            b[i] = in[2];
+            a[i] = in[3];
+        }
+    }
+
+    template<>
+    void deinterleaveSIMD<3>( const float *in, float *const *out, size_t count )
+    {
+        float *r = out[0], *g = out[1], *b = out[2];
+        size_t i = 0;
+        for ( ; i+4<=count; i+=4, in+=12 )
+        {
+            // r0 g0 b0 r1 | g1 b1 r2 g2 | b2 r3 g3 b3
+            __m128 v0 = _mm_loadu_ps( in );
+            __m128 v1 = _mm_loadu_ps( in + 4 );
+            __m128 v2 = _mm_loadu_ps( in + 8 );
+
+            __m128 t = _mm_shuffle_ps( v1, v2, _MM_SHUFFLE(1, 0, 3, 2) );
+            _mm_storeu_ps( r + i, _mm_shuffle_ps( v0, t, _MM_SHUFFLE(3, 0, 3, 0) ) );
+
+            t = _mm_shuffle_ps( v0, v1, _MM_SHUFFLE(0, 0, 1, 1) );
+            __m128 u = _mm_shuffle_ps( v1, v2, _MM_SHUFFLE(2, 2, 3, 3) );
+            _mm_storeu_ps( g + i, _mm_shuffle_ps( t, u, _MM_SHUFFLE(2, 0, 2, 0) ) );
+
+            t = _mm_shuffle_ps( v0, v1, _MM_SHUFFLE(1, 1, 2, 2) );
+            u = _mm_shuffle_ps( v2, v2, _MM_SHUFFLE(3, 3, 0, 0) );
+            _mm_storeu_ps( b + i, _mm_shuffle_ps( t, u, _MM_SHUFFLE(2, 0, 2, 0) ) );
+        }
+        for ( ; i<count; ++i, in+=3 )
+        {
+            r[i] = in[0];
+            g[i] = in[1];
+            b[i] = in[2];
+        }
+    }
+#endif
+}
+
+void rmanconnect::deinterleave( const float *in, unsigned int spp,
+                                float *const *out, unsigned int channels, size_t count )
+{
+    if ( channels==spp )
+    {
+        switch ( spp )
+        {
+            case 1:
+                memcpy( out[0], in, sizeof(float)*count );
+                return;
+            case 2:
+                deinterleaveSIMD<2>( in, out, count );
+                return;
+            case 3:
+                deinterleaveSIMD<3>( in, out, count );
+                return;
+            case 4:
+                deinterleaveSIMD<4>( in, out, count );
+                return;
+        }
+    }
+    deinterleaveScalar<0>( in, spp, out, channels, count );
+}
+
+void rmanconnect::deinterleaveScaled( const float *in, unsigned int spp,
+                                      float *const *out, unsigned int channels, size_t count,
+                                      unsigned int scale, unsigned int phase )
+{
+    if ( scale<=1 )
+    {
+        deinterleave( in, spp, out, channels, count );
+        return;
+    }
+    for ( unsigned int c=0; c<channels; ++c )
+    {
+        const float *src = in + c;
+        float *dst = out[c];
+        for ( size_t i=0; i<count; ++i )
+            dst[i] = src[( ( phase + i ) / scale ) * spp];
+    }
+}
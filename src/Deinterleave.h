@@ -0,0 +1,64 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RMAN_CONNECT_DEINTERLEAVE_H_
+#define RMAN_CONNECT_DEINTERLEAVE_H_
+
+#include <cstddef>
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    /*! \brief Splits a run of interleaved pixels into separate channels.
+     *
+     * in holds count pixels of spp samples each. The first channels samples
+     * of every pixel are written to out[0] ... out[channels-1], one float
+     * per pixel, so channels must be no more than spp.
+     *
+     * This is used to copy a row of a bucket into a planar image buffer.
+     * Common sample counts (1, 2, 3 and 4) have their own kernels, using
+     * SSE on x86 CPUs, and anything else falls back to a generic loop.
+     */
+    void deinterleave( const float *in, unsigned int spp,
+                       float *const *out, unsigned int channels, size_t count );
+
+    /*! \brief Splits a run of reduced-resolution pixels into channels.
+     *
+     * Like deinterleave(), but each pixel of in is repeated scale times
+     * across out, so count output pixels are filled from a preview row.
+     * phase is how far into the first input pixel the run starts, from 0
+     * to scale-1. A scale of 1 is the same as deinterleave().
+     */
+    void deinterleaveScaled( const float *in, unsigned int spp,
+                             float *const *out, unsigned int channels, size_t count,
+                             unsigned int scale, unsigned int phase );
+}
+
+#endif // RMAN_CONNECT_DEINTERLEAVE_H_
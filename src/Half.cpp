@@ -0,0 +1,182 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "Half.h"
+#include <cstring>
+
+#if defined(__GNUC__) && ( defined(__x86_64__) || defined(__i386__) )
+#define RMAN_CONNECT_F16C
+#include <immintrin.h>
+#endif
+
+using namespace rmanconnect;
+
+namespace
+{
+    boost::uint16_t floatToHalfScalar( float value )
+    {
+        boost::uint32_t f;
+        memcpy( &f, &value, sizeof(f) );
+        boost::uint32_t sign = f & 0x80000000u;
+        f ^= sign;
+
+        boost::uint16_t h;
+        if ( f >= ((127 + 16) << 23) )
+        {
+            // too big, infinity or NaN (NaNs are quietened)
+            if ( f > 0x7f800000u )
+                h = 0x7e00 | ((f & 0x7fffff) >> 13);
+            else
+                h = 0x7c00;
+        }
+        else if ( f < (113u << 23) )
+        {
+            // becomes a denormal or zero; let the FPU do the rounding by
+            // adding a magic number that lines the mantissa bits up
+            const boost::uint32_t magic_bits = ((127 - 15) + (23 - 10) + 1) << 23;
+            float magic, denorm;
+            memcpy( &magic, &magic_bits, sizeof(magic) );
+            memcpy( &denorm, &f, sizeof(denorm) );
+            denorm += magic;
+            memcpy( &f, &denorm, sizeof(f) );
+            h = static_cast<boost::uint16_t>( f - magic_bits );
+        }
+        else
+        {
+            // normal number; rebias the exponent and round to nearest even
+            boost::uint32_t mant_odd = (f >> 13) & 1;
+            f += (static_cast<boost::uint32_t>(15 - 127) << 23) + 0xfff;
+            f += mant_odd;
+            h = static_cast<boost::uint16_t>( f >> 13 );
+        }
+        return h | static_cast<boost::uint16_t>( sign >> 16 );
+    }
+
+    float halfToFloatScalar( boost::uint16_t h )
+    {
+        boost::uint32_t sign = static_cast<boost::uint32_t>( h & 0x8000 ) << 16;
+        boost::uint32_t exponent = ( h >> 10 ) & 0x1f;
+        boost::uint32_t mantissa = h & 0x3ff;
+
+        boost::uint32_t f;
+        if ( exponent==0 )
+        {
+            if ( mantissa==0 )
+            {
+                f = sign;
+            }
+            else
+            {
+                // denormal half; normalize it
+                int e = -1;
+                do
+                {
+                    ++e;
+                    mantissa <<= 1;
+                }
+                while ( (mantissa & 0x400)==0 );
+                f = sign | ((127 - 15 - e) << 23) | ((mantissa & 0x3ff) << 13);
+            }
+        }
+        else if ( exponent==31 )
+        {
+            // infinity or NaN (NaNs are quietened)
+            f = sign | 0x7f800000u | (mantissa << 13);
+            if ( mantissa!=0 )
+                f |= 0x400000u;
+        }
+        else
+        {
+            f = sign | ((exponent + 112) << 23) | (mantissa << 13);
+        }
+
+        float value;
+        memcpy( &value, &f, sizeof(value) );
+        return value;
+    }
+
+#ifdef RMAN_CONNECT_F16C
+    bool hasF16C()
+    {
+        // the kernels use 256-bit registers, so AVX has to be there too
+        static const bool supported = __builtin_cpu_supports( "avx" ) &&
+                                      __builtin_cpu_supports( "f16c" );
+        return supported;
+    }
+
+    __attribute__((target("avx,f16c")))
+    size_t floatToHalfF16C( const float *in, boost::uint16_t *out, size_t count )
+    {
+        size_t i = 0;
+        for ( ; i+8<=count; i+=8 )
+        {
+            __m256 v = _mm256_loadu_ps( in + i );
+            _mm_storeu_si128( reinterpret_cast<__m128i*>(out + i),
+                              _mm256_cvtps_ph( v, _MM_FROUND_TO_NEAREST_INT ) );
+        }
+        return i;
+    }
+
+    __attribute__((target("avx,f16c")))
+    size_t halfToFloatF16C( const boost::uint16_t *in, float *out, size_t count )
+    {
+        size_t i = 0;
+        for ( ; i+8<=count; i+=8 )
+        {
+            __m128i v = _mm_loadu_si128( reinterpret_cast<const __m128i*>(in + i) );
+            _mm256_storeu_ps( out + i, _mm256_cvtph_ps( v ) );
+        }
+        return i;
+    }
+#endif
+}
+
+void rmanconnect::floatToHalf( const float *in, boost::uint16_t *out, size_t count )
+{
+    size_t i = 0;
+#ifdef RMAN_CONNECT_F16C
+    if ( hasF16C() )
+        i = floatToHalfF16C( in, out, count );
+#endif
+    for ( ; i<count; ++i )
+        out[i] = floatToHalfScalar( in[i] );
+}
+
+void rmanconnect::halfToFloat( const boost::uint16_t *in, float *out, size_t count )
+{
+    size_t i = 0;
+#ifdef RMAN_CONNECT_F16C
+    if ( hasF16C() )
+        i = halfToFloatF16C( in, out, count );
+#endif
+    for ( ; i<count; ++i )
+        out[i] = halfToFloatScalar( in[i] );
+}
@@ -0,0 +1,57 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef RMAN_CONNECT_HALF_H_
+#define RMAN_CONNECT_HALF_H_
+
+#include <boost/cstdint.hpp>
+#include <cstddef>
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    /*! \brief Converts count floats to IEEE 754 half-precision.
+     *
+     * Values are rounded to the nearest half (ties to even). Values too
+     * large for a half become infinity and NaNs stay NaN. On x86 CPUs with
+     * the F16C extension this uses a vectorized kernel, otherwise it falls
+     * back to an equivalent scalar conversion.
+     */
+    void floatToHalf( const float *in, boost::uint16_t *out, size_t count );
+
+    /*! \brief Converts count IEEE 754 half-precision values to floats.
+     *
+     * Every half is exactly representable as a float, so this is lossless.
+     */
+    void halfToFloat( const boost::uint16_t *in, float *out, size_t count );
+}
+
+#endif // RMAN_CONNECT_HALF_H_
@@ -0,0 +1,237 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "IngestBuffer.h"
+
+using namespace rmanconnect;
+
+namespace
+{
+    boost::posix_time::ptime now()
+    {
+        return boost::posix_time::microsec_clock::universal_time();
+    }
+}
+
+IngestBuffer::IngestBuffer() :
+    mDirtyX( 0 ),
+    mDirtyY( 0 ),
+    mDirtyR( 0 ),
+    mDirtyT( 0 ),
+    mIsDirty( false ),
+    mTraced( false )
+{
+}
+
+void IngestBuffer::lockAll()
+{
+    for ( int i=0; i<LockStripes; ++i )
+        mLocks[i].lock();
+}
+
+void IngestBuffer::unlockAll()
+{
+    for ( int i=LockStripes - 1; i>=0; --i )
+        mLocks[i].unlock();
+}
+
+void IngestBuffer::lockCounted( boost::mutex &lock )
+{
+    if ( lock.try_lock() )
+        return;
+    boost::posix_time::ptime start = now();
+    lock.lock();
+    mLockWaits.add( 1 );
+    mLockWaitUs.add( ( now() - start ).total_microseconds() );
+}
+
+void IngestBuffer::lockRow( int y )
+{
+    lockCounted( rowLock(y) );
+
+    // draw any traced buckets waiting on this row
+    std::vector<PendingTrace> &waiting = mPendingTraces[lockStripe(y)];
+    if ( waiting.empty() )
+        return;
+    boost::uint64_t drawn = traceClock();
+    for ( unsigned int i=0; i<waiting.size(); )
+    {
+        if ( y<waiting[i].top || y>=waiting[i].bottom )
+        {
+            ++i;
+            continue;
+        }
+        waiting[i].trace.drawn = drawn;
+        mTraces.add( waiting[i].trace );
+        waiting[i] = waiting.back();
+        waiting.pop_back();
+    }
+}
+
+bool IngestBuffer::copy( int imageId, const Region &region, const float *block,
+                         int &x, int &y, int &r, int &t )
+{
+    // the part of each block row that lands in the buffer, and the
+    // (flipped) buffer rows the block lands on
+    int left, right, top, bottom;
+    if ( !mBuffer.clip(region, left, right, top, bottom) )
+        return false;
+    x = region.x + left;
+    y = top;
+    r = region.x + right;
+    t = bottom;
+    markDirty( x, y, r, t );
+
+    // copy it a band of rows at a time, only locking that band
+    for ( int band=top; band<bottom; )
+    {
+        int band_end = std::min( bottom, ( band / RmanBuffer::BandRows + 1 ) * RmanBuffer::BandRows );
+        boost::mutex &lock = rowLock( band );
+        lockCounted( lock );
+        mBuffer.copy( region, block, left, right, band, band_end, mRowPointers );
+        lock.unlock();
+        band = band_end;
+    }
+
+    // a traced bucket is now waiting to be drawn
+    if ( region.times.received )
+        commitTrace( imageId, region, top, bottom );
+    return true;
+}
+
+void IngestBuffer::commitTrace( int imageId, const Region &region, int top, int bottom )
+{
+    PendingTrace pending;
+    BucketTrace &trace = pending.trace;
+    trace.imageId = imageId;
+    trace.x = region.x;
+    trace.y = region.y;
+    trace.width = region.width;
+    trace.height = region.height;
+    trace.scale = region.scale;
+    trace.times = region.times;
+    trace.committed = traceClock();
+    trace.drawn = 0;
+    pending.top = top;
+    pending.bottom = bottom;
+    mTraced = true;
+
+    // it's drawn when the first of its rows is, so it waits with that
+    // row's lock
+    boost::mutex::scoped_lock lock( rowLock(top) );
+    std::vector<PendingTrace> &waiting = mPendingTraces[lockStripe(top)];
+    if ( waiting.size()<MaxPendingTraces )
+        waiting.push_back( pending );
+    else
+        mTraces.add( trace );
+}
+
+void IngestBuffer::markDirty( int x, int y, int r, int t )
+{
+    if ( mIsDirty )
+    {
+        mDirtyX = std::min( mDirtyX, x );
+        mDirtyY = std::min( mDirtyY, y );
+        mDirtyR = std::max( mDirtyR, r );
+        mDirtyT = std::max( mDirtyT, t );
+    }
+    else
+    {
+        mDirtyX = x;
+        mDirtyY = y;
+        mDirtyR = r;
+        mDirtyT = t;
+    }
+    mIsDirty = true;
+}
+
+double IngestBuffer::refreshWait( float rate, bool force ) const
+{
+    if ( !mIsDirty )
+        return -1.0;
+    if ( force || rate<=0.f || mLastRefresh.is_not_a_date_time() )
+        return 0.0;
+    double wait = 1.0 / rate - ( now() - mLastRefresh ).total_microseconds() / 1000000.0;
+    return std::max( wait, 0.0 );
+}
+
+void IngestBuffer::beginRefresh( int &x, int &y, int &r, int &t )
+{
+    x = mDirtyX;
+    y = mDirtyY;
+    r = mDirtyR;
+    t = mDirtyT;
+    mBuffer.flush();
+    mIsDirty = false;
+    mLastRefresh = now();
+}
+
+void IngestBuffer::drawTraces()
+{
+    releaseTraces( traceClock() );
+}
+
+void IngestBuffer::flushTraces()
+{
+    releaseTraces( 0 );
+}
+
+void IngestBuffer::releaseTraces( boost::uint64_t drawn )
+{
+    for ( int i=0; i<LockStripes; ++i )
+    {
+        std::vector<PendingTrace> waiting;
+        {
+            boost::mutex::scoped_lock lock( mLocks[i] );
+            waiting.swap( mPendingTraces[i] );
+        }
+        for ( unsigned int j=0; j<waiting.size(); ++j )
+        {
+            waiting[j].trace.drawn = drawn;
+            mTraces.add( waiting[j].trace );
+        }
+    }
+}
+
+void IngestBuffer::clearTraces()
+{
+    lockAll();
+    for ( int i=0; i<LockStripes; ++i )
+        mPendingTraces[i].clear();
+    unlockAll();
+    mTraces.clear();
+    mTraced = false;
+}
+
+void IngestBuffer::resetLockStats()
+{
+    mLockWaits.reset();
+    mLockWaitUs.reset();
+}
@@ -0,0 +1,197 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RMAN_CONNECT_INGESTBUFFER_H_
+#define RMAN_CONNECT_INGESTBUFFER_H_
+
+#include "Data.h"
+#include "RmanBuffer.h"
+#include "Trace.h"
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <vector>
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    /*! \class StatCounter
+     * \brief A count that any thread may add to.
+     */
+    class StatCounter
+    {
+    public:
+        StatCounter() : mValue( 0 ) {}
+
+        void add( unsigned long n ) { __sync_fetch_and_add( &mValue, n ); }
+        unsigned long value() const { return __sync_fetch_and_add( const_cast<volatile unsigned long*>(&mValue), 0 ); }
+        void reset() { __sync_lock_test_and_set( &mValue, 0 ); }
+
+    private:
+        volatile unsigned long mValue;
+    };
+
+    /*! \class IngestBuffer
+     * \brief Receives buckets into an RmanBuffer while it's being read.
+     *
+     * This is the receiving side shared by the Nuke node and
+     * rmanconnect_consumer. Buckets are copied in a band of rows at a time,
+     * only locking that band, so the image can be read from any number of
+     * threads while buckets arrive. Bands share LockStripes locks between
+     * them, and holding any one of them keeps the buffer's size and
+     * channels from changing.
+     *
+     * It also keeps track of the part of the buffer changed since it was
+     * last refreshed, limiting refreshes to a given rate, and of traced
+     * buckets that have been copied in but not yet drawn.
+     *
+     * Only one thread may write to it at a time (copy(), markDirty(),
+     * refreshWait() and beginRefresh()), while lockRow() may be called from
+     * any thread.
+     */
+    class IngestBuffer
+    {
+    public:
+        //! The number of locks shared by the bands of rows
+        static const int LockStripes = 64;
+
+        //! The most traced buckets kept waiting to be drawn, per lock stripe
+        static const unsigned int MaxPendingTraces = 4096;
+
+        IngestBuffer();
+
+        //! The buffer. Lock it with lockAll() to change its size.
+        RmanBuffer &buffer() { return mBuffer; }
+        const RmanBuffer &buffer() const { return mBuffer; }
+
+        //! The lock for the band holding row y.
+        boost::mutex &rowLock( int y ) { return mLocks[lockStripe(y)]; }
+
+        //! Locks the whole buffer, e.g. to resize it.
+        void lockAll();
+        void unlockAll();
+
+        /*! \brief Locks row y to read it, counting any wait.
+         *
+         * Traced buckets waiting on the row are counted as drawn. Unlock
+         * with unlockRow().
+         */
+        void lockRow( int y );
+        void unlockRow( int y ) { rowLock( y ).unlock(); }
+
+        /*! \brief Copies a block of pixels into the buffer.
+         *
+         * Anything that falls outside the buffer is dropped. The part of
+         * the buffer it lands on is marked dirty and returned in x, y, r
+         * and t (rows being flipped, as in the buffer). A traced block
+         * waits to be drawn. Returns false if none of it lands in the
+         * buffer.
+         */
+        bool copy( int imageId, const Region &region, const float *block,
+                   int &x, int &y, int &r, int &t );
+
+        //! Notes that part of the buffer has changed.
+        void markDirty( int x, int y, int r, int t );
+
+        /*! \brief Says when the buffer should next be refreshed.
+         *
+         * Refreshes are limited to rate a second, unless rate is 0 or force
+         * is set. Returns 0 if it should be refreshed now, the seconds
+         * until it should be, or -1 if nothing has changed.
+         */
+        double refreshWait( float rate, bool force=false ) const;
+
+        /*! \brief Starts a refresh, setting x, y, r and t to the part of
+         * the buffer changed since the last one.
+         *
+         * Starts writing the changes back to any cache file.
+         */
+        void beginRefresh( int &x, int &y, int &r, int &t );
+
+        //! Counts every traced bucket waiting to be drawn as drawn now.
+        void drawTraces();
+        //! Gives up waiting for traced buckets to be drawn.
+        void flushTraces();
+        //! Forgets every traced bucket.
+        void clearTraces();
+        //! Have any buckets been traced since clearTraces()?
+        bool traced() const { return mTraced; }
+        //! The traced buckets that have been drawn or given up on
+        TraceLog &traces() { return mTraces; }
+        const TraceLog &traces() const { return mTraces; }
+
+        //! Times a band lock was already held when copying or reading
+        unsigned long lockWaits() const { return mLockWaits.value(); }
+        //! Total time spent waiting for band locks
+        unsigned long lockWaitMicroseconds() const { return mLockWaitUs.value(); }
+        void resetLockStats();
+
+    private:
+        // a traced bucket copied into rows top to bottom but not drawn yet
+        struct PendingTrace
+        {
+            BucketTrace trace;
+            int top, bottom;
+        };
+
+        int lockStripe( int y ) const
+        {
+            return ( std::max( y, 0 ) / RmanBuffer::BandRows ) % LockStripes;
+        }
+
+        void lockCounted( boost::mutex &lock );
+        void commitTrace( int imageId, const Region &region, int top, int bottom );
+        // logs every waiting trace as drawn at the given time (or not at
+        // all if it's 0)
+        void releaseTraces( boost::uint64_t drawn );
+
+        IngestBuffer( const IngestBuffer& );
+        IngestBuffer &operator=( const IngestBuffer& );
+
+        RmanBuffer mBuffer;
+        boost::mutex mLocks[LockStripes];
+        std::vector<float*> mRowPointers; // scratch space for copy()
+
+        // the part of the buffer changed since the last refresh
+        int mDirtyX, mDirtyY, mDirtyR, mDirtyT;
+        bool mIsDirty;
+        boost::posix_time::ptime mLastRefresh;
+
+        // traced buckets waiting on each lock stripe's rows (guarded by
+        // its lock), and those that have been drawn
+        std::vector<PendingTrace> mPendingTraces[LockStripes];
+        bool mTraced;
+        TraceLog mTraces;
+
+        StatCounter mLockWaits, mLockWaitUs;
+    };
+}
+
+#endif // RMAN_CONNECT_INGESTBUFFER_H_
@@ -0,0 +1,165 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef RMAN_CONNECT_MESSAGE_H_
+#define RMAN_CONNECT_MESSAGE_H_
+
+#include <boost/cstdint.hpp>
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    //! Identifies an RmanConnect message header on the wire ('RMCN').
+    const boost::uint32_t MessageMagic = 0x524d434e;
+
+    //! The wire protocol version. Bump this whenever MessageHeader changes.
+    const boost::uint16_t MessageVersion = 7;
+
+    /*! \brief The 'type' of a message, matching Data::type().
+     */
+    enum MessageType
+    {
+        MsgOpenImage = 0,
+        MsgPixels = 1,
+        MsgCloseImage = 2,
+        MsgBatch = 3,
+        MsgPreview = 4,
+        MsgQuit = 9
+    };
+
+    /*! \brief The format of each sample in a pixel payload.
+     */
+    enum SampleFormat
+    {
+        FormatFloat32 = 0,
+        FormatFloat16 = 1
+    };
+
+    /*! \brief Flags that can be set on a MessageHeader.
+     */
+    enum MessageFlags
+    {
+        //! The payload is in the connection's SharedRing, not on the socket
+        MsgFlagSharedMemory = 1,
+        //! The message's pixels are being traced, see enqueued and sent
+        MsgFlagTraced = 2
+    };
+
+#pragma pack(push, 1)
+    /*! \struct MessageHeader
+     * \brief The fixed-size header that precedes every message.
+     *
+     * Every message sent between Client and Server is a single MessageHeader
+     * optionally followed by payloadSize bytes of payload. This lets a Client
+     * send a whole bucket with one gathered write, and a Server read it back
+     * with one header read followed by one payload read.
+     *
+     * A MsgBatch message carries several MsgPixels (or MsgPreview)
+     * messages, each with its own header, packed back-to-back in its
+     * payload. The messages in a batch are all of the same type.
+     *
+     * A MsgPreview message is a box-filtered copy of the block x, y, width,
+     * height at 1/scale of its resolution, so its payload holds
+     * ceil(width/scale) by ceil(height/scale) pixels. A Client sends it
+     * ahead of the block's full-resolution pixels. scale is 1 in every
+     * other message.
+     *
+     * codec says how the payload is encoded (see PayloadCodec) and
+     * payloadSize is always its encoded size. In a MsgOpenImage message
+     * codec is the codec the Client would like to use, and the Server's
+     * reply holds the one it has agreed to. A MsgBatch header's codec is
+     * CodecNone only if none of the messages it carries are encoded.
+     *
+     * The payload of a MsgOpenImage message is the names of the image's
+     * channels, each followed by a NUL.
+     *
+     * format is the SampleFormat of the (decoded) payload, and is
+     * negotiated in the same way as codec.
+     *
+     * flags holds MessageFlags. A MsgOpenImage message with
+     * MsgFlagSharedMemory set asks the Server for a shared memory ring; if
+     * the reply has it set too, the reply's payload is the name of the ring.
+     * From then on any message with the flag set has its payload in the ring
+     * rather than following it on the socket, except a MsgBatch: one with
+     * the flag set carries just the headers of its blocks, and each block's
+     * pixels are the next record in the ring.
+     *
+     * A Client that is tracing its pixels sets MsgFlagTraced on every
+     * message, and fills in enqueued with the traceClock() time at which
+     * each block was queued and sent with the time at which the message
+     * was written. The blocks in a batch are sent with the batch, so only
+     * the batch's header has sent filled in. Both are 0 otherwise.
+     */
+    struct MessageHeader
+    {
+        MessageHeader( int msgType=-1 ) :
+            magic(MessageMagic),
+            version(MessageVersion),
+            type(static_cast<boost::uint16_t>(msgType)),
+            imageId(-1),
+            x(0), y(0),
+            width(0), height(0),
+            spp(0),
+            codec(0),
+            format(0),
+            flags(0),
+            scale(1),
+            payloadSize(0),
+            enqueued(0),
+            sent(0)
+        {
+        }
+
+        //! Returns true if the header has the right magic and version.
+        bool valid() const
+        {
+            return magic==MessageMagic && version==MessageVersion;
+        }
+
+        boost::uint32_t magic;
+        boost::uint16_t version;
+        boost::uint16_t type;
+        boost::int32_t imageId;
+        boost::int32_t x, y;
+        boost::int32_t width, height;
+        boost::int32_t spp;
+        boost::uint16_t codec;
+        boost::uint16_t format;
+        boost::uint32_t flags;
+        boost::uint32_t scale;
+        boost::uint32_t payloadSize;
+        boost::uint64_t enqueued;
+        boost::uint64_t sent;
+    };
+#pragma pack(pop)
+}
+
+#endif // RMAN_CONNECT_MESSAGE_H_
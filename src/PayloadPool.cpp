@@ -0,0 +1,296 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "PayloadPool.h"
+#include <boost/detail/atomic_count.hpp>
+#include <boost/thread/mutex.hpp>
+#include <cstdlib>
+#include <new>
+
+using namespace rmanconnect;
+
+namespace
+{
+    // the smallest size class (in floats) and how many classes there are
+    const size_t SmallestClass = 1024;
+    const int NumClasses = 13;
+
+    // payloads start on 64-byte boundaries, after their block's header
+    const size_t BlockAlignment = 64;
+
+    // the size class for a payload of size floats, or -1 if it's too big
+    int sizeClass( size_t size )
+    {
+        size_t capacity = SmallestClass;
+        for ( int c=0; c<NumClasses; ++c, capacity<<=1 )
+            if ( size<=capacity )
+                return c;
+        return -1;
+    }
+}
+
+struct Payload::Block
+{
+    Block( PayloadPool::Core *core, int sizeClass, size_t capacity ) :
+        refs( 0 ),
+        core( core ),
+        sizeClass( sizeClass ),
+        capacity( capacity ),
+        size( 0 ),
+        next( 0 )
+    {
+    }
+
+    boost::detail::atomic_count refs;
+    PayloadPool::Core *core;
+    int sizeClass;
+    size_t capacity, size;
+
+    // the next block in a free list
+    Block *next;
+
+    size_t bytes() const { return sizeof(float)*capacity; }
+    float *data(){ return reinterpret_cast<float*>( reinterpret_cast<char*>(this) + headerSize() ); }
+
+    static size_t headerSize(){ return ( sizeof(Block) + BlockAlignment - 1 ) & ~( BlockAlignment - 1 ); }
+
+    static Block *create( PayloadPool::Core *core, int sizeClass, size_t capacity )
+    {
+        void *memory = 0;
+        if ( posix_memalign( &memory, BlockAlignment, headerSize() + sizeof(float)*capacity )!=0 )
+            throw std::bad_alloc();
+        return new( memory ) Block( core, sizeClass, capacity );
+    }
+
+    static void destroy( Block *block )
+    {
+        block->~Block();
+        free( block );
+    }
+};
+
+struct PayloadPool::Core
+{
+    Core( size_t maxCachedBytes ) :
+        refs( 1 ),
+        open( true ),
+        maxCachedBytes( maxCachedBytes )
+    {
+        for ( int c=0; c<NumClasses; ++c )
+            freeLists[c] = 0;
+    }
+
+    // empty the free lists (with the mutex locked)
+    void clear()
+    {
+        for ( int c=0; c<NumClasses; ++c )
+        {
+            while ( freeLists[c] )
+            {
+                Payload::Block *block = freeLists[c];
+                freeLists[c] = block->next;
+                Payload::Block::destroy( block );
+            }
+        }
+        stats.cachedBytes = 0;
+    }
+
+    boost::mutex mutex;
+
+    // one for the pool, plus one for each block in use. The core is
+    // deleted when the pool and all of its blocks are gone.
+    unsigned long refs;
+    bool open;
+
+    size_t maxCachedBytes;
+    Payload::Block *freeLists[NumClasses];
+    PoolStats stats;
+};
+
+//=====
+// Payload
+
+Payload::Payload() :
+    mBlock( 0 )
+{
+}
+
+Payload::Payload( Block *block ) :
+    mBlock( block )
+{
+    ++mBlock->refs;
+}
+
+Payload::Payload( const Payload &other ) :
+    mBlock( other.mBlock )
+{
+    if ( mBlock )
+        ++mBlock->refs;
+}
+
+Payload &Payload::operator=( const Payload &other )
+{
+    Payload copy( other );
+    swap( copy );
+    return *this;
+}
+
+Payload::~Payload()
+{
+    reset();
+}
+
+float *Payload::data() const
+{
+    return mBlock ? mBlock->data() : 0;
+}
+
+size_t Payload::size() const
+{
+    return mBlock ? mBlock->size : 0;
+}
+
+void Payload::reset()
+{
+    if ( mBlock && --mBlock->refs==0 )
+        PayloadPool::release( mBlock );
+    mBlock = 0;
+}
+
+void Payload::swap( Payload &other )
+{
+    Block *block = mBlock;
+    mBlock = other.mBlock;
+    other.mBlock = block;
+}
+
+//=====
+// PayloadPool
+
+PayloadPool::PayloadPool( size_t maxCachedBytes ) :
+    mCore( new Core(maxCachedBytes) )
+{
+}
+
+PayloadPool::~PayloadPool()
+{
+    bool last = false;
+    {
+        boost::mutex::scoped_lock lock( mCore->mutex );
+        mCore->open = false;
+        mCore->clear();
+        last = --mCore->refs==0;
+    }
+    if ( last )
+        delete mCore;
+}
+
+Payload PayloadPool::acquire( size_t size, bool *allocated )
+{
+    if ( allocated )
+        *allocated = false;
+    if ( size==0 )
+        return Payload();
+
+    // reuse a block of the right size if we have one
+    int c = sizeClass( size );
+    Payload::Block *block = 0;
+    {
+        boost::mutex::scoped_lock lock( mCore->mutex );
+        if ( c>=0 && mCore->freeLists[c] )
+        {
+            block = mCore->freeLists[c];
+            mCore->freeLists[c] = block->next;
+            mCore->stats.cachedBytes -= block->bytes();
+            mCore->stats.outstandingBytes += block->bytes();
+            mCore->stats.hits++;
+            mCore->refs++;
+        }
+    }
+
+    // otherwise make a new one
+    if ( !block )
+    {
+        block = Payload::Block::create( mCore, c, c>=0 ? SmallestClass<<c : size );
+        if ( allocated )
+            *allocated = true;
+
+        boost::mutex::scoped_lock lock( mCore->mutex );
+        PoolStats &stats = mCore->stats;
+        stats.outstandingBytes += block->bytes();
+        stats.misses++;
+        if ( stats.outstandingBytes + stats.cachedBytes > stats.highWaterBytes )
+            stats.highWaterBytes = stats.outstandingBytes + stats.cachedBytes;
+        mCore->refs++;
+    }
+
+    block->size = size;
+    block->next = 0;
+    return Payload( block );
+}
+
+void PayloadPool::release( Payload::Block *block )
+{
+    Core *core = block->core;
+    bool last = false;
+    {
+        // keep the block for reuse if there's room for it
+        boost::mutex::scoped_lock lock( core->mutex );
+        core->stats.outstandingBytes -= block->bytes();
+        if ( core->open && block->sizeClass>=0 &&
+             core->stats.cachedBytes + block->bytes() <= core->maxCachedBytes )
+        {
+            block->next = core->freeLists[block->sizeClass];
+            core->freeLists[block->sizeClass] = block;
+            core->stats.cachedBytes += block->bytes();
+            block = 0;
+        }
+        last = --core->refs==0;
+    }
+    if ( block )
+        Payload::Block::destroy( block );
+    if ( last )
+        delete core;
+}
+
+PoolStats PayloadPool::stats() const
+{
+    boost::mutex::scoped_lock lock( mCore->mutex );
+    return mCore->stats;
+}
+
+void PayloadPool::resetStats()
+{
+    boost::mutex::scoped_lock lock( mCore->mutex );
+    PoolStats &stats = mCore->stats;
+    stats.hits = 0;
+    stats.misses = 0;
+    stats.highWaterBytes = stats.outstandingBytes + stats.cachedBytes;
+}
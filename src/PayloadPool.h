@@ -0,0 +1,151 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RMAN_CONNECT_PAYLOADPOOL_H_
+#define RMAN_CONNECT_PAYLOADPOOL_H_
+
+#include <cstddef>
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    /*! \struct PoolStats
+     * \brief Counters describing how well a PayloadPool is being reused.
+     */
+    struct PoolStats
+    {
+        PoolStats() :
+            hits(0),
+            misses(0),
+            outstandingBytes(0),
+            cachedBytes(0),
+            highWaterBytes(0)
+        {
+        }
+
+        //! Payloads handed out from the pool's free lists
+        unsigned long hits;
+        //! Payloads that had to be allocated
+        unsigned long misses;
+        //! Bytes held by payloads that are still in use
+        size_t outstandingBytes;
+        //! Bytes held in the free lists, ready to be reused
+        size_t cachedBytes;
+        //! The most bytes the pool has held at once (in use plus cached)
+        size_t highWaterBytes;
+    };
+
+    /*! \class Payload
+     * \brief A reference-counted block of floats that belongs to a
+     * PayloadPool.
+     *
+     * Copying a Payload shares the block rather than its contents. When the
+     * last copy goes away the block goes back to the pool it came from, even
+     * if that's on a different thread. An empty Payload holds nothing.
+     */
+    class Payload
+    {
+    public:
+        //! Constructs an empty payload.
+        Payload();
+        Payload( const Payload &other );
+        Payload &operator=( const Payload &other );
+        //! Destructor. Releases the block.
+        ~Payload();
+
+        //! The payload's floats, 64-byte aligned, or 0 if it's empty
+        float *data() const;
+        //! How many floats the payload holds
+        size_t size() const;
+        //! Does the payload hold anything?
+        bool empty() const { return mBlock==0; }
+
+        //! Releases the block, leaving the payload empty.
+        void reset();
+        //! Swaps blocks with another payload.
+        void swap( Payload &other );
+
+    private:
+        friend class PayloadPool;
+        struct Block;
+        explicit Payload( Block *block );
+        Block *mBlock;
+    };
+
+    /*! \class PayloadPool
+     * \brief Hands out Payloads from free lists of recycled blocks.
+     *
+     * Blocks come in power-of-two size classes from 1024 floats (a 16x16
+     * RGBA bucket) up to 4M floats, so the common bucket and batch sizes
+     * each settle into a class of their own and are reused message after
+     * message. Larger payloads are allocated and freed as they're needed.
+     *
+     * Released blocks are kept for reuse until maxCachedBytes are cached,
+     * after which they're freed. Payloads may outlive their pool: any still
+     * in use when it's destroyed are freed when they're released.
+     *
+     * acquire() and Payload's release are safe to call from any thread.
+     */
+    class PayloadPool
+    {
+    public:
+        //! Constructor
+        PayloadPool( size_t maxCachedBytes=256*1024*1024 );
+        //! Destructor. Frees every cached block.
+        ~PayloadPool();
+
+        /*! \brief Returns a payload of size floats.
+         *
+         * Its contents are undefined. If allocated is given it's set to
+         * whether the pool had to allocate memory for it.
+         */
+        Payload acquire( size_t size, bool *allocated=0 );
+
+        //! Returns the pool's counters.
+        PoolStats stats() const;
+
+        //! Resets the hit and miss counters and the high-water mark.
+        void resetStats();
+
+    private:
+        friend class Payload;
+        struct Core;
+
+        // give a block back to its pool
+        static void release( Payload::Block *block );
+
+        PayloadPool( const PayloadPool& );
+        PayloadPool &operator=( const PayloadPool& );
+
+        Core *mCore;
+    };
+}
+
+#endif // RMAN_CONNECT_PAYLOADPOOL_H_
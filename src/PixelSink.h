@@ -0,0 +1,109 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RMAN_CONNECT_PIXELSINK_H_
+#define RMAN_CONNECT_PIXELSINK_H_
+
+#include "Data.h"
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    /*! \struct PixelSpan
+     * \brief Somewhere for a block of pixels to be written straight into.
+     *
+     * Row i of the block (counting from the block's y) is written as
+     * width*spp interleaved floats starting at data + i*rowStride.
+     * rowStride may be negative, to flip the block as it's written.
+     *
+     * Pixels may be read from the socket straight into a span, so it can be
+     * written to at any point until PixelSink::written() is called for it
+     * (which it never is if the Client goes away part way through).
+     */
+    struct PixelSpan
+    {
+        float *data;
+        long rowStride;
+    };
+
+    /*! \class PixelSink
+     * \brief Receives pixels as soon as they've been read, without a Data.
+     *
+     * Normally every block of pixels a Server receives is stored in a Data
+     * object and returned by Server::listen(). A consumer that sets a
+     * PixelSink with Server::setPixelSink() is instead handed each block
+     * from inside listen(), as soon as it's been read, and the pixels are
+     * never copied into a Data.
+     *
+     * For each full-resolution block the Server first asks for a span() to
+     * read it into.
+     * If one is given the pixels are read (or decoded) straight into it
+     * and then written() is called. If not the pixels are put somewhere
+     * reusable and handed to pixels().
+     *
+     * The Server calls these from whichever thread calls listen(), and only
+     * when every message returned by listen() before them has been
+     * handled, so a sink will always have seen an image opened before it's
+     * given any of its pixels.
+     */
+    class PixelSink
+    {
+    public:
+        virtual ~PixelSink() {}
+
+        /*! \brief Asks for somewhere to put a block of pixels.
+         *
+         * Return true having filled in span to have region's pixels written
+         * straight into it. The default returns false. The regions given to
+         * a sink always have an offset of 0.
+         */
+        virtual bool span( int /*imageId*/, const Region &/*region*/, PixelSpan &/*span*/ ) { return false; }
+
+        //! Called once a block has been written into the span given for it.
+        virtual void written( int /*imageId*/, const Region &/*region*/ ) {}
+
+        /*! \brief Called with a block of pixels that had no span.
+         *
+         * data holds region.width*region.height*region.spp interleaved
+         * floats, and is only valid until this returns.
+         */
+        virtual void pixels( int imageId, const Region &region, const float *data ) = 0;
+
+        /*! \brief Called with a preview of a block of pixels.
+         *
+         * data holds a reduced-resolution copy of region (see
+         * Region::scale), and is only valid until this returns. The default
+         * ignores previews.
+         */
+        virtual void preview( int /*imageId*/, const Region &/*region*/, const float * /*data*/ ) {}
+    };
+}
+
+#endif // RMAN_CONNECT_PIXELSINK_H_
@@ -0,0 +1,94 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Reactor.h"
+#include <boost/bind.hpp>
+#include <boost/thread/once.hpp>
+#include <exception>
+#include <iostream>
+
+using namespace rmanconnect;
+
+namespace
+{
+    Reactor *sharedReactor = 0;
+    boost::once_flag sharedOnce = BOOST_ONCE_INIT;
+
+    void makeSharedReactor()
+    {
+        static Reactor reactor( Reactor::SharedThreads );
+        sharedReactor = &reactor;
+    }
+}
+
+const unsigned int Reactor::SharedThreads;
+
+Reactor::Reactor( unsigned int threads ) :
+        mWork( new boost::asio::io_service::work(mIoService) )
+{
+    for ( unsigned int i=0; i<threads || i==0; ++i )
+        mThreads.create_thread( boost::bind(&Reactor::run, this) );
+}
+
+Reactor::~Reactor()
+{
+    mWork.reset();
+    mIoService.stop();
+    mThreads.join_all();
+}
+
+Reactor &Reactor::shared()
+{
+    boost::call_once( makeSharedReactor, sharedOnce );
+    return *sharedReactor;
+}
+
+void Reactor::run()
+{
+    // keep going if a handler throws, saying why; a Server's Connections
+    // catch their own errors, so this can only be a Listener or PixelSink
+    // that failed
+    while ( true )
+    {
+        try
+        {
+            mIoService.run();
+            return;
+        }
+        catch( const std::exception &e )
+        {
+            std::cerr << "rmanconnect: handler failed: " << e.what() << std::endl;
+        }
+        catch( ... )
+        {
+            std::cerr << "rmanconnect: handler failed" << std::endl;
+        }
+    }
+}
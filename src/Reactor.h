@@ -0,0 +1,118 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RMAN_CONNECT_REACTOR_H_
+#define RMAN_CONNECT_REACTOR_H_
+
+#include <boost/asio.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    class Data;
+
+    /*! \class Listener
+     * \brief Handed a Server's messages as they arrive, instead of them
+     * being returned by Server::listen().
+     *
+     * A Server run by a Reactor (see Server::setListener()) calls message()
+     * with each message listen() would have returned, in the same order and
+     * with the same promises about its PixelSink. The calls come from any of
+     * the Reactor's threads, but never two at once for the same Server.
+     */
+    class Listener
+    {
+    public:
+        virtual ~Listener() {}
+
+        //! Called with each message the Server receives.
+        virtual void message( Data &data ) = 0;
+
+        /*! \brief Called after each message, and again once the wait it
+         * last asked for is up.
+         *
+         * Returns the seconds until it wants calling again (like the
+         * timeout given to listen()), or -1 to wait for the next message.
+         * The default never asks to be called.
+         */
+        virtual double idle() { return -1.0; }
+    };
+
+    /*! \class Reactor
+     * \brief Runs the I/O of any number of Servers on a small, fixed set of
+     * threads.
+     *
+     * A Server made with a Reactor never needs a thread of its own: its
+     * sockets are read by the Reactor's threads and its messages handed to
+     * its Listener. Each Server's handlers are run one at a time, so a
+     * Server only ever sees one of the threads at once, while different
+     * Servers can be handled in parallel. Waking a thread to stop a Server
+     * or change its port is just a post() to the io_service.
+     */
+    class Reactor
+    {
+    public:
+        //! The number of threads in the shared() Reactor
+        static const unsigned int SharedThreads = 2;
+
+        //! Starts the given number of threads running I/O.
+        Reactor( unsigned int threads=1 );
+        /*! \brief Destructor. Stops and joins the threads.
+         *
+         * Any Servers using the Reactor should be destroyed first.
+         */
+        ~Reactor();
+
+        //! The Reactor shared by every node in a Nuke session, started the
+        //! first time it's asked for.
+        static Reactor &shared();
+
+        //! The io_service run by the Reactor's threads.
+        boost::asio::io_service &ioService(){ return mIoService; }
+
+        //! The number of threads running I/O.
+        unsigned int threads() const { return mThreads.size(); }
+
+    private:
+        Reactor( const Reactor& );
+        Reactor &operator=( const Reactor& );
+
+        // each thread runs the io_service until the Reactor is destroyed
+        void run();
+
+        boost::asio::io_service mIoService;
+        boost::scoped_ptr<boost::asio::io_service::work> mWork;
+        boost::thread_group mThreads;
+    };
+}
+
+#endif // RMAN_CONNECT_REACTOR_H_
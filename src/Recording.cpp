@@ -0,0 +1,125 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Recording.h"
+#include <stdexcept>
+
+using namespace rmanconnect;
+
+namespace
+{
+    // the start of every recording ('RMCR'), followed by MessageVersion
+    const boost::uint32_t RecordingMagic = 0x524d4352;
+}
+
+//=====
+// Recorder
+Recorder::Recorder()
+{
+}
+
+Recorder::~Recorder()
+{
+    close();
+}
+
+void Recorder::open( const std::string &path )
+{
+    close();
+    mFile.open( path.c_str(), std::ios::out | std::ios::binary | std::ios::trunc );
+    if ( !mFile )
+        throw std::runtime_error( "Could not write recording " + path );
+    boost::uint32_t magic = RecordingMagic;
+    boost::uint16_t version = MessageVersion;
+    mFile.write( reinterpret_cast<const char*>(&magic), sizeof(magic) );
+    mFile.write( reinterpret_cast<const char*>(&version), sizeof(version) );
+    mStart = boost::posix_time::microsec_clock::universal_time();
+}
+
+void Recorder::close()
+{
+    if ( mFile.is_open() )
+        mFile.close();
+}
+
+void Recorder::record( const MessageHeader &header,
+                       const std::vector<boost::asio::const_buffer> &payload )
+{
+    if ( !mFile.is_open() )
+        return;
+
+    boost::uint64_t time = ( boost::posix_time::microsec_clock::universal_time() - mStart ).total_microseconds();
+    MessageHeader msg = header;
+    msg.flags &= ~( MsgFlagSharedMemory | MsgFlagTraced );
+    msg.enqueued = msg.sent = 0;
+    mFile.write( reinterpret_cast<const char*>(&time), sizeof(time) );
+    mFile.write( reinterpret_cast<const char*>(&msg), sizeof(msg) );
+    for ( unsigned int i=0; i<payload.size(); ++i )
+        mFile.write( boost::asio::buffer_cast<const char*>(payload[i]),
+                     boost::asio::buffer_size(payload[i]) );
+}
+
+//=====
+// Playback
+Playback::Playback( const std::string &path ) :
+        mFile( path.c_str(), std::ios::in | std::ios::binary )
+{
+    boost::uint32_t magic = 0;
+    boost::uint16_t version = 0;
+    mFile.read( reinterpret_cast<char*>(&magic), sizeof(magic) );
+    mFile.read( reinterpret_cast<char*>(&version), sizeof(version) );
+    if ( !mFile || magic!=RecordingMagic )
+        throw std::runtime_error( "Could not read recording " + path );
+    if ( version!=MessageVersion )
+        throw std::runtime_error( "Recording " + path + " was made with a different protocol version" );
+    mFirst = mFile.tellg();
+}
+
+bool Playback::next( RecordedMessage &message )
+{
+    mFile.read( reinterpret_cast<char*>(&message.time), sizeof(message.time) );
+    if ( mFile.gcount()==0 && mFile.eof() )
+        return false;
+    mFile.read( reinterpret_cast<char*>(&message.header), sizeof(message.header) );
+    if ( !mFile || !message.header.valid() )
+        throw std::runtime_error( "Recording is corrupt" );
+    message.payload.resize( message.header.payloadSize );
+    if ( !message.payload.empty() )
+        mFile.read( &message.payload[0], message.payload.size() );
+    if ( !mFile )
+        throw std::runtime_error( "Recording is truncated" );
+    return true;
+}
+
+void Playback::rewind()
+{
+    mFile.clear();
+    mFile.seekg( mFirst );
+}
@@ -0,0 +1,132 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RMAN_CONNECT_RECORDING_H_
+#define RMAN_CONNECT_RECORDING_H_
+
+#include "Message.h"
+#include <boost/asio/buffer.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <fstream>
+#include <string>
+#include <vector>
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    /*! \struct RecordedMessage
+     * \brief One message read back from a recording.
+     */
+    struct RecordedMessage
+    {
+        //! Microseconds from the start of the recording until it was sent
+        boost::uint64_t time;
+        //! The message's header, as it was sent
+        MessageHeader header;
+        //! Its payload, exactly as it was sent (so possibly encoded)
+        std::vector<char> payload;
+    };
+
+    /*! \class Recorder
+     * \brief Writes the messages a Client sends to a file.
+     *
+     * A recording starts with a small file header, followed by each message
+     * as a 64-bit timestamp, its MessageHeader and its payload. Payloads are
+     * written as they went to the Server, after encoding, so a recording is
+     * no bigger than the traffic it captured. Messages whose payload went
+     * through shared memory are recorded as if it had been sent on the
+     * socket, and traced messages as if they weren't, since their times
+     * would mean nothing when played back.
+     *
+     * See Client::setRecording() and the rmanconnect_replay tool.
+     */
+    class Recorder
+    {
+    public:
+        //! Constructor
+        Recorder();
+        //! Destructor. Closes the file.
+        ~Recorder();
+
+        /*! \brief Starts a new recording at path.
+         *
+         * Throws a std::runtime_error if the file can't be written.
+         */
+        void open( const std::string &path );
+
+        //! Finishes the recording.
+        void close();
+
+        //! Is a recording being made?
+        bool isOpen() const { return mFile.is_open(); }
+
+        //! Records a message with its payload gathered from buffers.
+        void record( const MessageHeader &header,
+                     const std::vector<boost::asio::const_buffer> &payload );
+
+    private:
+        Recorder( const Recorder& );
+        Recorder &operator=( const Recorder& );
+
+        std::ofstream mFile;
+        boost::posix_time::ptime mStart;
+    };
+
+    /*! \class Playback
+     * \brief Reads the messages back from a recording made by a Recorder.
+     */
+    class Playback
+    {
+    public:
+        /*! \brief Opens the recording at path.
+         *
+         * Throws a std::runtime_error if it can't be read or was made with
+         * a different version of the wire protocol.
+         */
+        explicit Playback( const std::string &path );
+
+        /*! \brief Reads the next message.
+         *
+         * Returns false at the end of the recording. Throws a
+         * std::runtime_error if the recording is truncated or corrupt.
+         */
+        bool next( RecordedMessage &message );
+
+        //! Starts reading from the first message again.
+        void rewind();
+
+    private:
+        std::ifstream mFile;
+        std::streampos mFirst;
+    };
+}
+
+#endif // RMAN_CONNECT_RECORDING_H_
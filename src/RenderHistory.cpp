@@ -0,0 +1,277 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "RenderHistory.h"
+#include "Codec.h"
+#include <boost/bind.hpp>
+#include <algorithm>
+#include <cstring>
+
+using namespace rmanconnect;
+
+//=====
+// Snapshot
+const unsigned int Snapshot::TileRows;
+
+Snapshot::Snapshot( unsigned int width, unsigned int height,
+                    const std::vector<std::string> &channels ) :
+        mWidth( width ),
+        mHeight( height ),
+        mChannels( channels ),
+        mPixels( static_cast<size_t>(width) * height * channels.size(), 0.f ),
+        mBytes( mPixels.size() * sizeof(float) ),
+        mCompressed( false )
+{
+}
+
+unsigned int Snapshot::tilesPerChannel() const
+{
+    return ( mHeight + TileRows - 1 ) / TileRows;
+}
+
+float *Snapshot::row( unsigned int channel, unsigned int y )
+{
+    return &mPixels[( static_cast<size_t>(channel) * mHeight + y ) * mWidth];
+}
+
+void Snapshot::readRow( unsigned int channel, unsigned int y,
+                        unsigned int x, unsigned int count, float *out ) const
+{
+    boost::mutex::scoped_lock lock( mMutex );
+    if ( !mCompressed )
+    {
+        memcpy( out, &mPixels[( static_cast<size_t>(channel) * mHeight + y ) * mWidth + x],
+                sizeof(float) * count );
+        return;
+    }
+
+    // expand the tile the first time it's read. Its encoded pixels never
+    // change once compressed, so we can inflate them without the lock and
+    // let other rows be read meanwhile.
+    Tile &tile = mTiles[channel * tilesPerChannel() + y / TileRows];
+    if ( tile.decoded.empty() )
+    {
+        unsigned int rows = std::min( TileRows, mHeight - ( y / TileRows ) * TileRows );
+        std::vector<float> decoded( static_cast<size_t>(rows) * mWidth );
+        std::vector<char> scratch;
+        lock.unlock();
+        decodePayload( CodecZlib, &tile.encoded[0], tile.encoded.size(), sizeof(float),
+                       &decoded[0], decoded.size() * sizeof(float), scratch );
+        lock.lock();
+
+        // another thread may have beaten us to it
+        if ( tile.decoded.empty() )
+        {
+            tile.decoded.swap( decoded );
+            mBytes += tile.decoded.size() * sizeof(float);
+        }
+    }
+    memcpy( out, &tile.decoded[( y % TileRows ) * mWidth + x], sizeof(float) * count );
+}
+
+void Snapshot::compress()
+{
+    if ( isCompressed() )
+        return;
+
+    // mPixels is only written before we're called and only freed here, so
+    // it can be read without holding the lock while we deflate it
+    std::vector<Tile> tiles( tilesPerChannel() * mChannels.size() );
+    size_t bytes = 0;
+    for ( unsigned int c=0; c<mChannels.size(); ++c )
+    {
+        for ( unsigned int t=0; t<tilesPerChannel(); ++t )
+        {
+            Tile &tile = tiles[c * tilesPerChannel() + t];
+            unsigned int rows = std::min( TileRows, mHeight - t * TileRows );
+            const float *pixels = &mPixels[( static_cast<size_t>(c) * mHeight + t * TileRows ) * mWidth];
+            size_t size = static_cast<size_t>(rows) * mWidth;
+            if ( encodePayload( CodecZlib, pixels, size * sizeof(float), sizeof(float), tile.encoded ) )
+            {
+                bytes += tile.encoded.size();
+            }
+            else
+            {
+                // keep tiles that don't compress as they are
+                tile.decoded.assign( pixels, pixels + size );
+                tile.stored = true;
+                bytes += size * sizeof(float);
+            }
+        }
+    }
+
+    boost::mutex::scoped_lock lock( mMutex );
+    mTiles.swap( tiles );
+    std::vector<float>().swap( mPixels );
+    mBytes = bytes;
+    mCompressed = true;
+}
+
+bool Snapshot::isCompressed() const
+{
+    boost::mutex::scoped_lock lock( mMutex );
+    return mCompressed;
+}
+
+void Snapshot::releaseTiles()
+{
+    boost::mutex::scoped_lock lock( mMutex );
+    for ( unsigned int i=0; i<mTiles.size(); ++i )
+    {
+        Tile &tile = mTiles[i];
+        if ( !tile.stored && !tile.decoded.empty() )
+        {
+            mBytes -= tile.decoded.size() * sizeof(float);
+            std::vector<float>().swap( tile.decoded );
+        }
+    }
+}
+
+size_t Snapshot::bytes() const
+{
+    boost::mutex::scoped_lock lock( mMutex );
+    return mBytes;
+}
+
+//=====
+// RenderHistory
+RenderHistory::RenderHistory( unsigned int maxRenders, size_t maxBytes ) :
+        mMaxRenders( maxRenders ),
+        mMaxBytes( maxBytes ),
+        mStopping( false )
+{
+}
+
+RenderHistory::~RenderHistory()
+{
+    {
+        boost::mutex::scoped_lock lock( mMutex );
+        mStopping = true;
+        mPendingChanged.notify_all();
+    }
+    if ( mThread.joinable() )
+        mThread.join();
+}
+
+void RenderHistory::setLimits( unsigned int maxRenders, size_t maxBytes )
+{
+    boost::mutex::scoped_lock lock( mMutex );
+    mMaxRenders = maxRenders;
+    mMaxBytes = maxBytes;
+    trim();
+}
+
+void RenderHistory::add( boost::shared_ptr<Snapshot> snapshot )
+{
+    boost::mutex::scoped_lock lock( mMutex );
+    mSnapshots.push_front( snapshot );
+    mPending.push_back( snapshot );
+    trim();
+    if ( !mThread.joinable() )
+        mThread = boost::thread( boost::bind(&RenderHistory::compressLoop, this) );
+    mPendingChanged.notify_all();
+}
+
+boost::shared_ptr<Snapshot> RenderHistory::get( unsigned int index ) const
+{
+    boost::mutex::scoped_lock lock( mMutex );
+    if ( index>=mSnapshots.size() )
+        return boost::shared_ptr<Snapshot>();
+    return mSnapshots[index];
+}
+
+boost::shared_ptr<Snapshot> RenderHistory::select( unsigned int index )
+{
+    boost::mutex::scoped_lock lock( mMutex );
+    for ( unsigned int i=0; i<mSnapshots.size(); ++i )
+        if ( i!=index )
+            mSnapshots[i]->releaseTiles();
+    if ( index>=mSnapshots.size() )
+        return boost::shared_ptr<Snapshot>();
+    return mSnapshots[index];
+}
+
+unsigned int RenderHistory::size() const
+{
+    boost::mutex::scoped_lock lock( mMutex );
+    return mSnapshots.size();
+}
+
+size_t RenderHistory::bytes() const
+{
+    boost::mutex::scoped_lock lock( mMutex );
+    size_t bytes = 0;
+    for ( unsigned int i=0; i<mSnapshots.size(); ++i )
+        bytes += mSnapshots[i]->bytes();
+    return bytes;
+}
+
+void RenderHistory::trim()
+{
+    // snapshots still waiting to be compressed don't count against the
+    // budget yet, as they're about to shrink
+    size_t bytes = 0;
+    for ( unsigned int i=0; i<mSnapshots.size(); ++i )
+        if ( mSnapshots[i]->isCompressed() )
+            bytes += mSnapshots[i]->bytes();
+    while ( mSnapshots.size()>1 &&
+            ( mSnapshots.size()>mMaxRenders || bytes>mMaxBytes ) )
+    {
+        if ( mSnapshots.back()->isCompressed() )
+            bytes -= mSnapshots.back()->bytes();
+        mSnapshots.pop_back();
+    }
+    if ( mMaxRenders==0 )
+        mSnapshots.clear();
+}
+
+void RenderHistory::compressLoop()
+{
+    boost::mutex::scoped_lock lock( mMutex );
+    for (;;)
+    {
+        while ( mPending.empty() && !mStopping )
+            mPendingChanged.wait( lock );
+        if ( mStopping )
+            return;
+
+        // compress the oldest waiting snapshot, unless it's been dropped
+        boost::shared_ptr<Snapshot> snapshot = mPending.front();
+        mPending.pop_front();
+        if ( snapshot.use_count()==1 )
+            continue;
+        lock.unlock();
+        snapshot->compress();
+        lock.lock();
+
+        // now it counts against the budget
+        trim();
+    }
+}
@@ -0,0 +1,182 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RMAN_CONNECT_RENDERHISTORY_H_
+#define RMAN_CONNECT_RENDERHISTORY_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <cstddef>
+#include <deque>
+#include <string>
+#include <vector>
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    /*! \class Snapshot
+     * \brief A copy of a finished image, compressed to save memory.
+     *
+     * A snapshot starts out holding its pixels uncompressed, one plane of
+     * rows per channel, which are filled in through row(). compress() then
+     * deflates it in tiles of TileRows rows of one channel and frees the
+     * uncompressed copy. Reading a row with readRow() decompresses the tile
+     * it's in the first time it's touched, so only the parts of the image
+     * that are actually looked at are expanded again.
+     *
+     * readRow(), compress() and releaseTiles() may be called from different
+     * threads at once.
+     */
+    class Snapshot
+    {
+    public:
+        //! The number of rows in each compressed tile
+        static const unsigned int TileRows = 32;
+
+        //! Constructs a black snapshot with the given size and channels.
+        Snapshot( unsigned int width, unsigned int height,
+                  const std::vector<std::string> &channels );
+
+        unsigned int width() const { return mWidth; }
+        unsigned int height() const { return mHeight; }
+        unsigned int numChannels() const { return mChannels.size(); }
+        //! The name of each channel
+        const std::vector<std::string> &channels() const { return mChannels; }
+
+        /*! \brief A row of one channel, to fill in before compressing.
+         *
+         * Only valid until compress() is called.
+         */
+        float *row( unsigned int channel, unsigned int y );
+
+        /*! \brief Copies count pixels of a row, starting at x, into out.
+         *
+         * Decompresses the row's tile if it hasn't been already.
+         */
+        void readRow( unsigned int channel, unsigned int y,
+                      unsigned int x, unsigned int count, float *out ) const;
+
+        //! Compresses the snapshot, freeing its uncompressed pixels.
+        void compress();
+
+        //! Has compress() finished?
+        bool isCompressed() const;
+
+        //! Frees any tiles readRow() has decompressed.
+        void releaseTiles();
+
+        //! The bytes of memory the snapshot's pixels are using.
+        size_t bytes() const;
+
+    private:
+        struct Tile
+        {
+            Tile() : stored(false) {}
+            std::vector<char> encoded;
+            std::vector<float> decoded;
+            bool stored; // didn't compress, so decoded is kept
+        };
+
+        unsigned int tilesPerChannel() const;
+
+        unsigned int mWidth, mHeight;
+        std::vector<std::string> mChannels;
+        std::vector<float> mPixels;
+        mutable std::vector<Tile> mTiles;
+        mutable size_t mBytes;
+        bool mCompressed;
+        mutable boost::mutex mMutex;
+    };
+
+    /*! \class RenderHistory
+     * \brief Keeps the most recent snapshots within a memory budget.
+     *
+     * Snapshots are compressed on a background thread once they're added.
+     * The oldest are dropped whenever there are more than maxRenders or
+     * the compressed ones use more than maxBytes between them, although
+     * the most recent is always kept. The thread is only started when the
+     * first snapshot is added.
+     */
+    class RenderHistory
+    {
+    public:
+        //! Constructor
+        RenderHistory( unsigned int maxRenders=4, size_t maxBytes=512*1024*1024 );
+        //! Destructor. Waits for any compression in progress to finish.
+        ~RenderHistory();
+
+        //! Sets how many snapshots are kept, and in how many bytes.
+        void setLimits( unsigned int maxRenders, size_t maxBytes );
+
+        //! Adds a snapshot, as the most recent.
+        void add( boost::shared_ptr<Snapshot> snapshot );
+
+        /*! \brief Returns a snapshot, 0 being the most recent.
+         *
+         * Returns an empty pointer if there aren't that many.
+         */
+        boost::shared_ptr<Snapshot> get( unsigned int index ) const;
+
+        /*! \brief Returns a snapshot about to be shown.
+         *
+         * Like get(), but also frees the decompressed tiles of every other
+         * snapshot so only the one being looked at is expanded.
+         */
+        boost::shared_ptr<Snapshot> select( unsigned int index );
+
+        //! The number of snapshots kept.
+        unsigned int size() const;
+
+        //! The bytes of memory all the snapshots are using.
+        size_t bytes() const;
+
+    private:
+        // the background thread's loop
+        void compressLoop();
+
+        // drop the oldest snapshots until we're within our limits. Call
+        // with mMutex held.
+        void trim();
+
+        RenderHistory( const RenderHistory& );
+        RenderHistory &operator=( const RenderHistory& );
+
+        std::deque< boost::shared_ptr<Snapshot> > mSnapshots; // most recent first
+        std::deque< boost::shared_ptr<Snapshot> > mPending; // waiting to be compressed
+        unsigned int mMaxRenders;
+        size_t mMaxBytes;
+        bool mStopping;
+        mutable boost::mutex mMutex;
+        boost::condition_variable mPendingChanged;
+        boost::thread mThread;
+    };
+}
+
+#endif // RMAN_CONNECT_RENDERHISTORY_H_
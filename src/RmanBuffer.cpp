@@ -0,0 +1,324 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "RmanBuffer.h"
+#include "Deinterleave.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+using namespace rmanconnect;
+
+// the header at the start of a cache file, followed by the channel names
+// (each null-terminated) and then, from dataOffset, the pixels
+struct RmanBuffer::CacheHeader
+{
+    char magic[8];
+    unsigned int version;
+    unsigned int width;
+    unsigned int height;
+    unsigned int channels;
+    unsigned int stride;
+    unsigned int bandRows;
+    unsigned int complete; // has the image finished rendering?
+    unsigned int namesBytes;
+    unsigned int dataOffset;
+};
+
+namespace
+{
+    const char CacheMagic[8] = { 'R', 'M', 'C', 'C', 'A', 'C', 'H', 'E' };
+    const unsigned int CacheVersion = 1;
+
+    // the bytes of pixels in a buffer
+    size_t bufferBytes( unsigned int height, unsigned int channels, unsigned int stride )
+    {
+        size_t bands = ( height + RmanBuffer::BandRows - 1 ) / RmanBuffer::BandRows;
+        return sizeof(float) * stride * bands * RmanBuffer::BandRows * channels;
+    }
+}
+
+const int RmanBuffer::BandRows;
+
+RmanBuffer::RmanBuffer() :
+        mWidth( 0 ),
+        mHeight( 0 ),
+        mChannels( 0 ),
+        mStride( 0 ),
+        mData( 0 ),
+        mBytes( 0 ),
+        mHeader( 0 ),
+        mMapBytes( 0 )
+{
+}
+
+RmanBuffer::~RmanBuffer()
+{
+    release();
+}
+
+bool RmanBuffer::init( unsigned int width, unsigned int height, unsigned int channels,
+                       const std::string &path, const std::vector<std::string> &names )
+{
+    // round each row up to a whole number of cache lines, avoiding
+    // multiples of 4k so the rows of a bucket don't all compete for the
+    // same cache sets
+    unsigned int stride = ( width + 15 ) & ~15u;
+    if ( stride % 1024 == 0 )
+        stride += 16;
+    size_t bytes = bufferBytes( height, channels, stride );
+
+    bool mapped = false;
+    if ( !path.empty() && bytes>0 )
+        mapped = create( path, width, height, channels, stride, bytes, names );
+    if ( !mapped && ( mHeader || bytes!=mBytes ) )
+    {
+        release();
+        if ( bytes>0 )
+        {
+            // big buffers are aligned for huge pages
+            size_t align = bytes >= ( 2u << 20 ) ? ( 2u << 20 ) : 64;
+            void *data = 0;
+            if ( posix_memalign( &data, align, bytes )!=0 )
+                throw std::bad_alloc();
+#ifdef MADV_HUGEPAGE
+            if ( align > 64 )
+                madvise( data, bytes, MADV_HUGEPAGE );
+#endif
+            mData = static_cast<float*>(data);
+            mBytes = bytes;
+        }
+    }
+    mWidth = width;
+    mHeight = height;
+    mChannels = channels;
+    mStride = stride;
+
+    // a new cache file is already zeroed
+    if ( mData && !mapped )
+        memset( mData, 0, mBytes );
+    return mapped || path.empty();
+}
+
+bool RmanBuffer::attach( const std::string &path, std::vector<std::string> &names )
+{
+    int fd = open( path.c_str(), O_RDWR );
+    if ( fd<0 )
+        return false;
+    struct stat st;
+    void *map = MAP_FAILED;
+    if ( fstat( fd, &st )==0 && static_cast<size_t>(st.st_size) >= sizeof(CacheHeader) )
+        map = mmap( 0, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( map==MAP_FAILED )
+        return false;
+
+    // check it's one of ours and all there
+    const CacheHeader *header = static_cast<CacheHeader*>(map);
+    size_t size = st.st_size;
+    size_t bytes = bufferBytes( header->height, header->channels, header->stride );
+    if ( memcmp( header->magic, CacheMagic, sizeof(header->magic) )!=0 ||
+         header->version!=CacheVersion ||
+         header->bandRows!=static_cast<unsigned int>(BandRows) ||
+         header->stride < header->width || header->stride % 16!=0 ||
+         header->dataOffset < sizeof(CacheHeader) + header->namesBytes ||
+         header->dataOffset % 64!=0 || size < header->dataOffset + bytes )
+    {
+        munmap( map, size );
+        return false;
+    }
+
+    // read the channel names
+    names.clear();
+    const char *name = reinterpret_cast<const char*>(header + 1);
+    const char *end = name + header->namesBytes;
+    while ( name<end && names.size()<header->channels )
+    {
+        size_t length = strnlen( name, end - name );
+        names.push_back( std::string( name, length ) );
+        name += length + 1;
+    }
+    if ( names.size()!=header->channels )
+    {
+        munmap( map, size );
+        return false;
+    }
+
+    release();
+    mHeader = static_cast<CacheHeader*>(map);
+    mPath = path;
+    mMapBytes = size;
+    mData = reinterpret_cast<float*>(static_cast<char*>(map) + header->dataOffset);
+    mBytes = bytes;
+    mWidth = header->width;
+    mHeight = header->height;
+    mChannels = header->channels;
+    mStride = header->stride;
+    return true;
+}
+
+void RmanBuffer::flush()
+{
+    if ( mHeader )
+        msync( mHeader, mMapBytes, MS_ASYNC );
+}
+
+void RmanBuffer::finish()
+{
+    if ( mHeader )
+    {
+        mHeader->complete = 1;
+        flush();
+    }
+}
+
+bool RmanBuffer::complete() const
+{
+    return mHeader && mHeader->complete;
+}
+
+void RmanBuffer::fill( unsigned int channel, float value )
+{
+    for ( unsigned int y=0; y<mHeight; y+=BandRows )
+    {
+        float *band = row( channel, y );
+        std::fill( band, band + mStride * BandRows, value );
+    }
+}
+
+bool RmanBuffer::clip( const Region &region, int &left, int &right, int &top, int &bottom ) const
+{
+    int width = mWidth, height = mHeight;
+    left = std::max( -region.x, 0 );
+    right = std::min( width - region.x, region.width );
+    top = std::max( height - ( region.y + region.height ), 0 );
+    bottom = std::min( height - region.y, height );
+    return left<right && top<bottom && mChannels>0;
+}
+
+void RmanBuffer::copy( const Region &region, const float *block, int left, int right,
+                       int first, int last, std::vector<float*> &rows )
+{
+    int channels = std::min( region.spp, static_cast<int>(mChannels) );
+    int scale = std::max( region.scale, 1 );
+    int row_width = ( region.width + scale - 1 ) / scale;
+    rows.resize( channels );
+    for ( int y=first; y<last; ++y )
+    {
+        int block_y = mHeight - y - 1 - region.y;
+        for ( int c=0; c<channels; ++c )
+            rows[c] = row( c, y ) + region.x + left;
+        deinterleaveScaled( block + ( row_width * ( block_y / scale ) + left / scale ) * region.spp,
+                            region.spp, &rows[0], channels, right - left, scale, left % scale );
+    }
+}
+
+bool RmanBuffer::create( const std::string &path, unsigned int width, unsigned int height,
+                         unsigned int channels, unsigned int stride, size_t bytes,
+                         const std::vector<std::string> &names )
+{
+    std::string packed;
+    for ( unsigned int c=0; c<channels; ++c )
+    {
+        packed += c < names.size() ? names[c] : std::string();
+        packed += '\0';
+    }
+    size_t page = sysconf( _SC_PAGESIZE );
+    size_t offset = ( sizeof(CacheHeader) + packed.size() + page - 1 ) / page * page;
+    size_t size = offset + bytes;
+
+    // if we already have this file mapped for an image of the same shape,
+    // just clear it rather than making it again. Punching out the pixels
+    // leaves the file sparse, as if it were new.
+    if ( mHeader && mPath==path && mMapBytes==size && mHeader->dataOffset==offset &&
+         mHeader->width==width && mHeader->height==height && mHeader->channels==channels &&
+         mHeader->stride==stride && mHeader->namesBytes==packed.size() &&
+         memcmp( mHeader + 1, packed.data(), packed.size() )==0 )
+    {
+        mHeader->complete = 0;
+#ifdef MADV_REMOVE
+        if ( madvise( mData, mBytes, MADV_REMOVE )!=0 )
+#endif
+            memset( mData, 0, mBytes );
+        return true;
+    }
+
+    // truncating it leaves the file sparse and zeroed, so untouched parts
+    // of the image never use any disk
+    release();
+    int fd = open( path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644 );
+    if ( fd<0 )
+        return false;
+    void *map = MAP_FAILED;
+    if ( ftruncate( fd, size )==0 )
+        map = mmap( 0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    close( fd );
+    if ( map==MAP_FAILED )
+    {
+        unlink( path.c_str() );
+        return false;
+    }
+
+    mHeader = static_cast<CacheHeader*>(map);
+    memcpy( mHeader->magic, CacheMagic, sizeof(mHeader->magic) );
+    mHeader->version = CacheVersion;
+    mHeader->width = width;
+    mHeader->height = height;
+    mHeader->channels = channels;
+    mHeader->stride = stride;
+    mHeader->bandRows = BandRows;
+    mHeader->complete = 0;
+    mHeader->namesBytes = packed.size();
+    mHeader->dataOffset = offset;
+    memcpy( mHeader + 1, packed.data(), packed.size() );
+    mPath = path;
+    mMapBytes = size;
+    mData = reinterpret_cast<float*>(static_cast<char*>(map) + offset);
+    mBytes = bytes;
+    return true;
+}
+
+void RmanBuffer::release()
+{
+    if ( mHeader )
+        munmap( mHeader, mMapBytes );
+    else
+        free( mData );
+    mData = 0;
+    mBytes = 0;
+    mHeader = 0;
+    mPath.clear();
+    mMapBytes = 0;
+}
@@ -0,0 +1,168 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RMAN_CONNECT_RMANBUFFER_H_
+#define RMAN_CONNECT_RMANBUFFER_H_
+
+#include "Data.h"
+#include <cstddef>
+#include <string>
+#include <vector>
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    /*! \class RmanBuffer
+     * \brief The image a receiver assembles from incoming buckets.
+     *
+     * The buffer holds any number of float channels per pixel, with rows
+     * running from the bottom of the image up. Rows are stored in bands of
+     * BandRows, each band holding that many rows of every channel in turn,
+     * so a bucket lands in one or two contiguous tiles of the buffer. Each
+     * row starts on a cache line so it can be copied straight out.
+     *
+     * The buffer can be kept in a memory-mapped cache file instead of
+     * memory, in which case buckets are written straight to the file's
+     * pages and the kernel writes them back to disk in the background.
+     * attach() maps an existing cache without reading it, so only the pages
+     * that are looked at are ever read back in.
+     *
+     * The buffer does no locking of its own. Receivers lock it a band of
+     * rows at a time (see copy()).
+     */
+    class RmanBuffer
+    {
+    public:
+        //! The number of rows in each band
+        static const int BandRows = 8;
+
+        //! Constructs an empty buffer.
+        RmanBuffer();
+        //! Destructor. Frees (or unmaps) the pixels.
+        ~RmanBuffer();
+
+        /*! \brief Sets up a black buffer.
+         *
+         * If a path is given the buffer is kept in a cache file there, along
+         * with the channel names. Returns false if the file couldn't be
+         * used, in which case the buffer is kept in memory instead.
+         *
+         * When the new image is the same shape as the last one (same size,
+         * channels and cache file) its memory or mapping is reused and just
+         * cleared.
+         */
+        bool init( unsigned int width, unsigned int height, unsigned int channels,
+                   const std::string &path="",
+                   const std::vector<std::string> &names=std::vector<std::string>() );
+
+        /*! \brief Maps an existing cache file, setting names to its channels.
+         *
+         * Returns false, leaving the buffer as it was, if there isn't a
+         * valid one.
+         */
+        bool attach( const std::string &path, std::vector<std::string> &names );
+
+        //! Is the buffer kept in a cache file?
+        bool cached() const { return mHeader!=0; }
+
+        //! Starts writing any changed pages of the cache file to disk.
+        void flush();
+
+        //! Notes that the image has finished rendering.
+        void finish();
+
+        //! Has the image finished rendering? (only known for cached images)
+        bool complete() const;
+
+        //! Sets one channel of every pixel to value.
+        void fill( unsigned int channel, float value );
+
+        //! A row of one channel.
+        float *row( unsigned int channel, unsigned int y )
+        {
+            return mData + offset( channel, y );
+        }
+
+        const float *row( unsigned int channel, unsigned int y ) const
+        {
+            return mData + offset( channel, y );
+        }
+
+        /*! \brief Finds where a block of pixels lands in the buffer.
+         *
+         * Sets left and right to the columns of the block that land in the
+         * buffer, and top and bottom to the (flipped) buffer rows it covers,
+         * bottom being one past the last. Returns false if none of it does.
+         */
+        bool clip( const Region &region, int &left, int &right, int &top, int &bottom ) const;
+
+        /*! \brief Copies the part of a block that lands on rows first to last-1.
+         *
+         * left and right are as set by clip(). Samples past the buffer's
+         * channels are dropped, and previews (see Region::scale) are
+         * scaled back up. rows is used as scratch space.
+         */
+        void copy( const Region &region, const float *block, int left, int right,
+                   int first, int last, std::vector<float*> &rows );
+
+        unsigned int width() const { return mWidth; }
+        unsigned int height() const { return mHeight; }
+        unsigned int numChannels() const { return mChannels; }
+        //! The number of samples in the buffer
+        unsigned int size() const { return mWidth * mHeight * mChannels; }
+
+    private:
+        struct CacheHeader;
+
+        size_t offset( unsigned int channel, unsigned int y ) const
+        {
+            size_t band = y / BandRows;
+            return ( ( band * mChannels + channel ) * BandRows + y % BandRows ) * mStride;
+        }
+
+        bool create( const std::string &path, unsigned int width, unsigned int height,
+                     unsigned int channels, unsigned int stride, size_t bytes,
+                     const std::vector<std::string> &names );
+        void release();
+
+        RmanBuffer( const RmanBuffer& );
+        RmanBuffer &operator=( const RmanBuffer& );
+
+        unsigned int mWidth, mHeight, mChannels;
+        unsigned int mStride; // floats from one row to the next in a band
+        float *mData;
+        size_t mBytes;
+        CacheHeader *mHeader; // the start of our cache file's mapping
+        std::string mPath; // the cache file we've mapped
+        size_t mMapBytes;
+    };
+}
+
+#endif // RMAN_CONNECT_RMANBUFFER_H_
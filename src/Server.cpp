@@ -29,41 +29,185 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
 #include "Server.h"
-#include "Client.h"
-#include <boost/lexical_cast.hpp>
-#include <vector>
-#include <iostream>
+#include "Connection.h"
+#include <boost/bind.hpp>
+#include <cstdio>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <stdexcept>
 
 using namespace rmanconnect;
 using boost::asio::ip::tcp;
 
+namespace
+{
+    // the most messages a client may have waiting for listen() before we
+    // stop reading from it
+    const unsigned int MaxUndeliveredMessages = 64;
+}
+
 Server::Server() :
         mPort(0),
-        mSocket( mIoService ),
-        mAcceptor( mIoService )
+        mNextImageId(1),
+        mPending(0),
+        mReactor(0),
+        mOwnIoService( new boost::asio::io_service ),
+        mIoService( *mOwnIoService ),
+        mStrand( mIoService ),
+        mAcceptor( mIoService ),
+        mLocalAcceptor( mIoService ),
+        mTimer( mIoService ),
+        mListenCount(0),
+        mTimedOut(false),
+        mQuit(false),
+        mListener(0),
+        mIdleWaiting(false),
+        mSink(0),
+        mSunk(false),
+        mSunkImageId(-1),
+        mStopping(false)
 {
 }
 
 Server::Server( int port ) :
         mPort(0),
-        mSocket( mIoService ),
-        mAcceptor( mIoService )
+        mNextImageId(1),
+        mPending(0),
+        mReactor(0),
+        mOwnIoService( new boost::asio::io_service ),
+        mIoService( *mOwnIoService ),
+        mStrand( mIoService ),
+        mAcceptor( mIoService ),
+        mLocalAcceptor( mIoService ),
+        mTimer( mIoService ),
+        mListenCount(0),
+        mTimedOut(false),
+        mQuit(false),
+        mListener(0),
+        mIdleWaiting(false),
+        mSink(0),
+        mSunk(false),
+        mSunkImageId(-1),
+        mStopping(false)
 {
     connect( port );
 }
 
+Server::Server( Reactor &reactor ) :
+        mPort(0),
+        mNextImageId(1),
+        mPending(0),
+        mReactor( &reactor ),
+        mOwnIoService(),
+        mIoService( reactor.ioService() ),
+        mStrand( mIoService ),
+        mAcceptor( mIoService ),
+        mLocalAcceptor( mIoService ),
+        mTimer( mIoService ),
+        mListenCount(0),
+        mTimedOut(false),
+        mQuit(false),
+        mListener(0),
+        mIdleWaiting(false),
+        mSink(0),
+        mSunk(false),
+        mSunkImageId(-1),
+        mStopping(false)
+{
+}
+
 Server::~Server()
 {
-    if ( mAcceptor.is_open() )
-        mAcceptor.close();
+    stop();
+}
+
+void Server::stop()
+{
+    // our sink isn't given any more pixels while we stop
+    PixelSink *sink = mSink;
+    if ( mReactor && !mStrand.running_in_this_thread() )
+    {
+        // close everything between our handlers, then wait for the ones
+        // that were cancelled to finish with us
+        addPending();
+        mStrand.post( boost::bind(&Server::handleClose, this) );
+        boost::mutex::scoped_lock lock( mPendingMutex );
+        while ( mPending>0 )
+            mPendingCondition.wait( lock );
+    }
+    else if ( mReactor )
+    {
+        // one of our own handlers can't wait for the others
+        close();
+    }
+    else
+    {
+        // close everything, then let any handlers still pending see that
+        // they've been cancelled
+        close();
+        mIoService.reset();
+        mIoService.poll();
+        mIoService.reset();
+    }
+    mSink = sink;
+    mSunk = false;
+    mQuit = false;
+
+    boost::mutex::scoped_lock lock( mQueueMutex );
+    mStopping = false;
+}
+
+void Server::close()
+{
+    // drop anything nobody listened to, and anything still to come
+    {
+        boost::mutex::scoped_lock lock( mQueueMutex );
+        mStopping = true;
+        mQueue.clear();
+        mConnectionStats.clear();
+    }
+    mSink = 0;
+
+    boost::system::error_code error;
+    mTimer.cancel( error );
+    mIdleWaiting = false;
+    mAcceptor.close( error );
+    if ( mLocalAcceptor.is_open() )
+    {
+        mLocalAcceptor.close( error );
+        ::unlink( mSocketPath.c_str() );
+    }
+    mSocketPath = "";
+    std::set< boost::shared_ptr<Connection> > connections;
+    connections.swap( mConnections );
+    for ( std::set< boost::shared_ptr<Connection> >::iterator it=connections.begin(); it!=connections.end(); ++it )
+        (*it)->close();
+}
+
+void Server::handleClose()
+{
+    close();
+    removePending();
 }
 
-void Server::connect( int port, bool search )
+void Server::addPending()
+{
+    boost::mutex::scoped_lock lock( mPendingMutex );
+    mPending++;
+}
+
+void Server::removePending()
+{
+    boost::mutex::scoped_lock lock( mPendingMutex );
+    if ( --mPending==0 )
+        mPendingCondition.notify_all();
+}
+
+void Server::connect( int port, bool search, const std::string &socketPath )
 {
     // disconnect if necessary
-    if ( mAcceptor.is_open() )
-        mAcceptor.close();
+    stop();
 
     // reconnect at specified port
     int start_port = port;
@@ -99,93 +243,390 @@ void Server::connect( int port, bool search )
         error += buffer;
         throw std::runtime_error( error.c_str() );
     }
+
+    // listen on our local socket too
+    if ( !socketPath.empty() )
+    {
+        try
+        {
+            // remove any socket left behind by a previous session, but
+            // never anything else that happens to be at the path
+            struct stat st;
+            if ( ::lstat( socketPath.c_str(), &st )==0 )
+            {
+                if ( !S_ISSOCK(st.st_mode) )
+                    throw std::runtime_error( "Not a socket" );
+                ::unlink( socketPath.c_str() );
+            }
+            boost::asio::local::stream_protocol::endpoint endpoint( socketPath );
+            mLocalAcceptor.open( endpoint.protocol() );
+            mLocalAcceptor.bind( endpoint );
+            mLocalAcceptor.listen();
+            mSocketPath = socketPath;
+        }
+        catch (...)
+        {
+            stop();
+            std::string error = "Failed to listen on socket: ";
+            error += socketPath;
+            throw std::runtime_error( error.c_str() );
+        }
+    }
+
+    // start accepting clients
+    startAccept();
+    if ( mLocalAcceptor.is_open() )
+        startLocalAccept();
+
+    // give our Listener its first chance to ask to be woken up
+    if ( mReactor )
+    {
+        addPending();
+        mStrand.post( boost::bind(&Server::handleDispatch, this) );
+    }
 }
 
-void Server::quit()
+void Server::startAccept()
 {
-    std::string hostname("localhost");
-    rmanconnect::Client client(hostname, mPort);
-    client.quit();
+    boost::shared_ptr<Connection> connection( new Connection(*this) );
+    mAcceptor.async_accept( connection->socket(),
+                            mStrand.wrap( boost::bind(&Server::handleAccept, this, connection, false,
+                                                      boost::asio::placeholders::error) ) );
 }
 
-void Server::accept()
+void Server::startLocalAccept()
 {
-    if ( mSocket.is_open() )
-        mSocket.close();
-    mAcceptor.accept(mSocket);
+    boost::shared_ptr<Connection> connection( new Connection(*this) );
+    mLocalAcceptor.async_accept( connection->localSocket(),
+                                 mStrand.wrap( boost::bind(&Server::handleAccept, this, connection, true,
+                                                           boost::asio::placeholders::error) ) );
 }
 
-Data Server::listen()
+void Server::handleAccept( boost::shared_ptr<Connection> connection, bool local,
+                           const boost::system::error_code &error )
 {
-    Data d;
+    if ( error==boost::asio::error::operation_aborted )
+        return;
 
-    // read the key from the incoming data
-    try
+    if ( !error )
     {
-        int key = -1;
-        boost::asio::read( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&key), sizeof(int)) );
-
-        switch( key )
+        ConnectionRecord record;
+        record.stats.local = local;
+        record.connected = boost::posix_time::microsec_clock::universal_time();
+        if ( local )
+            record.stats.peer = "local";
+        else
         {
-            case 0: // open image
+            boost::system::error_code peer_error;
+            tcp::endpoint peer = connection->socket().remote_endpoint( peer_error );
+            if ( !peer_error )
             {
-                // send back an image id
-                int image_id = 1;
-                boost::asio::write( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&image_id), sizeof(int) ) );
-
-                // get width & height
-                int width, height;
-                boost::asio::read( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&width), sizeof(int)) );
-                boost::asio::read( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&height), sizeof(int)) );
-
-                // create data object
-                d.mType = key;
-                d.mWidth = width;
-                d.mHeight = height;
-                break;
-            }
-            case 1: // image data
-            {
-                d.mType = key;
-
-                // receive image id
-                int image_id;
-                boost::asio::read( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&image_id), sizeof(int)) );
-
-                // get data info
-                boost::asio::read( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&d.mX), sizeof(int)) );
-                boost::asio::read( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&d.mY), sizeof(int)) );
-                boost::asio::read( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&d.mWidth), sizeof(int)) );
-                boost::asio::read( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&d.mHeight), sizeof(int)) );
-                boost::asio::read( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&d.mSpp), sizeof(int)) );
-
-                // get pixels
-                int num_samples = d.width() * d.height() * d.spp();
-                d.mPixelStore.resize( num_samples );
-                boost::asio::read( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&d.mPixelStore[0]), sizeof(float)*num_samples ) ) ;
-                break;
-            }
-            case 2: // close image
-            {
-                int image_id;
-                d.mType = key;
-                boost::asio::read( mSocket, boost::asio::buffer(reinterpret_cast<char*>(&image_id), sizeof(int)) );
-                mSocket.close();
-                break;
-            }
-            case 9: // quit
-            {
-                d.mType = 9;
-                mSocket.close();
-                break;
+                std::ostringstream str;
+                str << peer.address().to_string() << ":" << peer.port();
+                record.stats.peer = str.str();
             }
         }
+        {
+            boost::mutex::scoped_lock lock( mQueueMutex );
+            mConnectionStats[connection.get()] = record;
+        }
+        mConnections.insert( connection );
+        connection->start();
     }
-    catch( ... )
+
+    // wait for the next client
+    if ( local )
+        startLocalAccept();
+    else
+        startAccept();
+}
+
+bool Server::deliver( const boost::shared_ptr<Connection> &connection,
+                      const boost::shared_ptr<Data> &data )
+{
+    bool reading = true;
+    {
+        boost::mutex::scoped_lock lock( mQueueMutex );
+        if ( mStopping )
+            return false;
+        Delivery delivery;
+        delivery.connection = connection;
+        delivery.data = data;
+        mQueue.push_back( delivery );
+        gatherStats( *connection );
+
+        // pause the connection if it's too far ahead of the consumer
+        if ( ++connection->mUndelivered >= MaxUndeliveredMessages )
+        {
+            connection->mPaused = true;
+            reading = false;
+        }
+    }
+
+    // with a Reactor there's no one to wait for, so hand it over now
+    if ( mReactor )
+        dispatch();
+    return reading;
+}
+
+void Server::finished( const boost::shared_ptr<Connection> &connection )
+{
+    mConnections.erase( connection );
+    boost::mutex::scoped_lock lock( mQueueMutex );
+    mConnectionStats.erase( connection.get() );
+}
+
+void Server::sunk( Connection &connection, int imageId )
+{
+    {
+        boost::mutex::scoped_lock lock( mQueueMutex );
+        if ( mStopping )
+            return;
+        gatherStats( connection );
+        mSunk = true;
+        mSunkImageId = imageId;
+    }
+    if ( mReactor )
+        dispatch();
+}
+
+void Server::gatherStats( Connection &connection )
+{
+    // called with the queue locked
+    const ReceiveStats &stats = connection.mStats;
+    mStats.buckets += stats.buckets;
+    mStats.encodedBuckets += stats.encodedBuckets;
+    mStats.receivedBytes += stats.receivedBytes;
+    mStats.decodedBytes += stats.decodedBytes;
+    mStats.decodeSeconds += stats.decodeSeconds;
+    mStats.allocations += stats.allocations;
+    mStats.copiedBytes += stats.copiedBytes;
+    mStats.socketReads += stats.socketReads;
+
+    // and keep the connection's own totals
+    std::map<const Connection*, ConnectionRecord>::iterator it = mConnectionStats.find( &connection );
+    if ( it!=mConnectionStats.end() )
+    {
+        ConnectionRecord &record = it->second;
+        record.stats.imageId = connection.mImageId;
+        record.stats.sharedMemory = connection.mRing.isOpen();
+        if ( stats.buckets>0 )
+        {
+            record.stats.buckets += stats.buckets;
+            record.stats.receivedBytes += stats.receivedBytes;
+            record.lastPixels = boost::posix_time::microsec_clock::universal_time();
+        }
+    }
+    connection.mStats = ReceiveStats();
+}
+
+ReceiveStats Server::stats() const
+{
+    boost::mutex::scoped_lock lock( mQueueMutex );
+    return mStats;
+}
+
+std::vector<ConnectionStats> Server::connectionStats() const
+{
+    boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+    std::vector<ConnectionStats> result;
+    boost::mutex::scoped_lock lock( mQueueMutex );
+    for ( std::map<const Connection*, ConnectionRecord>::const_iterator it=mConnectionStats.begin();
+          it!=mConnectionStats.end(); ++it )
+    {
+        const ConnectionRecord &record = it->second;
+        ConnectionStats stats = record.stats;
+        stats.seconds = ( now - record.connected ).total_microseconds() / 1000000.0;
+        if ( !record.lastPixels.is_not_a_date_time() )
+        {
+            double seconds = ( record.lastPixels - record.connected ).total_microseconds() / 1000000.0;
+            if ( seconds>0.0 )
+                stats.bucketsPerSecond = stats.buckets / seconds;
+        }
+        result.push_back( stats );
+    }
+    return result;
+}
+
+void Server::resetStats()
+{
+    boost::mutex::scoped_lock lock( mQueueMutex );
+    mStats = ReceiveStats();
+    mPool.resetStats();
+}
+
+void Server::quit()
+{
+    // wake up listen() without making it wait for a message, or stop the
+    // Reactor's threads handling us
+    if ( mReactor )
+        stop();
+    else
+        mStrand.post( boost::bind(&Server::handleQuit, this) );
+}
+
+void Server::handleQuit()
+{
+    mQuit = true;
+}
+
+void Server::handleTimeout( unsigned int listenCount, const boost::system::error_code &error )
+{
+    if ( !error && listenCount==mListenCount )
+        mTimedOut = true;
+}
+
+bool Server::nextMessage( Data &d )
+{
+    Delivery delivery;
+    {
+        boost::mutex::scoped_lock lock( mQueueMutex );
+        if ( mQueue.empty() )
+        {
+            if ( !mSunk )
+                return false;
+
+            // say that our sink has been given some pixels
+            mSunk = false;
+            d.mType = MsgPixels;
+            d.mImageId = mSunkImageId;
+            return true;
+        }
+        delivery = mQueue.front();
+        mQueue.pop_front();
+
+        // restart the connection if it was waiting for us to catch up
+        Connection &connection = *delivery.connection;
+        connection.mUndelivered--;
+        if ( connection.mPaused && connection.mUndelivered < MaxUndeliveredMessages/2 )
+        {
+            connection.mPaused = false;
+            mStrand.post( boost::bind(&Connection::readHeader, delivery.connection) );
+        }
+    }
+
+    // hand over the message without copying its pixels
+    Data &from = *delivery.data;
+    d.mType = from.mType;
+    d.mImageId = from.mImageId;
+    d.mX = from.mX;
+    d.mY = from.mY;
+    d.mWidth = from.mWidth;
+    d.mHeight = from.mHeight;
+    d.mSpp = from.mSpp;
+    d.mChannels.swap( from.mChannels );
+    d.mPixelStore.swap( from.mPixelStore );
+    d.mRegions.swap( from.mRegions );
+    return true;
+}
+
+Data Server::listen( double timeout )
+{
+    if ( mReactor )
+        throw std::runtime_error( "Server is run by a Reactor!" );
+
+    // start the clock if we're not going to wait forever
+    mListenCount++;
+    mTimedOut = false;
+    if ( timeout>=0.0 )
     {
-        mSocket.close();
-        throw std::runtime_error( "Could not read from socket!" );
+        mTimer.expires_from_now( boost::posix_time::microseconds( static_cast<long>(timeout*1000000.0) ) );
+        mTimer.async_wait( mStrand.wrap( boost::bind(&Server::handleTimeout, this, mListenCount,
+                                                     boost::asio::placeholders::error) ) );
     }
 
+    // do some I/O until a message is ready
+    Data d;
+    while ( !nextMessage( d ) )
+    {
+        if ( mTimedOut )
+            return Data();
+        if ( mQuit )
+        {
+            mQuit = false;
+            d.mType = MsgQuit;
+            return d;
+        }
+        if ( mIoService.run_one()==0 )
+            throw std::runtime_error( "Server is not connected!" );
+    }
+    if ( timeout>=0.0 )
+    {
+        boost::system::error_code error;
+        mTimer.cancel( error );
+    }
     return d;
 }
+
+void Server::dispatch()
+{
+    // called from our strand
+    if ( !mListener )
+        return;
+    {
+        boost::mutex::scoped_lock lock( mQueueMutex );
+        if ( mStopping )
+            return;
+    }
+    while ( true )
+    {
+        Data d;
+        if ( !nextMessage( d ) )
+            break;
+        mListener->message( d );
+    }
+    idle();
+}
+
+void Server::idle()
+{
+    double wait = mListener->idle();
+    if ( wait<0.0 )
+        return;
+
+    // only move the timer if it's to wake up sooner (which cancels the
+    // wait already started)
+    boost::posix_time::ptime deadline = boost::posix_time::microsec_clock::universal_time() +
+            boost::posix_time::microseconds( static_cast<long>(wait*1000000.0) );
+    if ( mIdleWaiting && mTimer.expires_at()<=deadline )
+        return;
+    mTimer.expires_at( deadline );
+    mIdleWaiting = true;
+    addPending();
+    mTimer.async_wait( mStrand.wrap( boost::bind(&Server::handleIdle, this,
+                                                 boost::asio::placeholders::error) ) );
+}
+
+void Server::handleIdle( const boost::system::error_code &error )
+{
+    if ( !error )
+    {
+        mIdleWaiting = false;
+        try
+        {
+            dispatch();
+        }
+        catch( ... )
+        {
+            removePending();
+            throw;
+        }
+    }
+    removePending();
+}
+
+void Server::handleDispatch()
+{
+    // our Listener may throw (and the Reactor carries on), but stop() still
+    // needs to know we're done
+    try
+    {
+        dispatch();
+    }
+    catch( ... )
+    {
+        removePending();
+        throw;
+    }
+    removePending();
+}
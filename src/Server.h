@@ -32,16 +32,107 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #define RMAN_CONNECT_SERVER_H_
 
 #include "Data.h"
+#include "PayloadPool.h"
+#include "Reactor.h"
 #include <boost/asio.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread.hpp>
+#include <deque>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
 
 //! \namespace rmanconnect
 namespace rmanconnect
 {
+    /*! \struct ReceiveStats
+     * \brief Counters describing the pixels a Server has received.
+     */
+    struct ReceiveStats
+    {
+        ReceiveStats() :
+            buckets(0),
+            encodedBuckets(0),
+            receivedBytes(0),
+            decodedBytes(0),
+            decodeSeconds(0.0),
+            allocations(0),
+            copiedBytes(0),
+            socketReads(0)
+        {
+        }
+
+        //! Buckets of pixels received
+        unsigned long buckets;
+        //! Buckets that had to be decoded
+        unsigned long encodedBuckets;
+        //! Pixel bytes read from the socket
+        double receivedBytes;
+        //! Pixel bytes after decoding
+        double decodedBytes;
+        //! Total time spent decoding pixels
+        double decodeSeconds;
+        //! Heap allocations made while receiving messages
+        unsigned long allocations;
+        //! Pixel bytes copied by the Server after they were read or decoded
+        double copiedBytes;
+        //! Reads made from client sockets, each a single system call
+        unsigned long socketReads;
+    };
+
+    /*! \struct ConnectionStats
+     * \brief Counters describing one client connected to a Server.
+     */
+    struct ConnectionStats
+    {
+        ConnectionStats() :
+            imageId(-1),
+            local(false),
+            sharedMemory(false),
+            buckets(0),
+            receivedBytes(0),
+            seconds(0.0),
+            bucketsPerSecond(0.0)
+        {
+        }
+
+        //! The image the client has open, or -1
+        int imageId;
+        //! Where the client connected from
+        std::string peer;
+        //! Whether the client connected through the local socket
+        bool local;
+        //! Whether the client is sending pixels through shared memory
+        bool sharedMemory;
+        //! Buckets of pixels received from the client
+        unsigned long buckets;
+        //! Pixel bytes received from the client
+        double receivedBytes;
+        //! Seconds since the client connected
+        double seconds;
+        //! Buckets received per second, up to the last one received
+        double bucketsPerSecond;
+    };
+
+    class Connection;
+    class PixelSink;
+
     /*! \class Server
      * \brief Represents a listening Server, ready to accept incoming images.
      *
      * This class wraps up the provision of a TCP port, and handles incoming
      * connections from Client objects when they're ready to send image data.
+     *
+     * Once connected the Server accepts any number of Clients at once and
+     * reads from all of them asynchronously while listen() is waiting for a
+     * message. Their messages are queued up to be returned by listen(), each
+     * tagged with the id of the image it belongs to.
+     *
+     * Alternatively a Server can be made with a Reactor, whose threads do
+     * its I/O in the background and hand each message to a Listener as soon
+     * as it arrives, so nothing has to sit in listen().
      */
     class Server
     {
@@ -58,6 +149,14 @@ namespace rmanconnect
          * number.
          */
         Server( int port );
+        /*! \brief Constructor.
+         *
+         * Creates a new server whose I/O is done by reactor's threads, which
+         * hand its messages to the Listener given to setListener() rather
+         * than them being returned by listen(). The reactor must outlive
+         * the Server.
+         */
+        Server( Reactor &reactor );
         /*! \brief Destructor.
          *
          *  Shuts down the server, closing any open ports if the server is
@@ -71,27 +170,62 @@ namespace rmanconnect
          * search for the first available port if the specified one is not
          * available. To find out which port the server managed to connect to,
          * call getPort() afterwards.
+         *
+         * If a socketPath is given the server will also listen on a Unix
+         * domain socket at that path, which local Clients can connect to
+         * with Client::setSocketPath(). A socket already at that path
+         * (e.g. left behind by a Server that crashed) is replaced, but if
+         * anything else is there connect() throws rather than remove it.
          */
-        void connect( int port, bool seach=false );
-
-        /*! \brief Sets up the server to accept an incoming Client connections.
-         */
-        void accept();
+        void connect( int port, bool seach=false, const std::string &socketPath="" );
 
-        /*! \brief Listens for incoming messages from a Client.
+        /*! \brief Listens for incoming messages from any Client.
          *
          * This function blocks (and so may be require running on a separate
-         * thread), returning once a Client has sent a message.
+         * thread), returning once a Client has sent a message. All of the
+         * Server's I/O happens on the thread calling listen().
          *
          * The returned Data object is filled with the relevant information and
-         * passed back ready for handling by the parent application.
+         * passed back ready for handling by the parent application. Messages
+         * from one Client are returned in the order they were sent, and
+         * Data::imageId() says which image each one belongs to. If a Client
+         * goes away without closing its image, a close message is returned
+         * for it.
+         *
+         * If timeout is zero or more, listen() gives up after that many
+         * seconds and returns a Data whose type() is -1.
+         *
+         * If a PixelSink has been set the pixels themselves are handed to
+         * it instead. listen() then returns a pixels Data with no regions
+         * for each message of pixels the sink was given.
+         *
+         * A Server made with a Reactor can't be listened to, and throws.
+         */
+        Data listen( double timeout=-1.0 );
+
+        /*! \brief Sets what a Server made with a Reactor hands its messages
+         * to.
+         *
+         * Should be set before connect(). Until it is, messages are held
+         * back (and their Clients eventually stop being read from).
          */
-        Data listen();
+        void setListener( Listener *listener ){ mListener = listener; }
 
-        /*! \brief Sends a 'quit' message to the server.
+        /*! \brief Has pixels handed to sink as soon as they're read.
+         *
+         * Pass 0 to go back to returning them from listen(). The sink is
+         * called from inside listen() (or from the Reactor's threads) and
+         * must outlive the Server (or be unset first).
+         */
+        void setPixelSink( PixelSink *sink ){ mSink = sink; }
+
+        /*! \brief Stops the server listening.
          *
          * This can be used to exit a listening loop running on a separate
-         * thread.
+         * thread: the call to listen() wakes up and returns a message of
+         * type MsgQuit (9). A Server made with a Reactor disconnects from
+         * its port instead, returning once none of its handlers are
+         * running, so it mustn't be called from its own Listener.
          */
         void quit();
 
@@ -101,15 +235,139 @@ namespace rmanconnect
         //! Returns the port the server is currently connected to.
         int getPort(){ return mPort; }
 
+        //! Returns the local socket path the server is listening on, if any.
+        const std::string &getSocketPath(){ return mSocketPath; }
+
+        //! Returns the counters for the pixels received since the last reset.
+        ReceiveStats stats() const;
+
+        //! Resets the received pixel counters.
+        void resetStats();
+
+        /*! \brief Returns counters for each client currently connected.
+         *
+         * Unlike stats() these aren't reset by resetStats(); they cover the
+         * life of each connection. Safe to call from any thread.
+         */
+        std::vector<ConnectionStats> connectionStats() const;
+
+        /*! \brief Returns the counters for the pool that pixels are kept in.
+         *
+         * Pixels returned by listen() are held in blocks from a PayloadPool,
+         * which are reused once every copy of the Data holding them is gone.
+         */
+        PoolStats poolStats() const { return mPool.stats(); }
+
     private:
+        friend class Connection;
 
-        // the port we're listening to
+        // a message waiting to be returned by listen()
+        struct Delivery
+        {
+            boost::shared_ptr<Connection> connection;
+            boost::shared_ptr<Data> data;
+        };
+
+        // the counters for a connected client, and when it connected and
+        // last sent us pixels
+        struct ConnectionRecord
+        {
+            ConnectionStats stats;
+            boost::posix_time::ptime connected, lastPixels;
+        };
+
+        // accept clients asynchronously
+        void startAccept();
+        void startLocalAccept();
+        void handleAccept( boost::shared_ptr<Connection> connection, bool local,
+                           const boost::system::error_code &error );
+
+        // called by our connections from inside listen() (or from a
+        // Reactor's threads). deliver() returns false if the connection
+        // should stop reading for now.
+        bool deliver( const boost::shared_ptr<Connection> &connection,
+                      const boost::shared_ptr<Data> &data );
+        void finished( const boost::shared_ptr<Connection> &connection );
+        void sunk( Connection &connection, int imageId );
+        void gatherStats( Connection &connection );
+        int nextImageId(){ return mNextImageId++; }
+
+        // called when listen() times out, or quit() wakes it up
+        void handleTimeout( unsigned int listenCount, const boost::system::error_code &error );
+        void handleQuit();
+
+        // takes the next message for listen() or our Listener
+        bool nextMessage( Data &d );
+
+        // with a Reactor, hands queued messages to our Listener, and wakes
+        // it up when it asked to be
+        void dispatch();
+        void idle();
+        void handleIdle( const boost::system::error_code &error );
+        void handleDispatch();
+
+        // counts the handlers that might still refer to us: those holding
+        // a Connection, and our own timer and posts
+        void addPending();
+        void removePending();
+
+        // stop listening and drop every client, closing everything from
+        // our strand if we have a Reactor
+        void stop();
+        void close();
+        void handleClose();
+
+        // the port (and local socket) we're listening to
         int mPort;
+        std::string mSocketPath;
+
+        // the id given to the next image opened
+        int mNextImageId;
+
+        // where received pixels are kept
+        PayloadPool mPool;
+
+        // handlers that haven't finished with us (declared before the
+        // io_service, as destroying it may destroy the last Connections)
+        boost::mutex mPendingMutex;
+        boost::condition_variable mPendingCondition;
+        unsigned int mPending;
 
-        // boost::asio tcp stuff
-        boost::asio::io_service mIoService;
-        boost::asio::ip::tcp::socket mSocket;
+        // boost::asio stuff, run by listen() or by a Reactor's threads. All
+        // of our handlers run on one strand, so they never overlap.
+        Reactor *mReactor;
+        boost::scoped_ptr<boost::asio::io_service> mOwnIoService;
+        boost::asio::io_service &mIoService;
+        boost::asio::io_service::strand mStrand;
         boost::asio::ip::tcp::acceptor mAcceptor;
+        boost::asio::local::stream_protocol::acceptor mLocalAcceptor;
+        boost::asio::deadline_timer mTimer;
+
+        // for spotting which call to listen() a timeout belongs to, and
+        // whether quit() has woken it up
+        unsigned int mListenCount;
+        bool mTimedOut, mQuit;
+
+        // with a Reactor, where messages go and whether mTimer is waiting
+        // to wake it up
+        Listener *mListener;
+        bool mIdleWaiting;
+
+        // where pixels go instead of listen(), and the image of the last
+        // ones it was given if listen() hasn't said so yet
+        PixelSink *mSink;
+        bool mSunk;
+        int mSunkImageId;
+
+        // the clients we're connected to
+        std::set< boost::shared_ptr<Connection> > mConnections;
+
+        // messages waiting for listen(), and the counters for them
+        mutable boost::mutex mQueueMutex;
+        std::deque<Delivery> mQueue;
+        bool mStopping; // stop() is dropping every client
+        ReceiveStats mStats;
+        std::map<const Connection*, ConnectionRecord> mConnectionStats;
     };
 }
 
@@ -141,7 +399,8 @@ namespace rmanconnect
  * Ensure you have <a href="http://www.thefoundry.co.uk">Nuke</a> (5.2),
  * either <a href="http://www.3delight.com">3Delight</a> (9.0) or 
  * <a href="http://renderman.pixar.com">PRMan</a> (15.0),
- * <a href="http://www.boost.org/">Boost</a> (1.40) and
+ * <a href="http://www.boost.org/">Boost</a> (1.40),
+ * <a href="http://zlib.net/">zlib</a> and
  * <a href="http://cmake.org/">CMake</a> (2.8) installed. You should set the
  * following environment variables before running <i>cmake</i>.
  * <ul>
@@ -151,6 +410,9 @@ namespace rmanconnect
  *  <li><b>NDK_PATH</b> - The path to your Nuke libraries.
  * </ul>
  *
+ * The Nuke plugin and display driver are each skipped if their SDK can't be
+ * found, so the tools below can be built with just Boost and zlib.
+ *
  * \section rman_plugin Display Driver
  *
  * The display driver works just like any other, but has two additional
@@ -165,9 +427,85 @@ namespace rmanconnect
  * /display/dso/RmanConnect /full/path/to/d_rmanConnect
  * \endcode
  *
+ * The connection can be tuned with the optional <b>nodelay</b>,
+ * <b>sendbuffer</b> and <b>recvbuffer</b> integer parameters. By default
+ * Nagle's algorithm is disabled (<i>nodelay</i> is 1) so each bucket is sent
+ * as soon as it is ready, and the socket buffer sizes are left at the
+ * operating system defaults.
+ *
+ * Buckets are sent from a background thread so the renderer never waits on
+ * the network. The <b>queuemb</b> integer parameter (default 64) limits how
+ * much pixel memory may be waiting to be sent. When the limit is reached the
+ * renderer blocks until there is room, or if the <b>queuepolicy</b> string
+ * parameter is <i>"drop"</i> the bucket is discarded instead.
+ *
+ * Buckets waiting in the queue are sent together as a single batch message.
+ * The <b>batchbytes</b> integer parameter (default 65536) sets the most
+ * pixel data a batch may hold, and the <b>batchms</b> float parameter
+ * (default 0) sets how long the sender may wait for more buckets before
+ * flushing a batch. Set <i>batchbytes</i> to 0 to send every bucket on its
+ * own.
+ *
+ * Setting the <b>codec</b> string parameter to <i>"zlib"</i> losslessly
+ * compresses each bucket before it is sent, which is worthwhile when
+ * rendering to another machine over a slow network. The Nuke node prints
+ * the compression ratio and the time spent decoding each bucket when the
+ * image is closed.
+ *
+ * For interactive previews the <b>precision</b> string parameter can be set
+ * to <i>"half"</i>, which sends each sample as a 16-bit half-precision float
+ * and so halves the bandwidth. The Nuke plugin expands the samples back to
+ * 32-bit floats as they arrive.
+ *
+ * On the same host the driver can also connect through a Unix domain socket,
+ * which avoids the TCP stack altogether. Set the <b>socket</b> string
+ * parameter to the path given in the Nuke node's <b>socket</b> knob and the
+ * hostname and port will be ignored.
+ *
+ * When the display driver and Nuke are running on the same host the pixels
+ * are passed through a shared memory ring rather than the network stack.
+ * This can be turned off by setting the <b>sharedmemory</b> integer
+ * parameter to 0.
+ *
+ * When the renderer produces buckets faster than they can be delivered,
+ * setting the <b>preview</b> integer parameter to 2 or more sends a copy of
+ * each bucket shrunk by that factor ahead of the full-resolution queue. Nuke
+ * shows the whole image coarsely, then sharpens it as the full buckets
+ * arrive.
+ *
+ * Setting the <b>record</b> string parameter to a file path records every
+ * message the driver sends, with timestamps, for playing back later with
+ * the <i>rmanconnect_replay</i> tool.
+ *
+ * Setting the <b>trace</b> integer parameter to 1 timestamps each bucket as
+ * the renderer hands it over and as it is written to the socket, so the Nuke
+ * node can trace how long it took to reach the viewer (see below). The
+ * timestamps add 16 bytes to each message, which are zero when tracing is off.
+ *
+ * Once an image is closed the driver keeps its connection, and any shared
+ * memory ring, open for the next image the renderer sends to the same host
+ * and port, so sequences and interactive re-renders don't connect again for
+ * every frame. If the node has gone away in the meantime the driver simply
+ * connects again. Setting the <b>session</b> integer parameter to 0 closes
+ * the connection after each image instead.
+ *
+ * The driver prints nothing to the renderer's output unless the
+ * <b>stats</b> integer parameter is set to 1. It then prints a summary when
+ * each image is closed: how the send queue behaved if it ever filled up,
+ * the compression ratio and time spent encoding each bucket if a codec was
+ * used, and how long the whole image took to be shown if previews were sent.
+ *
  * It's important that you always render images as 32-bit floating-point
  * (i.e. the quantize settings are all zero).
  *
+ * A display can have any number of channels, and the names the renderer
+ * gives them are passed on to Nuke. <i>r</i>, <i>g</i>, <i>b</i>, <i>a</i>
+ * and <i>z</i> become the usual rgba and depth channels. Any other channel
+ * is put in a layer named after the part of its name before the last '.'
+ * (e.g. <i>__Pworld.x</i> becomes <i>Pworld.x</i>), or in the <i>other</i>
+ * layer if it has no '.', so one node can carry the beauty and several AOVs
+ * at once.
+ *
  * Here is an example of a rib snippet which renders the primary display to port
  * <i>9201</i> on <i>localhost</i>.
  *
@@ -213,22 +551,167 @@ namespace rmanconnect
  * nuke.createNode("RmanConnect")
  * \endcode
  *
- * The node has two knobs: a format knob, and a port knob.
+ * The node has a format knob, a port knob, a socket knob, a cache directory
+ * knob, a refresh rate knob, three knobs for comparing renders and two
+ * knobs reporting how it is keeping up.
  * The <b>format</b> sets the output buffer size for the node. If an incoming
  * image is a different size to the buffer then it will be padded with black or
  * cropped.
  * The <b>port</b> knob sets the TCP port address that the node will listen for
  * connections on.
  *
+ * Nodes don't have threads of their own. Every RmanConnect node in a Nuke
+ * session shares two I/O threads (a Reactor), which read from all of their
+ * ports and copy the buckets in, so opening more nodes or ports doesn't add
+ * threads. Changing the port or deleting a node wakes those threads straight
+ * away rather than waiting for a message.
+ *
  * \image html nukeplugin_knobs.jpg
  *
+ * The optional <b>socket</b> knob sets the path of a Unix domain socket the
+ * node will also listen on, for display drivers using the <b>socket</b>
+ * parameter.
+ *
+ * If the <b>cache directory</b> knob is set the image is kept in a
+ * memory-mapped file there (named after the node's port) rather than in
+ * memory. Buckets are written straight into the file and the operating system
+ * writes them to disk in the background, so if Nuke crashes or is restarted
+ * the node picks the render up again, even if it hadn't finished. Reloading a
+ * cached render doesn't read the file: each part of it is only read from disk
+ * when the viewer draws it. When the next image is the same size and has the
+ * same channels its buffer (or cache file) is reused and cleared rather than
+ * allocated again.
+ *
+ * The <b>refresh rate</b> knob sets the most times per second the viewer is
+ * refreshed while buckets arrive (<i>10</i> by default). Only the part of the
+ * image that changed since the last refresh is redrawn, and the whole image is
+ * refreshed as soon as the render finishes. A value of <i>0</i> refreshes
+ * after every bucket.
+ *
+ * Each time a render finishes the node keeps a compressed copy of it. The
+ * <b>show render</b> knob flips between them: <i>0</i> shows the live render,
+ * <i>1</i> the last one to finish, <i>2</i> the one before that, and so on.
+ * The <b>history</b> knob sets how many are kept (<i>4</i> by default, or
+ * <i>0</i> for none) and <b>history memory</b> the most megabytes they may
+ * use between them (<i>512</i>), dropping the oldest first. Renders are
+ * compressed in the background and each part is only expanded again when the
+ * viewer first draws it.
+ *
+ * The read-only <b>stats</b> knob describes the image being received, and is
+ * updated each time the viewer refreshes: the buckets copied into the buffer
+ * and how quickly they arrived, the average time spent copying each one, how
+ * many times copying a bucket and drawing the viewer had to wait for each
+ * other's locks (and for how long), how many viewer refreshes there have been,
+ * and a line for each connected display driver. Setting <b>log stats every</b>
+ * to a number of seconds also prints them to the terminal that often while
+ * buckets arrive (<i>0</i>, the default, doesn't). Server::connectionStats()
+ * returns the per-driver counters to other programs.
+ *
+ * When a display driver has its <b>trace</b> parameter set, the node traces
+ * how long each bucket spent waiting in the driver's queue, crossing to
+ * Nuke, being copied into the buffer and waiting for the viewer to draw one
+ * of its rows, and in total. The <b>stats</b> knob shows
+ * percentiles of each, and a second after each image closes they're printed
+ * to the terminal too. If the <b>trace file</b> knob is set each image's
+ * buckets are also written there as a Chrome trace, which can be opened in
+ * chrome://tracing or Perfetto to look for stalls, with the driver's stages
+ * shown as one process and Nuke's as another. Times are taken from the
+ * host's monotonic clock, so the transfer and total latencies are only
+ * meaningful when the renderer and Nuke are on the same host.
+ *
  * By default <b>port</b> is set to <i>9201</i> and if a node cannot connect
  * then it will report an error. Change the port value will disconnect the
  * server and reconnect it to the new port. All instances of the
  * <b>RmanConnect</b> node will need unique port addresses.
  *
+ * Any number of display drivers can render to the same node at once without
+ * holding each other up. The node shows whichever image was opened most
+ * recently and ignores buckets from the others.
+ *
  * \image html nukeplugin_portclash.jpg
  *
+ * \section replay Replaying Renders
+ *
+ * <i>rmanconnect_replay</i> plays a recording made with the display driver's
+ * <b>record</b> parameter back into a running node, exactly as it was sent,
+ * so the same render traffic can be used again and again to benchmark or
+ * test the receiving side without a renderer.
+ *
+ * \code
+ * rmanconnect_replay -port 9201 beauty.rec
+ * \endcode
+ *
+ * By default messages are sent with the timing they were recorded with.
+ * <b>-speed 4</b> plays back four times as fast and <b>-speed 0</b> as fast
+ * as possible. <b>-loop n</b> plays the recording n times, <b>-host</b> and
+ * <b>-socket</b> pick where to send it, and <b>-serve</b> plays it into a
+ * Server inside the tool itself, reporting how quickly it was received.
+ * Pixels are always replayed over the socket, even if they were recorded
+ * going through shared memory.
+ *
+ * \section benchmarks Benchmarking
+ *
+ * <i>rmanconnect_loadgen</i> stands in for a renderer, sending synthetic
+ * images through the same Client the display driver uses, and
+ * <i>rmanconnect_consumer</i> stands in for Nuke. It receives them on a
+ * Reactor into the same IngestBuffer the node uses, so it has the same
+ * band locking, refresh limiting and trace handling. Neither needs Nuke or
+ * a renderer, so the whole pipeline can be benchmarked on any machine.
+ *
+ * \code
+ * rmanconnect_consumer -port 9201 -images 4 &
+ * rmanconnect_loadgen -port 9201 -res 2048x1556 -bucket 16 -order spiral -frames 4
+ * \endcode
+ *
+ * The load generator takes the image size (<b>-res</b>), bucket size
+ * (<b>-bucket</b>), bucket order (<b>-order</b> scanline, spiral or random),
+ * samples per pixel (<b>-channels</b>), the number of images sent at once
+ * by separate Clients (<b>-images</b>) and the number each sends in turn
+ * (<b>-frames</b>), along with the transport options the display driver
+ * has (<b>-codec</b>, <b>-half</b>, <b>-batch</b>, <b>-preview</b>,
+ * <b>-queue</b>, <b>-noshm</b>, <b>-socket</b>, <b>-trace</b>). Each Client
+ * keeps its connection between frames unless <b>-nosession</b> is given. It
+ * reports MB/s, buckets/s, percentiles of how long each sendPixels() and
+ * openImage() call took, and how many writes to the socket each bucket
+ * needed.
+ *
+ * The consumer reports the same for each image it receives, along with how
+ * long each bucket took to copy in and the Server's ReceiveStats, including
+ * the socket reads each bucket needed.
+ * <b>-images n</b> makes it exit after n images and <b>-refresh</b> sets its
+ * refresh rate. Like the node it only follows the most recently opened
+ * image, so images that overlap are counted but not reported. Buckets sent
+ * with <b>-trace</b> have their latencies reported as the node's are, with
+ * each one counted as drawn at the next refresh, and <b>-trace path</b>
+ * writes them to a Chrome trace file.
+ *
+ * <i>rmanconnect_bench</i> is a suite of microbenchmarks. Along with the
+ * transport code (which is built once, as the <i>rmanconnect_core</i>
+ * library every target links) it builds the real display driver and Nuke
+ * plugin sources against small stand-ins for <i>ndspy.h</i> and DDImage in
+ * <i>bench/shims</i>. It can then render through DspyImageOpen(),
+ * DspyImageData() and DspyImageClose() into an RmanConnect node and read
+ * the result back with engine(), with neither SDK installed. Build with
+ * <b>-DCMAKE_BUILD_TYPE=Release</b> for meaningful numbers.
+ *
+ * \code
+ * rmanconnect_bench --filter=dspyImage --min_time=2
+ * \endcode
+ *
+ * The node listens on port 9301, or on <b>RMANCONNECT_BENCH_PORT</b> if it's
+ * set. <b>--list</b> lists the benchmarks.
+ *
+ * The transport benchmarks send whole images (<i>transport</i>) and single
+ * buckets, waiting for each to arrive (<i>transportLatency</i>), so their
+ * times are throughput and latency. Each has a <i>Local</i> variant that
+ * connects through a Unix domain socket rather than TCP loopback, and a
+ * <i>SharedMemory</i> variant that sends the pixels through a shared memory
+ * ring (the others don't use one):
+ *
+ * \code
+ * rmanconnect_bench --filter=transport
+ * \endcode
+ *
  * \section authors Authors
  * <ul><li>Dan Bethell (danbethell at gmail dot com)</li>
  * <li>Johannes Saam (johannes dot saam at googlemail dot com)</li></ul>
@@ -0,0 +1,227 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "SharedRing.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <stdexcept>
+
+using namespace rmanconnect;
+
+namespace
+{
+    const boost::uint32_t RingMagic = 0x52494e47; // 'RING'
+
+    // records start on 64-byte boundaries
+    const unsigned int RecordAlignment = 64;
+
+    unsigned int align( unsigned int size )
+    {
+        return ( size + RecordAlignment - 1 ) & ~( RecordAlignment - 1 );
+    }
+
+    // the capacity must divide 2^32 so positions can wrap around freely
+    unsigned int powerOfTwo( unsigned int size )
+    {
+        unsigned int result = RecordAlignment;
+        while ( result < size && result < 0x80000000u )
+            result <<= 1;
+        return result;
+    }
+}
+
+// the control block at the start of the mapping. head and tail are
+// free-running byte counts, kept on separate cache lines.
+struct SharedRing::Control
+{
+    boost::uint32_t magic;
+    boost::uint32_t capacity;
+    char pad0[56];
+    volatile boost::uint32_t head;
+    char pad1[60];
+    volatile boost::uint32_t tail;
+    char pad2[60];
+};
+
+SharedRing::SharedRing() :
+    mControl(0),
+    mData(0),
+    mMappedSize(0)
+{
+}
+
+SharedRing::~SharedRing()
+{
+    close();
+}
+
+void SharedRing::map( int fd, bool create, unsigned int capacity )
+{
+    if ( create )
+    {
+        mMappedSize = sizeof(Control) + capacity;
+        if ( ftruncate( fd, mMappedSize )!=0 )
+        {
+            ::close( fd );
+            throw std::runtime_error( "Could not size shared memory ring!" );
+        }
+    }
+    else
+    {
+        struct stat info;
+        if ( fstat( fd, &info )!=0 || info.st_size<=static_cast<off_t>(sizeof(Control)) )
+        {
+            ::close( fd );
+            throw std::runtime_error( "Could not open shared memory ring!" );
+        }
+        mMappedSize = info.st_size;
+    }
+
+    void *ptr = mmap( 0, mMappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0 );
+    ::close( fd );
+    if ( ptr==MAP_FAILED )
+        throw std::runtime_error( "Could not map shared memory ring!" );
+
+    mControl = reinterpret_cast<Control*>(ptr);
+    mData = reinterpret_cast<char*>(ptr) + sizeof(Control);
+    if ( create )
+    {
+        memset( mControl, 0, sizeof(Control) );
+        mControl->magic = RingMagic;
+        mControl->capacity = capacity;
+    }
+    else if ( mControl->magic!=RingMagic ||
+              sizeof(Control) + mControl->capacity!=mMappedSize )
+    {
+        close();
+        throw std::runtime_error( "Shared memory ring is not valid!" );
+    }
+}
+
+void SharedRing::create( const std::string &name, unsigned int capacity )
+{
+    close();
+    capacity = powerOfTwo( capacity );
+    int fd = shm_open( name.c_str(), O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR );
+    if ( fd<0 )
+        throw std::runtime_error( "Could not create shared memory ring!" );
+    mName = name;
+    try
+    {
+        map( fd, true, capacity );
+    }
+    catch( ... )
+    {
+        unlink();
+        throw;
+    }
+}
+
+void SharedRing::attach( const std::string &name )
+{
+    close();
+    int fd = shm_open( name.c_str(), O_RDWR, 0 );
+    if ( fd<0 )
+        throw std::runtime_error( "Could not open shared memory ring!" );
+    mName = name;
+    map( fd, false, 0 );
+}
+
+void SharedRing::close()
+{
+    if ( mControl )
+        munmap( mControl, mMappedSize );
+    mControl = 0;
+    mData = 0;
+    mMappedSize = 0;
+}
+
+void SharedRing::unlink()
+{
+    if ( !mName.empty() )
+        shm_unlink( mName.c_str() );
+}
+
+bool SharedRing::fits( unsigned int size ) const
+{
+    return mControl && align(size)<=mControl->capacity;
+}
+
+unsigned int SharedRing::place( boost::uint32_t pos, unsigned int size, unsigned int &used ) const
+{
+    unsigned int capacity = mControl->capacity;
+    unsigned int offset = pos % capacity;
+    used = align( size );
+    if ( offset + used > capacity )
+    {
+        // skip the space left at the end and start at the beginning
+        used += capacity - offset;
+        offset = 0;
+    }
+    return offset;
+}
+
+char *SharedRing::reserve( unsigned int size )
+{
+    unsigned int used;
+    boost::uint32_t head = mControl->head;
+    unsigned int offset = place( head, size, used );
+    __sync_synchronize();
+    if ( head - mControl->tail + used > mControl->capacity )
+        return 0;
+    return mData + offset;
+}
+
+void SharedRing::commit( unsigned int size )
+{
+    unsigned int used;
+    place( mControl->head, size, used );
+    __sync_synchronize();
+    mControl->head = mControl->head + used;
+}
+
+const char *SharedRing::front( unsigned int size ) const
+{
+    unsigned int used;
+    __sync_synchronize();
+    return mData + place( mControl->tail, size, used );
+}
+
+void SharedRing::release( unsigned int size )
+{
+    unsigned int used;
+    place( mControl->tail, size, used );
+    __sync_synchronize();
+    mControl->tail = mControl->tail + used;
+}
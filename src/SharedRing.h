@@ -0,0 +1,123 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef RMAN_CONNECT_SHAREDRING_H_
+#define RMAN_CONNECT_SHAREDRING_H_
+
+#include <boost/cstdint.hpp>
+#include <string>
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    /*! \class SharedRing
+     * \brief A single-producer, single-consumer ring buffer in POSIX shared
+     * memory.
+     *
+     * When a Client and Server are on the same host the Server creates a
+     * ring and the Client attaches to it. The Client then writes each payload
+     * straight into the ring and only sends its MessageHeader over the
+     * socket, so the pixels never pass through the network stack.
+     *
+     * Records are stored contiguously. A record that would run past the end
+     * of the ring starts again at the beginning instead, so both sides can
+     * work out where the next record is from its size alone.
+     */
+    class SharedRing
+    {
+    public:
+        //! Constructor
+        SharedRing();
+        //! Destructor. Unmaps the ring.
+        ~SharedRing();
+
+        /*! \brief Creates a new ring of the given capacity (consumer-side).
+         *
+         * The capacity is rounded up to a power of two.
+         * Throws std::runtime_error if the shared memory can't be created.
+         */
+        void create( const std::string &name, unsigned int capacity );
+
+        /*! \brief Attaches to an existing ring (producer-side).
+         *
+         * Throws std::runtime_error if the ring can't be opened.
+         */
+        void attach( const std::string &name );
+
+        //! Unmaps the ring.
+        void close();
+
+        //! Removes the ring's name so no one else can attach to it.
+        void unlink();
+
+        //! Returns true if a ring is mapped.
+        bool isOpen() const { return mControl!=0; }
+
+        //! The name of the ring.
+        const std::string &name() const { return mName; }
+
+        //! Returns true if a record of this size could ever fit.
+        bool fits( unsigned int size ) const;
+
+        /*! \brief Returns space for the next record, or 0 if it's full.
+         *
+         * Call commit() once the record has been written.
+         */
+        char *reserve( unsigned int size );
+
+        //! Makes a reserved record visible to the consumer.
+        void commit( unsigned int size );
+
+        /*! \brief Returns the next record.
+         *
+         * The producer must have committed the record before telling the
+         * consumer about it. Call release() once it has been read.
+         */
+        const char *front( unsigned int size ) const;
+
+        //! Frees the next record so the producer can reuse its space.
+        void release( unsigned int size );
+
+    private:
+        struct Control;
+
+        void map( int fd, bool create, unsigned int capacity );
+        // offset of a record starting at position pos, and the space it uses
+        unsigned int place( boost::uint32_t pos, unsigned int size, unsigned int &used ) const;
+
+        std::string mName;
+        Control *mControl;
+        char *mData;
+        size_t mMappedSize;
+    };
+}
+
+#endif // RMAN_CONNECT_SHAREDRING_H_
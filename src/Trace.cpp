@@ -0,0 +1,261 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#include "Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <time.h>
+
+using namespace rmanconnect;
+
+namespace
+{
+    // enough bins to cover 1us to 2^Octaves us
+    const int Octaves = 30;
+    const int NumBins = Octaves * LatencyHistogram::BinsPerOctave + 1;
+
+    // the nanoseconds from start to end, or 0 if either is missing (or
+    // they came from clocks that don't agree)
+    bool latency( boost::uint64_t start, boost::uint64_t end, boost::uint64_t &nanoseconds )
+    {
+        if ( start==0 || end==0 || end<start )
+            return false;
+        nanoseconds = end - start;
+        return true;
+    }
+
+    // writes one async Chrome trace event
+    void writeEvent( std::ostream &out, const char *name, const char *phase, unsigned long id,
+                     int pid, boost::uint64_t time, boost::uint64_t origin, const BucketTrace *trace )
+    {
+        out << ",\n{\"name\":\"" << name << "\",\"cat\":\"bucket\",\"ph\":\"" << phase
+            << "\",\"id\":" << id << ",\"pid\":" << pid << ",\"tid\":" << pid
+            << ",\"ts\":" << ( time - origin ) / 1000.0;
+        if ( trace )
+            out << ",\"args\":{\"image\":" << trace->imageId << ",\"x\":" << trace->x
+                << ",\"y\":" << trace->y << ",\"width\":" << trace->width
+                << ",\"height\":" << trace->height << ",\"scale\":" << trace->scale << "}";
+        out << "}";
+    }
+
+    // writes a stage of a trace as a begin/end pair
+    void writeStage( std::ostream &out, const char *name, unsigned long id, int pid,
+                     boost::uint64_t start, boost::uint64_t end, boost::uint64_t origin,
+                     const BucketTrace &trace )
+    {
+        boost::uint64_t nanoseconds;
+        if ( !latency( start, end, nanoseconds ) || start<origin )
+            return;
+        writeEvent( out, name, "b", id, pid, start, origin, &trace );
+        writeEvent( out, name, "e", id, pid, end, origin, 0 );
+    }
+}
+
+boost::uint64_t rmanconnect::traceClock()
+{
+    timespec now;
+    clock_gettime( CLOCK_MONOTONIC, &now );
+    return static_cast<boost::uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+//=====
+// LatencyHistogram
+const int LatencyHistogram::BinsPerOctave;
+
+LatencyHistogram::LatencyHistogram() :
+        mBins( NumBins, 0 ),
+        mCount( 0 ),
+        mTotal( 0.0 ),
+        mMax( 0 )
+{
+}
+
+void LatencyHistogram::add( boost::uint64_t nanoseconds )
+{
+    int bin = 0;
+    if ( nanoseconds>1000 )
+        bin = std::min( static_cast<int>( std::log( nanoseconds / 1000.0 ) / std::log( 2.0 ) * BinsPerOctave ),
+                        NumBins - 1 );
+    mBins[bin]++;
+    mCount++;
+    mTotal += nanoseconds;
+    mMax = std::max( mMax, nanoseconds );
+}
+
+double LatencyHistogram::mean() const
+{
+    return mCount ? mTotal / mCount / 1000000000.0 : 0.0;
+}
+
+double LatencyHistogram::percentile( double fraction ) const
+{
+    // find the bin holding the percentile, and give its upper edge
+    unsigned long wanted = static_cast<unsigned long>( std::ceil( fraction * mCount ) ), seen = 0;
+    for ( int i=0; i<NumBins; ++i )
+    {
+        seen += mBins[i];
+        if ( seen>0 && seen>=wanted )
+            return std::min( std::pow( 2.0, ( i + 1.0 ) / BinsPerOctave ) / 1000000.0, max() );
+    }
+    return max();
+}
+
+void LatencyHistogram::clear()
+{
+    std::fill( mBins.begin(), mBins.end(), 0 );
+    mCount = 0;
+    mTotal = 0.0;
+    mMax = 0;
+}
+
+//=====
+// TraceLog
+TraceLog::TraceLog( unsigned long maxTraces ) :
+        mMaxTraces( maxTraces ),
+        mCount( 0 ),
+        mHistograms( NumStages )
+{
+}
+
+void TraceLog::add( const BucketTrace &trace )
+{
+    const BlockTimes &times = trace.times;
+    boost::uint64_t nanoseconds[NumStages];
+    bool has[NumStages];
+    has[StageQueued] = latency( times.enqueued, times.sent, nanoseconds[StageQueued] );
+    has[StageTransfer] = latency( times.sent, times.received, nanoseconds[StageTransfer] );
+    has[StageIngest] = latency( times.received, trace.committed, nanoseconds[StageIngest] );
+    has[StageDisplay] = latency( trace.committed, trace.drawn, nanoseconds[StageDisplay] );
+    has[StageTotal] = latency( times.enqueued, trace.drawn, nanoseconds[StageTotal] );
+
+    boost::mutex::scoped_lock lock( mMutex );
+    for ( int i=0; i<NumStages; ++i )
+        if ( has[i] )
+            mHistograms[i].add( nanoseconds[i] );
+    if ( mTraces.size()<mMaxTraces )
+        mTraces.push_back( trace );
+    mCount++;
+}
+
+void TraceLog::clear()
+{
+    boost::mutex::scoped_lock lock( mMutex );
+    for ( int i=0; i<NumStages; ++i )
+        mHistograms[i].clear();
+    mTraces.clear();
+    mCount = 0;
+}
+
+unsigned long TraceLog::count() const
+{
+    boost::mutex::scoped_lock lock( mMutex );
+    return mCount;
+}
+
+LatencyHistogram TraceLog::histogram( Stage stage ) const
+{
+    boost::mutex::scoped_lock lock( mMutex );
+    return mHistograms[stage];
+}
+
+const char *TraceLog::stageName( Stage stage )
+{
+    switch ( stage )
+    {
+        case StageQueued: return "queued";
+        case StageTransfer: return "transfer";
+        case StageIngest: return "ingest";
+        case StageDisplay: return "display";
+        case StageTotal: return "total";
+        default: return "";
+    }
+}
+
+std::string TraceLog::summary( const std::string &indent ) const
+{
+    std::stringstream ss;
+    ss.setf( std::ios::fixed );
+    ss.precision( 2 );
+    bool first = true;
+    boost::mutex::scoped_lock lock( mMutex );
+    for ( int i=0; i<NumStages; ++i )
+    {
+        const LatencyHistogram &histogram = mHistograms[i];
+        if ( histogram.count()==0 )
+            continue;
+        if ( !first )
+            ss << "\n";
+        first = false;
+        ss << indent << stageName( static_cast<Stage>(i) ) << " latency p50 "
+           << histogram.percentile( 0.5 ) * 1000.0 << " ms, p95 "
+           << histogram.percentile( 0.95 ) * 1000.0 << " ms, p99 "
+           << histogram.percentile( 0.99 ) * 1000.0 << " ms, max "
+           << histogram.max() * 1000.0 << " ms";
+    }
+    return ss.str();
+}
+
+bool TraceLog::writeChromeTrace( const std::string &path ) const
+{
+    std::ofstream out( path.c_str() );
+    if ( !out )
+        return false;
+
+    boost::mutex::scoped_lock lock( mMutex );
+
+    // times are given from the earliest one, in microseconds
+    boost::uint64_t origin = 0;
+    for ( unsigned long i=0; i<mTraces.size(); ++i )
+    {
+        const BucketTrace &trace = mTraces[i];
+        boost::uint64_t first = trace.times.enqueued ? trace.times.enqueued : trace.times.received;
+        if ( first && ( origin==0 || first<origin ) )
+            origin = first;
+    }
+
+    out.setf( std::ios::fixed );
+    out.precision( 3 );
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+        << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"display driver\"}},\n"
+        << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":2,\"args\":{\"name\":\"server\"}}";
+    for ( unsigned long i=0; i<mTraces.size(); ++i )
+    {
+        const BucketTrace &trace = mTraces[i];
+        const BlockTimes &times = trace.times;
+        writeStage( out, "queued", i, 1, times.enqueued, times.sent, origin, trace );
+        writeStage( out, "transfer", i, 2, times.sent, times.received, origin, trace );
+        writeStage( out, "ingest", i, 2, times.received, trace.committed, origin, trace );
+        writeStage( out, "display", i, 2, trace.committed, trace.drawn, origin, trace );
+    }
+    out << "\n]}\n";
+    return out.good();
+}
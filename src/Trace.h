@@ -0,0 +1,168 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef RMAN_CONNECT_TRACE_H_
+#define RMAN_CONNECT_TRACE_H_
+
+#include "Data.h"
+#include <boost/cstdint.hpp>
+#include <boost/thread.hpp>
+#include <string>
+#include <vector>
+
+//! \namespace rmanconnect
+namespace rmanconnect
+{
+    /*! \brief Returns the time in nanoseconds on the host's monotonic clock.
+     *
+     * Every process on a host shares the clock, so times taken by a display
+     * driver and by Nuke can be compared if they're on the same host.
+     */
+    boost::uint64_t traceClock();
+
+    /*! \class LatencyHistogram
+     * \brief Counts latencies in logarithmic bins, from 1us to about 17 minutes.
+     *
+     * Each power of two is split into BinsPerOctave bins, so percentiles
+     * are accurate to within about 20%.
+     */
+    class LatencyHistogram
+    {
+    public:
+        //! The number of bins each doubling of latency is split into
+        static const int BinsPerOctave = 4;
+
+        LatencyHistogram();
+
+        //! Counts a latency of the given nanoseconds.
+        void add( boost::uint64_t nanoseconds );
+
+        //! The number of latencies counted
+        unsigned long count() const { return mCount; }
+        //! The average latency in seconds, or 0 if there are none
+        double mean() const;
+        //! The largest latency in seconds
+        double max() const { return mMax / 1000000000.0; }
+        //! The latency in seconds that fraction (0-1) of them are within
+        double percentile( double fraction ) const;
+
+        void clear();
+
+    private:
+        std::vector<unsigned long> mBins;
+        unsigned long mCount;
+        double mTotal;
+        boost::uint64_t mMax;
+    };
+
+    /*! \struct BucketTrace
+     * \brief When one block of pixels passed each stage on its way to the viewer.
+     *
+     * times holds the driver and Server stages. committed is when the
+     * block had been copied into the consumer's buffer and drawn when it
+     * was first read back out for display, or 0 if it hasn't been.
+     */
+    struct BucketTrace
+    {
+        int imageId;
+        int x, y, width, height, scale;
+        BlockTimes times;
+        boost::uint64_t committed, drawn;
+    };
+
+    /*! \class TraceLog
+     * \brief Collects BucketTraces into latency histograms and a Chrome trace.
+     *
+     * The latency between each pair of stages is counted in a
+     * LatencyHistogram. The traces themselves are kept too, up to a limit,
+     * so they can be written out as a Chrome trace (JSON) to be loaded into
+     * chrome://tracing or Perfetto. The driver's stages appear in one
+     * process and the Server's and consumer's in another.
+     *
+     * Safe to use from several threads at once.
+     */
+    class TraceLog
+    {
+    public:
+        //! The latencies kept in histograms
+        enum Stage
+        {
+            //! From DspyImageData to being written to the socket
+            StageQueued,
+            //! From being written to the socket to being read by the Server
+            StageTransfer,
+            //! From being read to being in the consumer's buffer
+            StageIngest,
+            //! From being in the buffer to being read for display
+            StageDisplay,
+            //! From DspyImageData to being read for display
+            StageTotal,
+            NumStages
+        };
+
+        //! Constructs a log that keeps up to maxTraces traces.
+        TraceLog( unsigned long maxTraces=262144 );
+
+        //! Adds a trace, counting the latency of each stage it went through.
+        void add( const BucketTrace &trace );
+
+        //! Forgets every trace.
+        void clear();
+
+        //! The number of traces added since the last clear()
+        unsigned long count() const;
+
+        //! A copy of the histogram for one stage
+        LatencyHistogram histogram( Stage stage ) const;
+
+        //! The name of a stage
+        static const char *stageName( Stage stage );
+
+        /*! \brief Describes each stage's latency percentiles, a line per stage.
+         *
+         * Each line starts with indent. Returns "" if there are no traces.
+         */
+        std::string summary( const std::string &indent="" ) const;
+
+        /*! \brief Writes the traces kept to a Chrome trace file.
+         *
+         * Returns false if the file couldn't be written.
+         */
+        bool writeChromeTrace( const std::string &path ) const;
+
+    private:
+        mutable boost::mutex mMutex;
+        unsigned long mMaxTraces, mCount;
+        std::vector<BucketTrace> mTraces;
+        std::vector<LatencyHistogram> mHistograms;
+    };
+}
+
+#endif // RMAN_CONNECT_TRACE_H_
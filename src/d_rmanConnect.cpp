@@ -32,10 +32,96 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <iostream>
 #include <exception>
 #include <cstring>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
 
 #include "Client.h"
 #include "Data.h"
 
+namespace
+{
+    // Persistent Clients that aren't carrying an image, keyed by the server
+    // they're connected to. The renderer opens one image per display and
+    // frame, so keeping these around lets the next image to the same server
+    // reuse the connection (and shared memory ring) rather than making a
+    // new one.
+    class SessionPool
+    {
+    public:
+        ~SessionPool()
+        {
+            for ( std::multimap<std::string, rmanconnect::Client*>::iterator it=mIdle.begin();
+                  it!=mIdle.end(); ++it )
+                delete it->second;
+        }
+
+        // returns an idle Client for the server, or 0 if there isn't one
+        rmanconnect::Client *take( const std::string &key )
+        {
+            boost::mutex::scoped_lock lock( mMutex );
+            std::multimap<std::string, rmanconnect::Client*>::iterator it = mIdle.find( key );
+            if ( it==mIdle.end() )
+                return 0;
+            rmanconnect::Client *client = it->second;
+            mIdle.erase( it );
+            mKeys[client] = key;
+            return client;
+        }
+
+        // starts tracking a new Client for the server
+        void add( const std::string &key, rmanconnect::Client *client )
+        {
+            boost::mutex::scoped_lock lock( mMutex );
+            mKeys[client] = key;
+        }
+
+        // puts a Client back once its image is closed, or deletes it if it
+        // can't be reused
+        void release( rmanconnect::Client *client, bool reuse )
+        {
+            {
+                boost::mutex::scoped_lock lock( mMutex );
+                std::map<rmanconnect::Client*, std::string>::iterator it = mKeys.find( client );
+                if ( it!=mKeys.end() )
+                {
+                    if ( reuse && mIdle.count(it->second)<MaxIdle )
+                    {
+                        mIdle.insert( std::make_pair(it->second, client) );
+                        mKeys.erase( it );
+                        return;
+                    }
+                    mKeys.erase( it );
+                }
+            }
+            delete client;
+        }
+
+    private:
+        // most idle connections kept to any one server
+        static const unsigned int MaxIdle = 16;
+
+        boost::mutex mMutex;
+        std::multimap<std::string, rmanconnect::Client*> mIdle;
+        std::map<rmanconnect::Client*, std::string> mKeys;
+    };
+
+    SessionPool sessions;
+
+    // the handle the renderer holds for each open image
+    struct OpenImage
+    {
+        rmanconnect::Client *client;
+        // print the send queue's stats when the image is closed
+        bool printStats;
+        // keep the client for the next image once this one is closed
+        bool session;
+    };
+}
+
 extern "C"
 {
     // open our display driver
@@ -56,6 +142,28 @@ extern "C"
         int port_address = 9201;
         DspyFindIntInParamList( "port", &port_address, paramCount, parameters );
 
+        // get an optional local socket path from the 'socket' display
+        // parameter
+        char *socket_tmp = 0;
+        DspyFindStringInParamList( "socket", &socket_tmp, paramCount, parameters );
+
+        // get our socket options from the 'nodelay', 'sendbuffer' and
+        // 'recvbuffer' display parameters
+        int no_delay = 1, send_buffer = 0, recv_buffer = 0;
+        DspyFindIntInParamList( "nodelay", &no_delay, paramCount, parameters );
+        DspyFindIntInParamList( "sendbuffer", &send_buffer, paramCount, parameters );
+        DspyFindIntInParamList( "recvbuffer", &recv_buffer, paramCount, parameters );
+
+        // get our send queue limits from the 'queuemb' and 'queuepolicy'
+        // display parameters
+        int queue_mb = 64;
+        DspyFindIntInParamList( "queuemb", &queue_mb, paramCount, parameters );
+        bool drop_when_full = false;
+        char *policy_tmp = 0;
+        DspyFindStringInParamList( "queuepolicy", &policy_tmp, paramCount, parameters );
+        if ( policy_tmp && std::string(policy_tmp)=="drop" )
+            drop_when_full = true;
+
         // shuffle format so we always write out RGBA
         std::string chan[4] = { "r", "g", "b", "a" };
         for ( unsigned i=0; i<formatCount; i++ )
@@ -67,23 +175,108 @@ extern "C"
                     format[i] = tmp;
                 }
 
+        // get our batching limits from the 'batchbytes' and 'batchms'
+        // display parameters
+        int batch_bytes = 64*1024;
+        float batch_ms = 0.f;
+        DspyFindIntInParamList( "batchbytes", &batch_bytes, paramCount, parameters );
+        DspyFindFloatInParamList( "batchms", &batch_ms, paramCount, parameters );
+
+        // get the codec to encode pixels with from the 'codec' display
+        // parameter
+        char *codec_tmp = 0;
+        DspyFindStringInParamList( "codec", &codec_tmp, paramCount, parameters );
+        rmanconnect::PayloadCodec codec = rmanconnect::codecFromName( codec_tmp );
+
+        // get the sample format to send from the 'precision' display
+        // parameter
+        char *precision_tmp = 0;
+        DspyFindStringInParamList( "precision", &precision_tmp, paramCount, parameters );
+        rmanconnect::SampleFormat precision = rmanconnect::FormatFloat32;
+        if ( precision_tmp && std::string(precision_tmp)=="half" )
+            precision = rmanconnect::FormatFloat16;
+
+        // see whether we may use shared memory from the 'sharedmemory'
+        // display parameter
+        int shared_memory = 1;
+        DspyFindIntInParamList( "sharedmemory", &shared_memory, paramCount, parameters );
+
+        // send a reduced preview of each bucket ahead of it, shrunk by the
+        // 'preview' display parameter (0 sends none)
+        int preview_scale = 0;
+        DspyFindIntInParamList( "preview", &preview_scale, paramCount, parameters );
+
+        // record everything we send to the file named by the 'record'
+        // display parameter, for replaying later
+        char *record_tmp = 0;
+        DspyFindStringInParamList( "record", &record_tmp, paramCount, parameters );
+
+        // timestamp each bucket so nuke can trace its latency if the
+        // 'trace' display parameter is set
+        int trace = 0;
+        DspyFindIntInParamList( "trace", &trace, paramCount, parameters );
+
+        // keep the connection open for the next image to the same server
+        // unless the 'session' display parameter is 0
+        int session = 1;
+        DspyFindIntInParamList( "session", &session, paramCount, parameters );
+
+        // print how the send queue behaved when the image is closed if the
+        // 'stats' display parameter is set
+        int print_stats = 0;
+        DspyFindIntInParamList( "stats", &print_stats, paramCount, parameters );
+
         // now we can connect to the server and start rendering
+        rmanconnect::Client *client = 0;
         try
         {
-            // create a new rmanConnect object
-            rmanconnect::Client *client = new rmanconnect::Client( hostname, port_address );
+            // reuse an idle session to this server, or create a new
+            // rmanConnect object
+            std::stringstream key;
+            key << hostname << ":" << port_address << ":" << ( socket_tmp ? socket_tmp : "" );
+            if ( session )
+                client = sessions.take( key.str() );
+            if ( !client )
+            {
+                client = new rmanconnect::Client( hostname, port_address );
+                sessions.add( key.str(), client );
+            }
+            client->setPersistent( session!=0 );
+            client->setSocketOptions( no_delay!=0, send_buffer, recv_buffer );
+            if ( socket_tmp )
+                client->setSocketPath( socket_tmp );
+            client->setQueueOptions( static_cast<unsigned long>(queue_mb)*1024*1024, drop_when_full );
+            client->setBatchOptions( batch_bytes>0 ? batch_bytes : 0, batch_ms );
+            client->setCodec( codec );
+            client->setPrecision( precision );
+            client->setSharedMemory( shared_memory!=0 );
+            client->setPreview( preview_scale>0 ? preview_scale : 0 );
+            // (always set, so a pooled client stops recording for a
+            // display that didn't ask it to)
+            client->setRecording( record_tmp ? record_tmp : "" );
+            client->setTracing( trace!=0 );
 
-            // make image header & send to server
+            // make image header & send to server, naming each channel
             rmanconnect::Data header( 0, 0, width, height, formatCount );
+            std::vector<std::string> channels;
+            for ( int i=0; i<formatCount; ++i )
+                channels.push_back( format[i].name );
+            header.setChannels( channels );
             client->openImage( header );
 
             // create passable pointer for our client object
-            *pvImage = reinterpret_cast<PtDspyImageHandle>(client);
+            OpenImage *image = new OpenImage;
+            image->client = client;
+            image->printStats = print_stats!=0;
+            image->session = session!=0;
+            *pvImage = reinterpret_cast<PtDspyImageHandle>(image);
         }
         catch (const std::exception &e)
         {
             DspyError("RmanConnect display driver", "%s", e.what());
             DspyError("RmanConnect display driver", "Port '%s:%d'", hostname.c_str(), port_address);
+            if ( client )
+                sessions.release( client, false );
             return PkDspyErrorUndefined;
         }
 
@@ -98,7 +291,7 @@ extern "C"
         try
         {
             rmanconnect::Client *client =
-                    reinterpret_cast<rmanconnect::Client*> (pvImage);
+                    reinterpret_cast<OpenImage*> (pvImage)->client;
             const float *ptr = reinterpret_cast<const float*> (data);
 
             // create our data object
@@ -119,16 +312,44 @@ extern "C"
     // close the display driver
     PtDspyError DspyImageClose(PtDspyImageHandle pvImage)
     {
+        OpenImage *image = reinterpret_cast<OpenImage*> (pvImage);
+        rmanconnect::Client *client = image->client;
+        bool print_stats = image->printStats;
+        bool session = image->session;
+        delete image;
         try
         {
-            rmanconnect::Client *client =
-                    reinterpret_cast<rmanconnect::Client*> (pvImage);
             client->closeImage();
-            delete client;
+
+            // report how the send queue behaved, if asked to
+            rmanconnect::SendStats stats = client->stats();
+            if ( print_stats && ( stats.stalls>0 || stats.bucketsDropped>0 ) )
+            {
+                std::cout << "RmanConnect display driver: " << stats.bucketsQueued
+                          << " buckets queued, " << stats.bucketsDropped << " dropped, max queue depth "
+                          << stats.maxQueueDepth << ", stalled " << stats.stalls << " times for "
+                          << stats.stallSeconds << "s" << std::endl;
+            }
+            if ( print_stats && stats.sentBytes<stats.rawBytes && stats.bucketsQueued>0 )
+            {
+                std::cout << "RmanConnect display driver: compression ratio "
+                          << stats.rawBytes / stats.sentBytes << ":1, encoding took "
+                          << stats.encodeSeconds * 1000000.0 / stats.bucketsQueued
+                          << "us per bucket" << std::endl;
+            }
+            if ( print_stats && stats.previewsSent>0 )
+            {
+                std::cout << "RmanConnect display driver: " << stats.previewsSent
+                          << " previews sent, whole image shown after "
+                          << stats.firstFrameSeconds << "s" << std::endl;
+            }
+            // hand a persistent client back for the next image
+            sessions.release( client, session );
         }
         catch (const std::exception &e)
         {
             DspyError("RmanConnect display driver", "%s\n", e.what());
+            sessions.release( client, false );
             return PkDspyErrorUndefined;
         }
         return PkDspyErrorNone;
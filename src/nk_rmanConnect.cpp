@@ -30,6 +30,9 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 
 #include <time.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -41,8 +44,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include "DDImage/DDMath.h"
 using namespace DD::Image;
 
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
 #include "Data.h"
+#include "IngestBuffer.h"
+#include "PixelSink.h"
+#include "Reactor.h"
+#include "RmanBuffer.h"
+#include "RenderHistory.h"
 #include "Server.h"
+#include "Trace.h"
 
 // class name
 static const char* const CLASS = "RmanConnect";
@@ -54,77 +65,92 @@ static const char* const HELP =
 // our default port
 const int rmanconnect_default_port = 9201;
 
-// our listener method
-static void rmanConnectListen(unsigned index, unsigned nthreads, void* data);
-
-// lightweight pixel class
-class RmanColour
-{
-    public:
-        RmanColour()
-        {
-            _val[0] = _val[1] = _val[2] = 0.f;
-            _val[3] = 1.f;
-        }
+// our default limit on viewer refreshes per second
+const float rmanconnect_default_refresh_rate = 10.f;
 
-        float& operator[](int i){ return _val[i]; }
-        const float& operator[](int i) const { return _val[i]; }
+// how many finished renders we keep by default, and in how much memory
+const int rmanconnect_default_history_size = 4;
+const int rmanconnect_default_history_mb = 512;
 
-        // data
-        float _val[4];
-};
+// how long after an image closes we wait for it to be drawn before
+// reporting its traced latencies
+const double rmanconnect_trace_report_delay = 1.0;
 
-// our image buffer class
-class RmanBuffer
+// the sooner of two waits, either of which may be -1 for no wait
+static double soonest(double a, double b)
 {
-    public:
-        RmanBuffer() :
-            _width(0),
-            _height(0)
-        {
-        }
-
-        void init(const unsigned int width, const unsigned int height)
-        {
-            _width = width;
-            _height = height;
-            _data.resize(_width * _height);
-        }
-
-        RmanColour& get(unsigned int x, unsigned int y)
-        {
-            unsigned int index = (_width * y) + x;
-            return _data[index];
-        }
-
-        const RmanColour& get(unsigned int x, unsigned int y) const
-        {
-            unsigned int index = (_width * y) + x;
-            return _data[index];
-        }
-
-        const unsigned int size() const
-        {
-            return _data.size();
-        }
+    if ( a < 0.0 )
+        return b;
+    return b >= 0.0 && b < a ? b : a;
+}
 
-        // data
-        std::vector<RmanColour> _data;
-        unsigned int _width;
-        unsigned int _height;
-};
+// returns the nuke channel to use for a channel named by the renderer
+static Channel rmanChannel(const std::string &name)
+{
+    // the usual image channels
+    if ( name=="r" ) return Chan_Red;
+    if ( name=="g" ) return Chan_Green;
+    if ( name=="b" ) return Chan_Blue;
+    if ( name=="a" ) return Chan_Alpha;
+    if ( name=="z" ) return Chan_Z;
+
+    // anything else goes in a layer named after it, or after the part
+    // before the '.' if it has one (e.g. "__Pworld.x")
+    std::string layer = "other", chan = name;
+    std::string::size_type dot = name.rfind('.');
+    if ( dot!=std::string::npos )
+    {
+        layer = name.substr(0, dot);
+        chan = name.substr(dot + 1);
+    }
+    layer.erase(0, layer.find_first_not_of('_'));
+    chan.erase(0, chan.find_first_not_of('_'));
+    if ( layer.empty() )
+        layer = "other";
+    if ( chan.empty() )
+        chan = "unnamed";
+    if ( chan=="r" ) chan = "red";
+    else if ( chan=="g" ) chan = "green";
+    else if ( chan=="b" ) chan = "blue";
+    else if ( chan=="a" ) chan = "alpha";
+    return getChannel((layer + "." + chan).c_str());
+}
 
 // our nuke node
-class RmanConnect: public Iop
+class RmanConnect: public Iop, public rmanconnect::PixelSink, public rmanconnect::Listener
 {
     public:
         FormatPair m_fmt; // our buffer format (knob)
         int m_port; // the port we're listening on (knob)
-
-        RmanBuffer m_buffer; // our pixel buffer
-        Lock m_mutex; // mutex for locking the pixel buffer
+        const char *m_socketPath; // a local socket to listen on too (knob)
+        const char *m_cacheDir; // where to keep our buffer on disk (knob)
+
+        rmanconnect::IngestBuffer m_ingest; // our pixel buffer, locked in bands of rows
+        rmanconnect::RmanBuffer &m_buffer; // (m_ingest's buffer)
+        std::vector<Channel> m_channels; // the nuke channel of each buffer channel
+        ChannelSet m_channelSet; // all of our channels
+        int m_imageId; // the image we're showing
         unsigned int hash_counter; // our refresh hash counter
-        rmanconnect::Server m_server; // our rmanconnect::Server
+        float m_refreshRate; // most viewer refreshes per second (knob)
+        rmanconnect::RenderHistory m_history; // finished renders
+        int m_historySize; // how many to keep (knob)
+        int m_historyMB; // and in how much memory (knob)
+        int m_show; // the render to show, 0 being the live one (knob)
+        boost::shared_ptr<rmanconnect::Snapshot> m_shown; // set by _validate()
+        std::vector<Channel> m_shownChannels;
+        rmanconnect::Server m_server; // our rmanconnect::Server, run by the shared reactor
+        rmanconnect::StatCounter m_statBuckets, m_statBytes; // pixels copied into the buffer
+        rmanconnect::StatCounter m_statIngestUs; // time spent copying them
+        rmanconnect::StatCounter m_statRefreshes; // viewer refreshes
+        boost::posix_time::ptime m_statStart, m_statLast; // image opened, last bucket
+        boost::posix_time::ptime m_lastLog; // when stats were last logged
+        unsigned long m_loggedBuckets;
+        float m_statsInterval; // seconds between logging stats (knob)
+        Lock m_statsLock; // guards m_statsText
+        std::string m_statsText; // set as our server's messages are handled
+        const char *m_statsKnobText; // what the stats knob shows
+        boost::posix_time::ptime m_traceReport; // when to report them, if due
+        const char *m_traceFile; // where to write them as a Chrome trace (knob)
         bool m_inError; // some error handling
         std::string m_connectionError;
         bool m_legit;
@@ -132,11 +158,31 @@ class RmanConnect: public Iop
         RmanConnect(Node* node) :
             Iop(node),
             m_port(rmanconnect_default_port),
+            m_socketPath(0),
+            m_cacheDir(0),
+            m_buffer(m_ingest.buffer()),
+            m_imageId(-1),
+            hash_counter(0),
+            m_refreshRate(rmanconnect_default_refresh_rate),
+            m_historySize(rmanconnect_default_history_size),
+            m_historyMB(rmanconnect_default_history_mb),
+            m_show(0),
+            m_server(rmanconnect::Reactor::shared()),
+            m_loggedBuckets(0),
+            m_statsInterval(0.f),
+            m_statsKnobText(0),
+            m_traceFile(0),
             m_inError(false),
             m_connectionError(""),
             m_legit(false)
         {
             inputs(0);
+            setChannels(std::vector<std::string>());
+
+            // have buckets copied straight into our buffer as they arrive,
+            // and everything else handed to message()
+            m_server.setPixelSink(this);
+            m_server.setListener(this);
         }
 
         ~RmanConnect()
@@ -163,13 +209,125 @@ class RmanConnect: public Iop
             disconnect();
         }
 
-        void flagForUpdate()
+        void flagForUpdate(const Box &box)
         {
             if ( hash_counter==UINT_MAX )
                 hash_counter=0;
             else
                 hash_counter++;
-            asapUpdate();
+            asapUpdate(box);
+        }
+
+        // updates the viewer with whatever has changed, no more than
+        // m_refreshRate times a second (unless forced). Returns how many
+        // seconds until it should be called again, or -1 if there's nothing
+        // waiting to be refreshed.
+        double refresh(bool force=false)
+        {
+            double wait = m_ingest.refreshWait(m_refreshRate, force);
+            if ( wait != 0.0 )
+                return wait;
+
+            int x, y, r, t;
+            m_ingest.beginRefresh(x, y, r, t);
+            m_statRefreshes.add(1);
+            updateStats();
+            flagForUpdate(Box(x, y, r, t));
+            return -1.0;
+        }
+
+        // zero our stats for a new image
+        void resetStats()
+        {
+            m_statBuckets.reset();
+            m_statBytes.reset();
+            m_statIngestUs.reset();
+            m_ingest.resetLockStats();
+            m_statRefreshes.reset();
+            m_statStart = m_lastLog = boost::posix_time::microsec_clock::universal_time();
+            m_statLast = boost::posix_time::ptime();
+            m_loggedBuckets = 0;
+        }
+
+        // describes how well we're keeping up with the image being
+        // received, on one line or (for the stats knob) several with a line
+        // for each connected client
+        std::string statsText(bool panel)
+        {
+            double seconds = 0.0;
+            if ( !m_statLast.is_not_a_date_time() )
+                seconds = (m_statLast - m_statStart).total_microseconds() / 1000000.0;
+            unsigned long buckets = m_statBuckets.value();
+            double mb = m_statBytes.value() / 1048576.0;
+            const char *separator = panel ? "\n" : ", ";
+
+            std::stringstream ss;
+            ss.setf(std::ios::fixed);
+            ss.precision(1);
+            ss << "image " << m_imageId;
+            if ( panel )
+                ss << ": " << m_buffer.width() << "x" << m_buffer.height()
+                   << ", " << m_buffer.numChannels() << " channels\n"
+                   << buckets << " buckets, " << mb << " MB in " << seconds << " s\n";
+            else
+                ss << ": " << buckets << " buckets, ";
+            ss << (seconds > 0.0 ? buckets / seconds : 0.0) << " buckets/s, "
+               << (seconds > 0.0 ? mb / seconds : 0.0) << " MB/s" << separator
+               << "ingest " << (buckets ? m_statIngestUs.value() / static_cast<double>(buckets) : 0.0)
+               << " us per bucket" << separator
+               << m_ingest.lockWaits() << " lock waits ("
+               << m_ingest.lockWaitMicroseconds() / 1000.0 << " ms)" << separator
+               << m_statRefreshes.value() << " refreshes";
+            if ( panel )
+            {
+                std::string latencies = m_ingest.traces().summary();
+                if ( !latencies.empty() )
+                    ss << "\n" << latencies;
+
+                std::vector<rmanconnect::ConnectionStats> clients = m_server.connectionStats();
+                for (unsigned int i = 0; i < clients.size(); ++i)
+                {
+                    const rmanconnect::ConnectionStats &client = clients[i];
+                    ss << "\nclient " << client.peer << ": ";
+                    if ( client.imageId >= 0 )
+                        ss << "image " << client.imageId << ", ";
+                    if ( client.sharedMemory )
+                        ss << "shared memory, ";
+                    ss << client.buckets << " buckets, "
+                       << client.bucketsPerSecond << " buckets/s";
+                }
+            }
+            return ss.str();
+        }
+
+        // update the text the stats knob shows once the viewer refreshes
+        void updateStats()
+        {
+            std::string text = statsText(true);
+            m_statsLock.lock();
+            m_statsText.swap(text);
+            m_statsLock.unlock();
+        }
+
+        // log our stats if it's time to and anything's arrived since we
+        // last did. Returns how many seconds until it should be called
+        // again, or -1 if it needn't be until more buckets arrive.
+        double logStats()
+        {
+            unsigned long buckets = m_statBuckets.value();
+            if ( m_statsInterval <= 0.f || buckets==m_loggedBuckets )
+                return -1.0;
+
+            boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+            double wait = m_statsInterval - (now - m_lastLog).total_microseconds() / 1000000.0;
+            if ( wait > 0.0 )
+                return wait;
+
+            print_name( std::cout );
+            std::cout << ": " << statsText(false) << std::endl;
+            m_lastLog = now;
+            m_loggedBuckets = buckets;
+            return -1.0;
         }
 
         // we can use this to change our tcp port
@@ -182,12 +340,14 @@ class RmanConnect: public Iop
             disconnect();
             try
             {
-                m_server.connect( m_port );
+                m_server.connect( m_port, false, m_socketPath ? m_socketPath : "" );
             }
             catch ( ... )
             {
                 std::stringstream ss;
                 ss << "Could not connect to port: " << port;
+                if ( m_socketPath && *m_socketPath )
+                    ss << " or socket: " << m_socketPath;
                 m_connectionError = ss.str();
                 m_inError = true;
                 print_name( std::cerr );
@@ -198,24 +358,281 @@ class RmanConnect: public Iop
             // success
             if ( m_server.isConnected() )
             {
-                Thread::spawn(::rmanConnectListen, 1, this);
                 print_name( std::cout );
-                std::cout << ": Connected to port " << m_server.getPort() << std::endl;
+                std::cout << ": Connected to port " << m_server.getPort();
+                if ( !m_server.getSocketPath().empty() )
+                    std::cout << " and socket " << m_server.getSocketPath();
+                std::cout << std::endl;
             }
         }
 
-        // disconnect the server for it's port
+        // disconnect the server for it's port. Once this returns the
+        // reactor won't call us again until we reconnect.
         void disconnect()
         {
             if ( m_server.isConnected() )
             {
                 m_server.quit();
-                Thread::wait(this);
                 print_name( std::cout );
                 std::cout << ": Disconnected from port " << m_server.getPort() << std::endl;
             }
         }
 
+        // handle a message from our server. The shared reactor calls this
+        // from any of its threads, but never for two of our messages at
+        // once.
+        void message(rmanconnect::Data &d)
+        {
+            // the server may be receiving several images at once, so we show
+            // the one that was opened most recently and ignore the others
+            if ( (d.type()==1 || d.type()==2 || d.type()==4) && d.imageId()!=m_imageId )
+                return;
+
+            switch (d.type())
+            {
+                case 0: // open a new image
+                    openImage(d);
+                    break;
+                case 1: // image data (usually already copied by pixels())
+                case 4: // preview data (usually already copied by preview())
+                    addPixels(d);
+                    break;
+                case 2: // close image
+                    closeImage();
+                    break;
+            }
+        }
+
+        // called after each message, returning how long until we next need
+        // to refresh the viewer, log our stats or report traces
+        double idle()
+        {
+            return soonest(soonest(refresh(), logStats()), reportTraces());
+        }
+
+        // finish the image we're showing
+        void closeImage()
+        {
+            // report how well the pixels were compressed
+            const rmanconnect::ReceiveStats &stats = m_server.stats();
+            if ( stats.encodedBuckets>0 )
+            {
+                print_name( std::cout );
+                std::cout << ": compression ratio "
+                          << stats.decodedBytes / stats.receivedBytes
+                          << ":1, decoding took "
+                          << stats.decodeSeconds * 1000000.0 / stats.encodedBuckets
+                          << "us per bucket" << std::endl;
+            }
+            m_server.resetStats();
+
+            // keep a copy to compare later renders against, and update
+            // the image
+            m_buffer.finish();
+            snapshot();
+            updateStats();
+            refresh(true);
+
+            // report any traced buckets once they've been drawn
+            if ( m_ingest.traced() )
+                m_traceReport = boost::posix_time::microsec_clock::universal_time() +
+                        boost::posix_time::microseconds(static_cast<long>(rmanconnect_trace_report_delay * 1000000.0));
+        }
+
+        // say how long traced buckets took to be drawn, and write them to
+        // our trace file, once the last image has had time to be drawn (or
+        // straight away if forced).
+        // Returns how many seconds until it should be called again, or -1
+        // if there's nothing to report.
+        double reportTraces(bool force=false)
+        {
+            if ( m_traceReport.is_not_a_date_time() )
+                return -1.0;
+
+            boost::posix_time::ptime now = boost::posix_time::microsec_clock::universal_time();
+            if ( !force && now < m_traceReport )
+                return (m_traceReport - now).total_microseconds() / 1000000.0;
+            m_traceReport = boost::posix_time::ptime();
+
+            // anything that hasn't been drawn by now may never be
+            m_ingest.flushTraces();
+
+            const rmanconnect::TraceLog &traces = m_ingest.traces();
+            print_name( std::cout );
+            std::cout << ": traced " << traces.count() << " buckets" << std::endl
+                      << traces.summary("  ") << std::endl;
+            if ( m_traceFile && *m_traceFile )
+            {
+                bool written = traces.writeChromeTrace(m_traceFile);
+                std::ostream &out = written ? std::cout : std::cerr;
+                print_name( out );
+                out << ": " << (written ? "Wrote" : "Could not write") << " trace "
+                    << m_traceFile << std::endl;
+            }
+            updateStats();
+            return -1.0;
+        }
+
+        // set up our channels from the renderer's channel names. Unnamed
+        // channels default to rgba, then other.channel4 onwards. Call with
+        // the whole buffer locked.
+        void setChannels(const std::vector<std::string> &names, unsigned int spp=4)
+        {
+            m_channels.clear();
+            m_channelSet.clear();
+            if ( names.empty() )
+            {
+                m_channels.push_back(Chan_Red);
+                m_channels.push_back(Chan_Green);
+                m_channels.push_back(Chan_Blue);
+                m_channels.push_back(Chan_Alpha);
+                for (unsigned int i = 4; i < spp; ++i)
+                {
+                    std::stringstream ss;
+                    ss << "other.channel" << i;
+                    m_channels.push_back(getChannel(ss.str().c_str()));
+                }
+            }
+            for (unsigned int i = 0; i < names.size(); ++i)
+                m_channels.push_back(rmanChannel(names[i]));
+            for (unsigned int i = 0; i < m_channels.size(); ++i)
+                m_channelSet += m_channels[i];
+        }
+
+        // start a new image, setting up our buffer and channels for it
+        void openImage(const rmanconnect::Data &d)
+        {
+            // report the last image's traces before starting on this one's
+            reportTraces(true);
+
+            m_imageId = d.imageId();
+            resetStats();
+            m_ingest.clearTraces();
+            m_traceReport = boost::posix_time::ptime();
+            m_ingest.lockAll();
+            setChannels(d.channels(), d.spp());
+            std::string path = cachePath();
+            std::vector<std::string> names;
+            for (unsigned int c = 0; c < m_channels.size(); ++c)
+                names.push_back(getName(m_channels[c]));
+            if ( !m_buffer.init(d.width(), d.height(), m_channels.size(), path, names) )
+            {
+                print_name( std::cerr );
+                std::cerr << ": Could not create cache file " << path << std::endl;
+            }
+
+            // start off with an opaque alpha, like an empty render
+            for (unsigned int c = 0; c < m_channels.size(); ++c)
+                if ( m_channels[c]==Chan_Alpha )
+                    m_buffer.fill(c, 1.f);
+            m_ingest.unlockAll();
+            m_ingest.markDirty(0, 0, m_buffer.width(), m_buffer.height());
+            updateStats();
+        }
+
+        // the file our buffer is cached in, or "" if we're not caching it
+        std::string cachePath() const
+        {
+            if ( !m_cacheDir || !*m_cacheDir )
+                return "";
+            std::stringstream ss;
+            ss << m_cacheDir << "/rmanconnect_" << m_port << ".cache";
+            return ss.str();
+        }
+
+        // pick up where we left off if there's a cached image for our port,
+        // e.g. after nuke was restarted. The pixels are only read from disk
+        // as they're drawn.
+        void attachCache()
+        {
+            std::string path = cachePath();
+            if ( path.empty() || m_buffer.size()!=0 )
+                return;
+
+            std::vector<std::string> names;
+            m_ingest.lockAll();
+            bool attached = m_buffer.attach(path, names);
+            if ( attached )
+            {
+                m_channels.clear();
+                m_channelSet.clear();
+                for (unsigned int c = 0; c < names.size(); ++c)
+                {
+                    m_channels.push_back(getChannel(names[c].c_str()));
+                    m_channelSet += m_channels.back();
+                }
+            }
+            m_ingest.unlockAll();
+
+            if ( attached )
+            {
+                print_name( std::cout );
+                std::cout << ": Loaded " << (m_buffer.complete() ? "" : "partial ")
+                          << "render from " << path << std::endl;
+                flagForUpdate(Box(0, 0, m_buffer.width(), m_buffer.height()));
+            }
+        }
+
+        // keep a copy of the finished image in our history. Only our
+        // server's messages write to the buffer, so it doesn't need locking
+        // here.
+        void snapshot()
+        {
+            if ( m_historySize <= 0 || m_buffer.size()==0 )
+                return;
+
+            std::vector<std::string> names;
+            for (unsigned int c = 0; c < m_buffer.numChannels(); ++c)
+                names.push_back(getName(m_channels[c]));
+            boost::shared_ptr<rmanconnect::Snapshot> snapshot(
+                    new rmanconnect::Snapshot(m_buffer.width(), m_buffer.height(), names));
+            for (unsigned int c = 0; c < m_buffer.numChannels(); ++c)
+                for (unsigned int y = 0; y < m_buffer.height(); ++y)
+                    memcpy(snapshot->row(c, y), m_buffer.row(c, y), sizeof(float) * m_buffer.width());
+
+            m_history.setLimits(m_historySize, static_cast<size_t>(std::max(m_historyMB, 0)) << 20);
+            m_history.add(snapshot);
+
+            // whatever we're showing from the history has moved along one
+            if ( m_show > 0 )
+                flagForUpdate(Box(0, 0, m_buffer.width(), m_buffer.height()));
+        }
+
+        // copy each block of pixels (or previews) in d into our buffer
+        void addPixels(const rmanconnect::Data &d)
+        {
+            for (unsigned int _r = 0; _r < d.numRegions(); ++_r)
+                pixels(d.imageId(), d.region(_r), d.pixels() + d.region(_r).offset);
+        }
+
+        // a preview covers the same pixels as its bucket at a lower
+        // resolution, so we fill them in with it until the bucket arrives
+        void preview(int imageId, const rmanconnect::Region &region, const float *block)
+        {
+            pixels(imageId, region, block);
+        }
+
+        // copy a block of pixels into our buffer, dropping anything that
+        // falls outside it. The server calls this as each bucket arrives,
+        // one message at a time, so pixels are never copied while another
+        // bucket is (or while openImage() or refresh() run).
+        void pixels(int imageId, const rmanconnect::Region &region, const float *block)
+        {
+            // ignore any other images
+            if ( imageId!=m_imageId )
+                return;
+            boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+
+            int x, y, r, t;
+            if ( !m_ingest.copy(imageId, region, block, x, y, r, t) )
+                return;
+
+            m_statLast = boost::posix_time::microsec_clock::universal_time();
+            m_statBuckets.add(1);
+            m_statBytes.add(sizeof(float) * (r - x) * (t - y) * m_buffer.numChannels());
+            m_statIngestUs.add((m_statLast - start).total_microseconds());
+        }
+
         void append(Hash& hash)
         {
             hash.append(hash_counter);
@@ -223,83 +640,178 @@ class RmanConnect: public Iop
 
         void _validate(bool for_real)
         {
-            // do we need to open a port?
+            // do we need to open a port? (and reload the last render)
             if ( m_server.isConnected()==false && !m_inError && m_legit )
+            {
+                attachCache();
                 changePort(m_port);
+            }
 
             // handle any connection error
             if ( m_inError )
                 error(m_connectionError.c_str());
 
+            // show the latest stats
+            m_statsLock.lock();
+            std::string stats = m_statsText;
+            m_statsLock.unlock();
+            if ( stats!=(m_statsKnobText ? m_statsKnobText : "") )
+            {
+                Knob *stats_knob = knob("stats");
+                if ( stats_knob )
+                    stats_knob->set_text(stats.c_str());
+            }
+
+            // pick a finished render to show, if we're not showing the
+            // live one (or don't have that many)
+            m_shown.reset();
+            m_shownChannels.clear();
+            if ( m_show > 0 )
+                m_shown = m_history.select(m_show - 1);
+
             // setup format etc
             info_.format(*m_fmt.fullSizeFormat());
             info_.full_size_format(*m_fmt.format());
-            info_.channels(Mask_RGBA);
+            if ( m_shown )
+            {
+                ChannelSet channels;
+                for (unsigned int c = 0; c < m_shown->numChannels(); ++c)
+                {
+                    m_shownChannels.push_back(getChannel(m_shown->channels()[c].c_str()));
+                    channels += m_shownChannels.back();
+                }
+                info_.channels(channels);
+            }
+            else
+            {
+                m_ingest.rowLock(0).lock();
+                info_.channels(m_channelSet);
+                m_ingest.rowLock(0).unlock();
+            }
             info_.set(info().format());
         }
 
-        void engine(int y, int xx, int r, ChannelMask channels, Row& out)
+        // engine() for a finished render from our history
+        void snapshotEngine(int y, int xx, int r, ChannelMask channels, Row& out)
         {
-            float *rOut = out.writable(Chan_Red) + xx;
-            float *gOut = out.writable(Chan_Green) + xx;
-            float *bOut = out.writable(Chan_Blue) + xx;
-            float *aOut = out.writable(Chan_Alpha) + xx;
-            const float *END = rOut + (r - xx);
-            unsigned int xxx = static_cast<unsigned int> (xx);
-            unsigned int yyy = static_cast<unsigned int> (y);
-
-            // don't have a buffer yet
-            m_mutex.lock();
-            if ( m_buffer._width==0 && m_buffer._height==0 )
+            bool has_row = y >= 0 && y < static_cast<int>(m_shown->height());
+            int start = std::max(xx, 0);
+            int end = std::min(r, static_cast<int>(m_shown->width()));
+            if ( !has_row || start >= end )
+                start = end = xx;
+
+            foreach(z, channels)
             {
-                while (rOut < END)
+                float *cOut = out.writable(z);
+                unsigned int c = 0;
+                while ( c < m_shownChannels.size() && m_shownChannels[c]!=z )
+                    ++c;
+                if ( c >= m_shownChannels.size() || start==end )
                 {
-                    *rOut = *gOut = *bOut = *aOut = 0.f;
-                    ++rOut;
-                    ++gOut;
-                    ++bOut;
-                    ++aOut;
-                    ++xxx;
+                    memset(cOut + xx, 0, sizeof(float) * (r - xx));
+                    continue;
                 }
+                memset(cOut + xx, 0, sizeof(float) * (start - xx));
+                m_shown->readRow(c, y, start, end - start, cOut + start);
+                memset(cOut + end, 0, sizeof(float) * (r - end));
             }
-            else
+        }
+
+        void engine(int y, int xx, int r, ChannelMask channels, Row& out)
+        {
+            if ( m_shown )
+            {
+                snapshotEngine(y, xx, r, channels, out);
+                return;
+            }
+
+            // (drawing any traced buckets waiting on this row)
+            m_ingest.lockRow(y);
+
+            // the part of this row we have pixels for
+            bool has_row = y >= 0 && y < static_cast<int>(m_buffer.height());
+            int start = std::max(xx, 0);
+            int end = std::min(r, static_cast<int>(m_buffer.width()));
+            if ( !has_row || start >= end )
+                start = end = xx;
+
+            foreach(z, channels)
             {
-                while (rOut < END)
+                float *cOut = out.writable(z);
+
+                // find which of our channels this is
+                unsigned int c = 0;
+                while ( c < m_channels.size() && m_channels[c]!=z )
+                    ++c;
+
+                // don't have a buffer (or this channel) yet
+                if ( c >= m_buffer.numChannels() || start==end )
                 {
-                    if ( xxx >= m_buffer._width || yyy >= m_buffer._height )
-                    {
-                        *rOut = *gOut = *bOut = *aOut = 0.f;
-                    }
-                    else
-                    {
-                        *rOut = m_buffer.get(xxx, yyy)[0];
-                        *gOut = m_buffer.get(xxx, yyy)[1];
-                        *bOut = m_buffer.get(xxx, yyy)[2];
-                        *aOut = m_buffer.get(xxx, yyy)[3];
-                    }
-                    ++rOut;
-                    ++gOut;
-                    ++bOut;
-                    ++aOut;
-                    ++xxx;
+                    memset(cOut + xx, 0, sizeof(float) * (r - xx));
+                    continue;
                 }
+
+                // copy what we have and pad the rest with black
+                memset(cOut + xx, 0, sizeof(float) * (start - xx));
+                memcpy(cOut + start, m_buffer.row(c, y) + start, sizeof(float) * (end - start));
+                memset(cOut + end, 0, sizeof(float) * (r - end));
             }
-            m_mutex.unlock();
+            m_ingest.unlockRow(y);
         }
 
         void knobs(Knob_Callback f)
         {
             Format_knob(f, &m_fmt, "m_formats_knob", "format");
             Int_knob(f, &m_port, "port_number", "port");
+            String_knob(f, &m_socketPath, "socket_path", "socket");
+            File_knob(f, &m_cacheDir, "cache_dir", "cache directory");
+            Tooltip(f, "A directory to keep the received image in, so it "
+                       "survives nuke being restarted. Leave empty to keep it "
+                       "in memory only.");
+            Float_knob(f, &m_refreshRate, "refresh_rate", "refresh rate");
+            Tooltip(f, "The most times per second the viewer is refreshed while "
+                       "buckets arrive. Set to 0 to refresh after every bucket.");
+            Int_knob(f, &m_show, "show_render", "show render");
+            Tooltip(f, "Which render to show: 0 is the live one, 1 the last one "
+                       "to finish, 2 the one before that, and so on.");
+            Int_knob(f, &m_historySize, "history_size", "history");
+            Tooltip(f, "How many finished renders are kept to compare against. "
+                       "Set to 0 to keep none.");
+            Int_knob(f, &m_historyMB, "history_mb", "history memory (MB)");
+            Tooltip(f, "The most memory the compressed history may use. The "
+                       "oldest renders are dropped to stay within it.");
+            Float_knob(f, &m_statsInterval, "stats_interval", "log stats every");
+            Tooltip(f, "How many seconds apart to print the stats below to the "
+                       "terminal while buckets arrive. Set to 0 not to.");
+            File_knob(f, &m_traceFile, "trace_file", "trace file");
+            Tooltip(f, "Where to write the latencies of the buckets of each "
+                       "image as a Chrome trace, for chrome://tracing or "
+                       "Perfetto. Buckets are only traced when the display "
+                       "driver's 'trace' parameter is set.");
+            Multiline_Eval_String_knob(f, &m_statsKnobText, "stats", "stats");
+            SetFlags(f, Knob::READ_ONLY | Knob::NO_ANIMATION | Knob::DO_NOT_WRITE | Knob::NO_RERENDER);
+            Tooltip(f, "How the node is keeping up with the image being "
+                       "received: buckets copied into the buffer, how long "
+                       "copying them took, how often copying and drawing had "
+                       "to wait for each other, viewer refreshes, and what each "
+                       "connected renderer has sent.");
         }
 
         int knob_changed(Knob* knob)
         {
-            if (knob->name() && strcmp(knob->name(), "port_number") == 0)
+            if (knob->name() && ( strcmp(knob->name(), "port_number") == 0 ||
+                                  strcmp(knob->name(), "socket_path") == 0 ))
             {
                 changePort(m_port);
                 return 1;
             }
+            if (knob->name() && ( strcmp(knob->name(), "history_size") == 0 ||
+                                  strcmp(knob->name(), "history_mb") == 0 ))
+            {
+                m_history.setLimits(std::max(m_historySize, 0),
+                                    static_cast<size_t>(std::max(m_historyMB, 0)) << 20);
+                return 1;
+            }
             return 0;
         }
 
@@ -310,97 +822,6 @@ class RmanConnect: public Iop
 };
 //=====
 
-//=====
-// @brief our listening thread method
-static void rmanConnectListen(unsigned index, unsigned nthreads, void* data)
-{
-    bool killThread = false;
-
-    RmanConnect * node = reinterpret_cast<RmanConnect*> (data);
-    while (!killThread)
-    {
-        // accept incoming connections!
-        node->m_server.accept();
-
-        // our incoming data object
-        rmanconnect::Data d;
-
-        // loop over incoming data
-        while ((d.type()==2||d.type()==9)==false)
-        {
-            // listen for some data
-            try
-            {
-                d = node->m_server.listen();
-            }
-            catch( ... )
-            {
-                break;
-            }
-
-            // handle the data we received
-            switch (d.type())
-            {
-                case 0: // open a new image
-                {
-                    node->m_mutex.lock();
-                    node->m_buffer.init(d.width(), d.height());
-                    node->m_mutex.unlock();
-                    break;
-                }
-                case 1: // image data
-                {
-                    // lock buffer
-                    node->m_mutex.lock();
-
-                    // copy data from d into node->m_buffer
-                    int _w = node->m_buffer._width;
-                    int _h = node->m_buffer._height;
-
-                    unsigned int _x, _x0, _y, _y0, _s, offset;
-                    _x = _x0 = _y = _y0 = _s = 0;
-
-                    int _xorigin = d.x();
-                    int _yorigin = d.y();
-                    int _width = d.width();
-                    int _height = d.height();
-                    int _spp = d.spp();
-
-                    const float* pixel_data = d.pixels();
-                    for (_x = 0; _x < _width; ++_x)
-                        for (_y = 0; _y < _height; ++_y)
-                        {
-                            RmanColour &pix = node->m_buffer.get(_x
-                                    + _xorigin, _h - (_y + _yorigin + 1));
-                            offset = (_width * _y * _spp) + (_x * _spp);
-                            for (_s = 0; _s < _spp; ++_s)
-                                pix[_s] = pixel_data[offset+_s];
-                        }
-
-                    // release lock
-                    node->m_mutex.unlock();
-
-                    // update the image
-                    node->flagForUpdate();
-                    break;
-                }
-                case 2: // close image
-                {
-                    // update the image
-                    node->flagForUpdate();
-                    break;
-                }
-                case 9: // this is sent when the parent process want to kill
-                        // the listening thread
-                {
-                    killThread = true;
-                    break;
-                }
-            }
-        }
-    }
-}
-
 //=====
 // nuke builder stuff
 static Iop* constructor(Node* node){ return new RmanConnect(node); }
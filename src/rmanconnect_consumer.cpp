@@ -0,0 +1,332 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// rmanconnect_consumer
+//
+// Receives renders the way the Nuke plugin does, but without Nuke. Its
+// Server is run by a Reactor and pixels are copied into the same
+// IngestBuffer as the plugin's, a band of rows at a time, with 'refreshes'
+// coalesced to a fixed rate just as the plugin's viewer updates are. After
+// each image it reports how fast it was received and how long the buckets
+// took to copy in, so the receiving side can be benchmarked on any machine
+// (e.g. fed by rmanconnect_loadgen). Traced buckets count as drawn at the
+// refresh after they're copied in.
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "Data.h"
+#include "IngestBuffer.h"
+#include "Message.h"
+#include "PixelSink.h"
+#include "Reactor.h"
+#include "Server.h"
+#include "Trace.h"
+
+using namespace rmanconnect;
+
+namespace
+{
+    struct Options
+    {
+        Options() :
+            port(9201),
+            images(0),
+            refreshRate(10.f)
+        {
+        }
+
+        std::string socketPath, tracePath;
+        int port;
+        int images;
+        float refreshRate;
+    };
+
+    // the value below which fraction of the sorted samples fall
+    float percentile( const std::vector<float> &sorted, double fraction )
+    {
+        if ( sorted.empty() )
+            return 0.f;
+        size_t i = static_cast<size_t>( fraction * ( sorted.size() - 1 ) + 0.5 );
+        return sorted[std::min(i, sorted.size() - 1)];
+    }
+
+    double secondsSince( const boost::posix_time::ptime &time )
+    {
+        return ( boost::posix_time::microsec_clock::universal_time() - time ).total_microseconds() / 1000000.0;
+    }
+
+    // does what the plugin's node does with each message. The Reactor
+    // calls it from one of its threads at a time.
+    class Consumer : public PixelSink, public Listener
+    {
+    public:
+        Consumer( Server &server, float refreshRate, const std::string &tracePath ) :
+            mServer( server ),
+            mRefreshRate( refreshRate ),
+            mImageId( -1 ),
+            mClosed( 0 ),
+            mRefreshes( 0 ),
+            mBuckets( 0 ),
+            mBytes( 0.0 ),
+            mTracePath( tracePath )
+        {
+        }
+
+        void message( Data &d )
+        {
+            // only the most recently opened image is shown
+            if ( ( d.type()==MsgPixels || d.type()==MsgCloseImage || d.type()==MsgPreview ) &&
+                 d.imageId()!=mImageId )
+            {
+                if ( d.type()==MsgCloseImage )
+                    countClosed();
+                return;
+            }
+
+            switch ( d.type() )
+            {
+                case MsgOpenImage:
+                    openImage( d );
+                    break;
+                case MsgPixels:
+                case MsgPreview:
+                    addPixels( d );
+                    break;
+                case MsgCloseImage:
+                    closeImage();
+                    countClosed();
+                    break;
+            }
+        }
+
+        double idle()
+        {
+            return refresh();
+        }
+
+        // waits until images have been closed, or forever if it's 0
+        void waitForImages( int images )
+        {
+            boost::mutex::scoped_lock lock( mClosedMutex );
+            while ( images==0 || mClosed<images )
+                mClosedCondition.wait( lock );
+        }
+
+        void openImage( const Data &d )
+        {
+            mImageId = d.imageId();
+            mBuffer.clearTraces();
+            mBuffer.lockAll();
+            mBuffer.buffer().init( d.width(), d.height(), d.spp() );
+            mBuffer.unlockAll();
+            mBuffer.markDirty( 0, 0, d.width(), d.height() );
+            mOpened = boost::posix_time::microsec_clock::universal_time();
+            mRefreshes = 0;
+            mBuckets = 0;
+            mBytes = 0.0;
+            mIngest.clear();
+        }
+
+        void closeImage()
+        {
+            RmanBuffer &buffer = mBuffer.buffer();
+            buffer.finish();
+            refresh( true );
+
+            double seconds = std::max( secondsSince(mOpened), 0.000001 );
+            std::sort( mIngest.begin(), mIngest.end() );
+            const ReceiveStats &stats = mServer.stats();
+            std::cout << "image " << mImageId << ": " << buffer.width() << "x" << buffer.height()
+                      << "x" << buffer.numChannels() << ", " << mBuckets << " buckets in "
+                      << seconds << "s\n"
+                      << "  " << mBytes / 1048576.0 / seconds << "MB/s, "
+                      << mBuckets / seconds << " buckets/s, "
+                      << mRefreshes << " refreshes\n"
+                      << "  ingest us: p50 " << percentile(mIngest, 0.5)
+                      << ", p95 " << percentile(mIngest, 0.95)
+                      << ", p99 " << percentile(mIngest, 0.99)
+                      << ", max " << ( mIngest.empty() ? 0.f : mIngest.back() ) << "\n"
+                      << "  received " << stats.receivedBytes / 1048576.0 << "MB, "
+                      << stats.encodedBuckets << " decoded in " << stats.decodeSeconds << "s, "
+                      << stats.copiedBytes / 1048576.0 << "MB copied, "
+                      << stats.allocations << " allocations\n"
+                      << "  " << stats.socketReads << " socket reads, "
+                      << stats.socketReads / std::max( double(stats.buckets), 1.0 ) << " per bucket" << std::endl;
+            mServer.resetStats();
+
+            const TraceLog &traces = mBuffer.traces();
+            if ( traces.count()>0 )
+            {
+                std::cout << "  traced " << traces.count() << " buckets\n"
+                          << traces.summary( "  " ) << std::endl;
+                if ( !mTracePath.empty() && !traces.writeChromeTrace(mTracePath) )
+                    std::cerr << "rmanconnect_consumer: could not write " << mTracePath << std::endl;
+            }
+        }
+
+        // copy each block of pixels (or previews) in d into our buffer
+        void addPixels( const Data &d )
+        {
+            for ( unsigned int r=0; r<d.numRegions(); ++r )
+                pixels( d.imageId(), d.region(r), d.pixels() + d.region(r).offset );
+        }
+
+        void preview( int imageId, const Region &region, const float *block )
+        {
+            pixels( imageId, region, block );
+        }
+
+        void pixels( int imageId, const Region &region, const float *block )
+        {
+            if ( imageId!=mImageId )
+                return;
+
+            boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+            int x, y, r, t;
+            if ( !mBuffer.copy(imageId, region, block, x, y, r, t) )
+                return;
+
+            mIngest.push_back( ( boost::posix_time::microsec_clock::universal_time() - start ).total_microseconds() );
+            mBuckets++;
+            mBytes += sizeof(float) * region.width * region.height * region.spp /
+                      ( std::max(region.scale, 1) * std::max(region.scale, 1) );
+        }
+
+        // 'updates the viewer' no more than mRefreshRate times a second
+        // (unless forced), drawing any traced buckets. Returns how many
+        // seconds until it should be called again, or -1 if there's
+        // nothing waiting to be refreshed.
+        double refresh( bool force=false )
+        {
+            double wait = mBuffer.refreshWait( mRefreshRate, force );
+            if ( wait!=0.0 )
+                return wait;
+
+            int x, y, r, t;
+            mBuffer.beginRefresh( x, y, r, t );
+            mRefreshes++;
+            mBuffer.drawTraces();
+            return -1.0;
+        }
+
+    private:
+        void countClosed()
+        {
+            boost::mutex::scoped_lock lock( mClosedMutex );
+            mClosed++;
+            mClosedCondition.notify_all();
+        }
+
+        Server &mServer;
+        IngestBuffer mBuffer;
+        float mRefreshRate;
+        int mImageId;
+
+        // images closed so far
+        boost::mutex mClosedMutex;
+        boost::condition_variable mClosedCondition;
+        int mClosed;
+
+        // this image's counters
+        boost::posix_time::ptime mOpened;
+        unsigned long mRefreshes, mBuckets;
+        double mBytes;
+        std::vector<float> mIngest; // microseconds to copy in each bucket
+
+        std::string mTracePath;
+    };
+
+    void usage()
+    {
+        std::cerr << "usage: rmanconnect_consumer [options]\n"
+                  << "  -port n         the port to listen on (9201)\n"
+                  << "  -socket path    also listen on a Unix domain socket\n"
+                  << "  -images n       exit after n images (0 keeps going)\n"
+                  << "  -refresh rate   the most refreshes per second, or 0 for\n"
+                  << "                  one after every message (10)\n"
+                  << "  -trace path     write each image's traced buckets to a\n"
+                  << "                  Chrome trace file" << std::endl;
+    }
+}
+
+int main( int argc, char **argv )
+{
+    Options options;
+    for ( int i=1; i<argc; ++i )
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if ( arg=="-port" && has_value )
+            options.port = atoi( argv[++i] );
+        else if ( arg=="-socket" && has_value )
+            options.socketPath = argv[++i];
+        else if ( arg=="-images" && has_value )
+            options.images = std::max( atoi(argv[++i]), 0 );
+        else if ( arg=="-refresh" && has_value )
+            options.refreshRate = std::max( static_cast<float>(atof(argv[++i])), 0.f );
+        else if ( arg=="-trace" && has_value )
+            options.tracePath = argv[++i];
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    try
+    {
+        // a single thread does all of the I/O and copying, as a node's
+        // share of the plugin's Reactor would
+        Reactor reactor( 1 );
+        Server server( reactor );
+        Consumer consumer( server, options.refreshRate, options.tracePath );
+        server.setPixelSink( &consumer );
+        server.setListener( &consumer );
+        server.connect( options.port, false, options.socketPath );
+        std::cout << "listening on port " << server.getPort() << std::endl;
+
+        consumer.waitForImages( options.images );
+        server.quit();
+    }
+    catch ( const std::exception &e )
+    {
+        std::cerr << "rmanconnect_consumer: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
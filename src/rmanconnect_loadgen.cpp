@@ -0,0 +1,405 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// rmanconnect_loadgen
+//
+// Drives one or more Clients the way a renderer drives the display driver,
+// sending synthetic images of a given size, bucket size, bucket order and
+// number of channels, and reports how fast they went. Together with
+// rmanconnect_consumer (or a running Nuke) this benchmarks the whole
+// pipeline on any machine, without needing a renderer.
+
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Client.h"
+#include "Codec.h"
+#include "Data.h"
+
+using namespace rmanconnect;
+
+namespace
+{
+    enum BucketOrder
+    {
+        OrderScanline,
+        OrderSpiral,
+        OrderRandom
+    };
+
+    struct Options
+    {
+        Options() :
+            host("localhost"),
+            port(9201),
+            width(1920),
+            height(1080),
+            bucketSize(32),
+            order(OrderScanline),
+            channels(4),
+            images(1),
+            frames(1),
+            codec(CodecNone),
+            format(FormatFloat32),
+            batchBytes(64*1024),
+            preview(0),
+            queueMB(64),
+            sharedMemory(true),
+            persistent(true),
+            trace(false)
+        {
+        }
+
+        std::string host, socketPath;
+        int port;
+        int width, height, bucketSize;
+        BucketOrder order;
+        int channels;
+        int images, frames;
+        PayloadCodec codec;
+        SampleFormat format;
+        int batchBytes;
+        int preview;
+        int queueMB;
+        bool sharedMemory;
+        bool persistent;
+        bool trace;
+    };
+
+    // a bucket's position in the image, in the renderer's coordinates
+    struct Bucket
+    {
+        Bucket( int x_, int y_ ) : x(x_), y(y_) {}
+        int x, y;
+    };
+
+    // the buckets of an image in the order a renderer would send them
+    std::vector<Bucket> bucketOrder( const Options &options )
+    {
+        int columns = ( options.width + options.bucketSize - 1 ) / options.bucketSize;
+        int rows = ( options.height + options.bucketSize - 1 ) / options.bucketSize;
+        std::vector<Bucket> buckets;
+        if ( options.order==OrderSpiral )
+        {
+            // walk outwards from the middle bucket, turning left each time
+            // the run has been done twice, and skipping anything outside
+            int x = ( columns - 1 ) / 2, y = ( rows - 1 ) / 2;
+            int dx = 1, dy = 0, run = 1;
+            int total = columns * rows;
+            while ( static_cast<int>(buckets.size())<total )
+            {
+                for ( int leg=0; leg<2; ++leg )
+                {
+                    for ( int i=0; i<run; ++i )
+                    {
+                        if ( x>=0 && x<columns && y>=0 && y<rows )
+                            buckets.push_back( Bucket(x * options.bucketSize, y * options.bucketSize) );
+                        x += dx;
+                        y += dy;
+                    }
+                    int turn = dx;
+                    dx = dy;
+                    dy = -turn;
+                }
+                run++;
+            }
+        }
+        else
+        {
+            for ( int y=0; y<rows; ++y )
+                for ( int x=0; x<columns; ++x )
+                    buckets.push_back( Bucket(x * options.bucketSize, y * options.bucketSize) );
+            if ( options.order==OrderRandom )
+            {
+                // the same shuffle every run, so runs can be compared
+                srand( 1 );
+                for ( size_t i=buckets.size(); i>1; --i )
+                    std::swap( buckets[i - 1], buckets[rand() % i] );
+            }
+        }
+        return buckets;
+    }
+
+    // what one thread sent, and how long each bucket took to hand over
+    struct Results
+    {
+        Results() : buckets(0), bytes(0.0) {}
+
+        unsigned long buckets;
+        double bytes;
+        std::vector<float> latencies; // microseconds per sendPixels()
+        std::vector<float> opens; // microseconds per openImage()
+        SendStats stats;
+        std::string error;
+    };
+
+    // renders frames images one after the other through a Client of its own
+    void sendImages( const Options &options, const std::vector<Bucket> &buckets, Results &results )
+    {
+        try
+        {
+            Client client( options.host, options.port );
+            if ( !options.socketPath.empty() )
+                client.setSocketPath( options.socketPath );
+            client.setQueueOptions( static_cast<unsigned long>(options.queueMB)*1024*1024 );
+            client.setBatchOptions( options.batchBytes );
+            client.setCodec( options.codec );
+            client.setPrecision( options.format );
+            client.setSharedMemory( options.sharedMemory );
+            client.setPreview( options.preview );
+            client.setTracing( options.trace );
+            client.setPersistent( options.persistent );
+
+            const char *names[] = { "r", "g", "b", "a" };
+            std::vector<std::string> channels;
+            for ( int c=0; c<options.channels; ++c )
+            {
+                std::stringstream ss;
+                if ( c<4 )
+                    ss << names[c];
+                else
+                    ss << "aov.channel" << c;
+                channels.push_back( ss.str() );
+            }
+
+            std::vector<float> pixels( options.bucketSize * options.bucketSize * options.channels );
+            results.latencies.reserve( buckets.size() * options.frames );
+            for ( int frame=0; frame<options.frames; ++frame )
+            {
+                Data header( 0, 0, options.width, options.height, options.channels );
+                header.setChannels( channels );
+                boost::posix_time::ptime opening = boost::posix_time::microsec_clock::universal_time();
+                client.openImage( header );
+                results.opens.push_back(
+                    ( boost::posix_time::microsec_clock::universal_time() - opening ).total_microseconds() );
+
+                for ( size_t b=0; b<buckets.size(); ++b )
+                {
+                    int x = buckets[b].x, y = buckets[b].y;
+                    int width = std::min( options.bucketSize, options.width - x );
+                    int height = std::min( options.bucketSize, options.height - y );
+
+                    // a smooth ramp, so compressing it is about as hard as
+                    // compressing a real render
+                    float *pixel = &pixels[0];
+                    for ( int j=0; j<height; ++j )
+                        for ( int i=0; i<width; ++i )
+                            for ( int c=0; c<options.channels; ++c )
+                                *pixel++ = ( x + i ) / float(options.width) * ( c + 1 ) +
+                                           ( y + j ) / float(options.height) + frame;
+
+                    Data data( x, y, width, height, options.channels, &pixels[0] );
+                    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+                    client.sendPixels( data );
+                    results.latencies.push_back(
+                        ( boost::posix_time::microsec_clock::universal_time() - start ).total_microseconds() );
+                    results.buckets++;
+                    results.bytes += sizeof(float) * width * height * options.channels;
+                }
+                client.closeImage();
+
+                // the Client's counters start again with each image
+                SendStats stats = client.stats();
+                results.stats.bucketsDropped += stats.bucketsDropped;
+                results.stats.sentBytes += stats.sentBytes;
+                results.stats.stalls += stats.stalls;
+                results.stats.stallSeconds += stats.stallSeconds;
+                results.stats.previewsSent += stats.previewsSent;
+                results.stats.socketWrites += stats.socketWrites;
+            }
+        }
+        catch ( const std::exception &e )
+        {
+            results.error = e.what();
+        }
+    }
+
+    // the value below which fraction of the sorted samples fall
+    float percentile( const std::vector<float> &sorted, double fraction )
+    {
+        if ( sorted.empty() )
+            return 0.f;
+        size_t i = static_cast<size_t>( fraction * ( sorted.size() - 1 ) + 0.5 );
+        return sorted[std::min(i, sorted.size() - 1)];
+    }
+
+    bool parseSize( const std::string &value, int &width, int &height )
+    {
+        return sscanf( value.c_str(), "%dx%d", &width, &height )==2 && width>0 && height>0;
+    }
+
+    void usage()
+    {
+        std::cerr << "usage: rmanconnect_loadgen [options]\n"
+                  << "  -host name      the host to send to (localhost)\n"
+                  << "  -port n         the port to send to (9201)\n"
+                  << "  -socket path    send through a Unix domain socket instead\n"
+                  << "  -res WxH        the image size (1920x1080)\n"
+                  << "  -bucket n       the bucket size (32)\n"
+                  << "  -order o        scanline, spiral or random (scanline)\n"
+                  << "  -channels n     samples per pixel (4)\n"
+                  << "  -images n       images sent at once, each by its own Client (1)\n"
+                  << "  -frames n       images each Client sends in turn (1)\n"
+                  << "  -codec name     none or zlib (none)\n"
+                  << "  -half           send half-precision samples\n"
+                  << "  -batch bytes    the most pixels batched into a message (65536)\n"
+                  << "  -preview n      send previews shrunk by n ahead of each bucket (0)\n"
+                  << "  -queue mb       the most pixels each Client may queue (64)\n"
+                  << "  -noshm          never send pixels through shared memory\n"
+                  << "  -nosession      connect again for each frame\n"
+                  << "  -trace          timestamp each bucket for the consumer to trace" << std::endl;
+    }
+}
+
+int main( int argc, char **argv )
+{
+    Options options;
+    for ( int i=1; i<argc; ++i )
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if ( arg=="-host" && has_value )
+            options.host = argv[++i];
+        else if ( arg=="-port" && has_value )
+            options.port = atoi( argv[++i] );
+        else if ( arg=="-socket" && has_value )
+            options.socketPath = argv[++i];
+        else if ( arg=="-res" && has_value && parseSize(argv[i + 1], options.width, options.height) )
+            ++i;
+        else if ( arg=="-bucket" && has_value )
+            options.bucketSize = std::max( atoi(argv[++i]), 1 );
+        else if ( arg=="-order" && has_value )
+        {
+            std::string order = argv[++i];
+            if ( order=="scanline" )
+                options.order = OrderScanline;
+            else if ( order=="spiral" )
+                options.order = OrderSpiral;
+            else if ( order=="random" )
+                options.order = OrderRandom;
+            else
+            {
+                usage();
+                return 1;
+            }
+        }
+        else if ( arg=="-channels" && has_value )
+            options.channels = std::max( atoi(argv[++i]), 1 );
+        else if ( arg=="-images" && has_value )
+            options.images = std::max( atoi(argv[++i]), 1 );
+        else if ( arg=="-frames" && has_value )
+            options.frames = std::max( atoi(argv[++i]), 1 );
+        else if ( arg=="-codec" && has_value )
+            options.codec = codecFromName( argv[++i] );
+        else if ( arg=="-half" )
+            options.format = FormatFloat16;
+        else if ( arg=="-batch" && has_value )
+            options.batchBytes = std::max( atoi(argv[++i]), 0 );
+        else if ( arg=="-preview" && has_value )
+            options.preview = std::max( atoi(argv[++i]), 0 );
+        else if ( arg=="-queue" && has_value )
+            options.queueMB = std::max( atoi(argv[++i]), 1 );
+        else if ( arg=="-noshm" )
+            options.sharedMemory = false;
+        else if ( arg=="-nosession" )
+            options.persistent = false;
+        else if ( arg=="-trace" )
+            options.trace = true;
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+
+    std::vector<Bucket> buckets = bucketOrder( options );
+    std::vector<Results> results( options.images );
+    boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+    boost::thread_group threads;
+    for ( int i=0; i<options.images; ++i )
+        threads.create_thread( boost::bind(&sendImages, boost::cref(options),
+                                           boost::cref(buckets), boost::ref(results[i])) );
+    threads.join_all();
+    double seconds = ( boost::posix_time::microsec_clock::universal_time() - start ).total_microseconds() / 1000000.0;
+    seconds = std::max( seconds, 0.000001 );
+
+    // add up what every Client did
+    Results total;
+    int failed = 0;
+    for ( size_t i=0; i<results.size(); ++i )
+    {
+        if ( !results[i].error.empty() )
+        {
+            std::cerr << "rmanconnect_loadgen: image " << i << ": " << results[i].error << std::endl;
+            failed++;
+        }
+        total.buckets += results[i].buckets;
+        total.bytes += results[i].bytes;
+        total.latencies.insert( total.latencies.end(), results[i].latencies.begin(), results[i].latencies.end() );
+        total.opens.insert( total.opens.end(), results[i].opens.begin(), results[i].opens.end() );
+        total.stats.bucketsDropped += results[i].stats.bucketsDropped;
+        total.stats.sentBytes += results[i].stats.sentBytes;
+        total.stats.stalls += results[i].stats.stalls;
+        total.stats.stallSeconds += results[i].stats.stallSeconds;
+        total.stats.previewsSent += results[i].stats.previewsSent;
+        total.stats.socketWrites += results[i].stats.socketWrites;
+    }
+    std::sort( total.latencies.begin(), total.latencies.end() );
+    std::sort( total.opens.begin(), total.opens.end() );
+
+    std::cout << "sent " << options.images * options.frames - failed * options.frames << " images of "
+              << options.width << "x" << options.height << "x" << options.channels << ", "
+              << total.buckets << " buckets, " << total.bytes / 1048576.0 << "MB in " << seconds << "s\n"
+              << "  " << total.bytes / 1048576.0 / seconds << "MB/s, "
+              << total.buckets / seconds << " buckets/s, "
+              << total.stats.sentBytes / 1048576.0 << "MB on the wire\n"
+              << "  sendPixels() latency us: p50 " << percentile(total.latencies, 0.5)
+              << ", p95 " << percentile(total.latencies, 0.95)
+              << ", p99 " << percentile(total.latencies, 0.99)
+              << ", max " << ( total.latencies.empty() ? 0.f : total.latencies.back() ) << "\n"
+              << "  openImage() latency us: p50 " << percentile(total.opens, 0.5)
+              << ", max " << ( total.opens.empty() ? 0.f : total.opens.back() ) << "\n"
+              << "  " << total.stats.stalls << " stalls (" << total.stats.stallSeconds << "s), "
+              << total.stats.bucketsDropped << " dropped, "
+              << total.stats.previewsSent << " previews\n"
+              << "  " << total.stats.socketWrites << " socket writes, "
+              << total.stats.socketWrites / std::max( double(total.buckets), 1.0 ) << " per bucket" << std::endl;
+    return failed>0 ? 1 : 0;
+}
@@ -0,0 +1,361 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// rmanconnect_replay
+//
+// Plays back a recording made with the display driver's 'record' parameter
+// (or Client::setRecording()) into a Server, either at the speed it was
+// recorded, some multiple of it, or as fast as possible. This gives
+// repeatable end-to-end benchmarks of a Server using real render traffic,
+// without needing a renderer.
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread.hpp>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "Data.h"
+#include "Message.h"
+#include "Recording.h"
+#include "Server.h"
+
+using boost::asio::ip::tcp;
+using namespace rmanconnect;
+
+namespace
+{
+    struct Options
+    {
+        Options() :
+            host("localhost"),
+            port(9201),
+            speed(1.0),
+            loops(1),
+            serve(false)
+        {
+        }
+
+        std::string host, socketPath, recording;
+        int port;
+        double speed;
+        int loops;
+        bool serve;
+    };
+
+    // what we sent, and how long it took
+    struct Totals
+    {
+        Totals() : messages(0), images(0), bytes(0.0), seconds(0.0) {}
+
+        unsigned long messages, images;
+        double bytes, seconds;
+    };
+
+    // sends recorded messages to a Server over either kind of socket,
+    // connecting for each image as a Client does when it isn't persistent
+    class Sender
+    {
+    public:
+        Sender( const Options &options ) :
+            mOptions( options ),
+            mSocket( mIoService ),
+            mLocalSocket( mIoService ),
+            mImageId( -1 )
+        {
+        }
+
+        void send( RecordedMessage &message )
+        {
+            MessageHeader &header = message.header;
+            if ( header.type==MsgOpenImage )
+            {
+                open( message );
+                return;
+            }
+
+            // the Server will have given the image a new id
+            header.imageId = mImageId;
+            if ( header.type==MsgBatch )
+            {
+                for ( size_t offset=0; offset + sizeof(MessageHeader)<=message.payload.size(); )
+                {
+                    MessageHeader *msg = reinterpret_cast<MessageHeader*>(&message.payload[offset]);
+                    msg->imageId = mImageId;
+                    offset += sizeof(MessageHeader) + msg->payloadSize;
+                }
+            }
+            write( message );
+
+            if ( header.type==MsgCloseImage )
+                disconnect();
+        }
+
+    private:
+        void open( RecordedMessage &message )
+        {
+            connect();
+
+            // the payload always comes on the socket now
+            MessageHeader &header = message.header;
+            header.flags &= ~MsgFlagSharedMemory;
+            write( message );
+
+            MessageHeader reply;
+            read( boost::asio::buffer(reinterpret_cast<char*>(&reply), sizeof(reply)) );
+            if ( !reply.valid() || reply.type!=MsgOpenImage )
+                throw std::runtime_error( "Server replied with an incompatible protocol version!" );
+            if ( reply.codec!=header.codec || reply.format!=header.format )
+                throw std::runtime_error( "Server would not accept the recording's codec or sample format" );
+            mImageId = reply.imageId;
+        }
+
+        void connect()
+        {
+            disconnect();
+            if ( !mOptions.socketPath.empty() )
+            {
+                mLocalSocket.connect( boost::asio::local::stream_protocol::endpoint(mOptions.socketPath) );
+                return;
+            }
+
+            tcp::resolver resolver( mIoService );
+            tcp::resolver::query query( mOptions.host, boost::lexical_cast<std::string>(mOptions.port) );
+            tcp::resolver::iterator endpoint_iterator = resolver.resolve( query );
+            tcp::resolver::iterator end;
+            boost::system::error_code error = boost::asio::error::host_not_found;
+            while ( error && endpoint_iterator!=end )
+            {
+                mSocket.close();
+                mSocket.connect( *endpoint_iterator++, error );
+            }
+            if ( error )
+                throw boost::system::system_error( error );
+            mSocket.set_option( tcp::no_delay(true) );
+        }
+
+        void disconnect()
+        {
+            mSocket.close();
+            mLocalSocket.close();
+        }
+
+        void write( const RecordedMessage &message )
+        {
+            std::vector<boost::asio::const_buffer> buffers;
+            buffers.push_back( boost::asio::buffer(reinterpret_cast<const char*>(&message.header), sizeof(MessageHeader)) );
+            if ( !message.payload.empty() )
+                buffers.push_back( boost::asio::buffer(message.payload) );
+            if ( mLocalSocket.is_open() )
+                boost::asio::write( mLocalSocket, buffers );
+            else
+                boost::asio::write( mSocket, buffers );
+        }
+
+        void read( const boost::asio::mutable_buffer &buffer )
+        {
+            if ( mLocalSocket.is_open() )
+                boost::asio::read( mLocalSocket, boost::asio::mutable_buffers_1(buffer) );
+            else
+                boost::asio::read( mSocket, boost::asio::mutable_buffers_1(buffer) );
+        }
+
+        const Options &mOptions;
+        boost::asio::io_service mIoService;
+        tcp::socket mSocket;
+        boost::asio::local::stream_protocol::socket mLocalSocket;
+        int mImageId;
+    };
+
+    // plays the recording loops times, keeping to its timing unless speed
+    // is 0
+    void replay( const Options &options, Totals &totals )
+    {
+        Playback playback( options.recording );
+        Sender sender( options );
+        RecordedMessage message;
+        boost::posix_time::ptime start = boost::posix_time::microsec_clock::universal_time();
+        for ( int loop=0; loop<options.loops; ++loop )
+        {
+            playback.rewind();
+            boost::posix_time::ptime loop_start = boost::posix_time::microsec_clock::universal_time();
+            while ( playback.next(message) )
+            {
+                if ( options.speed>0.0 )
+                {
+                    boost::posix_time::ptime due = loop_start +
+                        boost::posix_time::microseconds( static_cast<boost::int64_t>(message.time / options.speed) );
+                    boost::this_thread::sleep( due );
+                }
+                if ( message.header.type==MsgOpenImage )
+                    totals.images++;
+                totals.messages++;
+                totals.bytes += sizeof(MessageHeader) + message.payload.size();
+                sender.send( message );
+            }
+        }
+        totals.seconds = ( boost::posix_time::microsec_clock::universal_time() - start ).total_microseconds() / 1000000.0;
+    }
+
+    // replays on a thread, catching anything it throws
+    void replayThread( const Options &options, Totals &totals, std::string &error )
+    {
+        try
+        {
+            replay( options, totals );
+        }
+        catch ( const std::exception &e )
+        {
+            error = e.what();
+        }
+    }
+
+    // the number of images in a recording
+    unsigned long countImages( const std::string &path )
+    {
+        Playback playback( path );
+        RecordedMessage message;
+        unsigned long images = 0;
+        while ( playback.next(message) )
+            if ( message.header.type==MsgCloseImage )
+                images++;
+        return images;
+    }
+
+    void usage()
+    {
+        std::cerr << "usage: rmanconnect_replay [options] recording\n"
+                  << "  -host name     the host to send to (localhost)\n"
+                  << "  -port n        the port to send to (9201)\n"
+                  << "  -socket path   send through a Unix domain socket instead\n"
+                  << "  -speed x       play back at x times the recorded speed, or as fast\n"
+                  << "                 as possible if x is 0 (1)\n"
+                  << "  -loop n        play the recording n times (1)\n"
+                  << "  -serve         play into a Server of our own that just receives\n"
+                  << "                 the pixels, rather than a running one" << std::endl;
+    }
+}
+
+int main( int argc, char **argv )
+{
+    Options options;
+    for ( int i=1; i<argc; ++i )
+    {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        if ( arg=="-host" && has_value )
+            options.host = argv[++i];
+        else if ( arg=="-port" && has_value )
+            options.port = atoi( argv[++i] );
+        else if ( arg=="-socket" && has_value )
+            options.socketPath = argv[++i];
+        else if ( arg=="-speed" && has_value )
+            options.speed = atof( argv[++i] );
+        else if ( arg=="-loop" && has_value )
+            options.loops = std::max( atoi(argv[++i]), 1 );
+        else if ( arg=="-serve" )
+            options.serve = true;
+        else if ( arg[0]!='-' && options.recording.empty() )
+            options.recording = arg;
+        else
+        {
+            usage();
+            return 1;
+        }
+    }
+    if ( options.recording.empty() )
+    {
+        usage();
+        return 1;
+    }
+
+    try
+    {
+        Totals totals;
+        if ( !options.serve )
+        {
+            replay( options, totals );
+        }
+        else
+        {
+            // receive the pixels ourselves, timing from the first message
+            // to the last image closing
+            unsigned long images = countImages( options.recording ) * options.loops;
+            Server server;
+            server.connect( options.port, true );
+            options.socketPath = "";
+            options.host = "localhost";
+            options.port = server.getPort();
+
+            std::string error;
+            boost::thread thread( boost::bind(&replayThread, boost::cref(options),
+                                              boost::ref(totals), boost::ref(error)) );
+            unsigned long closed = 0, buckets = 0;
+            boost::posix_time::ptime start;
+            while ( closed<images && error.empty() )
+            {
+                Data d = server.listen( 1.0 );
+                if ( d.type()==MsgOpenImage && start.is_not_a_date_time() )
+                    start = boost::posix_time::microsec_clock::universal_time();
+                else if ( d.type()==MsgPixels || d.type()==MsgPreview )
+                    buckets += d.numRegions();
+                else if ( d.type()==MsgCloseImage )
+                    closed++;
+            }
+            thread.join();
+            if ( !error.empty() )
+                throw std::runtime_error( error );
+
+            double seconds = start.is_not_a_date_time() ? 0.0 :
+                ( boost::posix_time::microsec_clock::universal_time() - start ).total_microseconds() / 1000000.0;
+            ReceiveStats stats = server.stats();
+            std::cout << "received " << closed << " images, " << buckets << " buckets in "
+                      << seconds << "s (" << stats.buckets / std::max(seconds, 0.000001)
+                      << " buckets/s)" << std::endl;
+        }
+
+        std::cout << "sent " << totals.images << " images, " << totals.messages << " messages, "
+                  << totals.bytes / 1048576.0 << "MB in " << totals.seconds << "s ("
+                  << totals.bytes / 1048576.0 / std::max(totals.seconds, 0.000001) << "MB/s)" << std::endl;
+    }
+    catch ( const std::exception &e )
+    {
+        std::cerr << "rmanconnect_replay: " << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
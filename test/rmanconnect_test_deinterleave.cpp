@@ -0,0 +1,137 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+// rmanconnect_test_deinterleave
+//
+// Checks that deinterleave() splits pixels into the right channels. The SSE
+// kernels for 3 and 4 samples per pixel do runs of 4 pixels and leave the
+// rest to a scalar tail, so splitting one pixel at a time always takes the
+// scalar code, while whole rows take the kernels. Rows of every width up to
+// a few runs are split from and into unaligned memory, and must match both
+// the scalar path and the sample each output should have come from, without
+// writing past the end of any channel.
+
+#include "Deinterleave.h"
+
+#include <cstdio>
+#include <vector>
+
+using namespace rmanconnect;
+
+namespace
+{
+    int failures = 0;
+
+    // written around each channel to catch overruns
+    const float Guard = -1.f;
+
+    // padding either side of each channel
+    const unsigned int Pad = 4;
+
+    void fail( const char *what, unsigned int spp, unsigned int channels, size_t count,
+               unsigned int offset, size_t i, unsigned int c, float got, float expected )
+    {
+        if ( failures<10 )
+            printf( "FAIL %s: spp %u, channels %u, count %u, offset %u: "
+                    "pixel %u channel %u gave %g, expected %g\n",
+                    what, spp, channels, static_cast<unsigned int>( count ), offset,
+                    static_cast<unsigned int>( i ), c, got, expected );
+        ++failures;
+    }
+
+    // splits count pixels starting offset floats into a buffer, into
+    // channels starting offset floats into theirs, and checks the result
+    void testSplit( unsigned int spp, unsigned int channels, size_t count, unsigned int offset )
+    {
+        // every sample is different, so any mix-up shows
+        std::vector<float> in( offset + count*spp );
+        for ( size_t i=0; i<count*spp; ++i )
+            in[offset + i] = static_cast<float>( i );
+
+        std::vector< std::vector<float> > bulk( channels ), single( channels );
+        std::vector<float*> bulk_out( channels ), single_out( channels );
+        for ( unsigned int c=0; c<channels; ++c )
+        {
+            bulk[c].assign( offset + count + 2*Pad, Guard );
+            single[c].assign( offset + count + 2*Pad, Guard );
+            bulk_out[c] = &bulk[c][Pad + offset];
+            single_out[c] = &single[c][Pad + offset];
+        }
+
+        deinterleave( &in[0] + offset, spp, &bulk_out[0], channels, count );
+        for ( size_t i=0; i<count; ++i )
+        {
+            std::vector<float*> out( channels );
+            for ( unsigned int c=0; c<channels; ++c )
+                out[c] = single_out[c] + i;
+            deinterleave( &in[0] + offset + i*spp, spp, &out[0], channels, 1 );
+        }
+
+        for ( unsigned int c=0; c<channels; ++c )
+        {
+            for ( size_t i=0; i<bulk[c].size(); ++i )
+            {
+                bool inside = i>=Pad + offset && i<Pad + offset + count;
+                size_t pixel = i - Pad - offset;
+                float expected = inside ? static_cast<float>( pixel*spp + c ) : Guard;
+                if ( bulk[c][i]!=expected )
+                    fail( "bulk", spp, channels, count, offset, pixel, c, bulk[c][i], expected );
+                if ( single[c][i]!=bulk[c][i] )
+                    fail( "paths", spp, channels, count, offset, pixel, c, single[c][i], bulk[c][i] );
+            }
+        }
+    }
+}
+
+int main()
+{
+    // every kernel, and the generic loop (fewer channels than samples, or
+    // more samples than any kernel handles), at odd and even widths and
+    // every alignment
+    for ( unsigned int spp=1; spp<=5; ++spp )
+        for ( unsigned int channels=1; channels<=spp; ++channels )
+            for ( size_t count=0; count<=19; ++count )
+                for ( unsigned int offset=0; offset<4; ++offset )
+                    testSplit( spp, channels, count, offset );
+
+    // and a full row
+    for ( unsigned int offset=0; offset<4; ++offset )
+    {
+        testSplit( 3, 3, 2047, offset );
+        testSplit( 4, 4, 2047, offset );
+    }
+
+    if ( failures )
+    {
+        printf( "%d failures\n", failures );
+        return 1;
+    }
+    printf( "ok\n" );
+    return 0;
+}
@@ -0,0 +1,148 @@
+/*
+Copyright (c) 2010, Dan Bethell, Johannes Saam.
+All rights reserved.
+
+Redistribution and use in source and binary forms, with or without modification,
+are permitted provided that the following conditions are met:
+
+    * Redistributions of source code must retain the above copyright notice,
+    this list of conditions and the following disclaimer.
+
+    * Redistributions in binary form must reproduce the above copyright notice,
+    this list of conditions and the following disclaimer in the documentation
+    and/or other materials provided with the distribution.
+
+    * Neither the name of RmanConnect nor the names of its contributors may be
+    used to endorse or promote products derived from this software without
+    specific prior written permission.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+// rmanconnect_test_half
+//
+// Checks the float<->half conversions. Every half must survive a round trip
+// through a float bit for bit (NaNs come back quietened), and the F16C
+// kernels must give exactly the bits the scalar code does. The kernels
+// convert runs of 8 values and the scalar code does whatever is left over,
+// so converting one value at a time always takes the scalar path, while
+// whole arrays take the F16C path on CPUs that have it.
+
+#include "Half.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace rmanconnect;
+
+namespace
+{
+    int failures = 0;
+
+    void fail( const char *what, unsigned int input, unsigned int got, unsigned int expected )
+    {
+        if ( failures<10 )
+            printf( "FAIL %s: 0x%08x gave 0x%08x, expected 0x%08x\n",
+                    what, input, got, expected );
+        ++failures;
+    }
+
+    boost::uint32_t bits( float value )
+    {
+        boost::uint32_t b;
+        memcpy( &b, &value, sizeof(b) );
+        return b;
+    }
+
+    // every half survives half->float->half; NaNs are quietened on the way
+    void testRoundTrip()
+    {
+        std::vector<boost::uint16_t> halves( 65536 ), back( 65536 );
+        std::vector<float> floats( 65536 );
+        for ( unsigned int i=0; i<65536; ++i )
+            halves[i] = static_cast<boost::uint16_t>( i );
+
+        halfToFloat( &halves[0], &floats[0], halves.size() );
+        floatToHalf( &floats[0], &back[0], floats.size() );
+
+        for ( unsigned int i=0; i<65536; ++i )
+        {
+            bool nan = ( i & 0x7c00 )==0x7c00 && ( i & 0x3ff )!=0;
+            unsigned int expected = nan ? ( i | 0x200 ) : i;
+            if ( back[i]!=expected )
+                fail( "round trip", i, back[i], expected );
+        }
+    }
+
+    // bulk conversions (F16C where available) match one-at-a-time (scalar)
+    void testPathsMatch()
+    {
+        // all the halves, and a spread of float bit patterns that covers
+        // every exponent, the rounding cases, infinities and NaNs
+        std::vector<boost::uint16_t> halves( 65536 );
+        for ( unsigned int i=0; i<65536; ++i )
+            halves[i] = static_cast<boost::uint16_t>( i );
+
+        std::vector<float> floats;
+        for ( boost::uint64_t b=0; b<=0xffffffffull; b+=4093 )
+        {
+            boost::uint32_t f = static_cast<boost::uint32_t>( b );
+            float value;
+            memcpy( &value, &f, sizeof(value) );
+            floats.push_back( value );
+        }
+
+        std::vector<float> bulk_floats( halves.size() );
+        halfToFloat( &halves[0], &bulk_floats[0], halves.size() );
+        for ( unsigned int i=0; i<65536; ++i )
+        {
+            // exactly halfway between a normal half and the next one up
+            if ( ( i & 0x7c00 )==0 || ( i & 0x7c00 )==0x7c00 )
+                continue;
+            boost::uint32_t f = bits( bulk_floats[i] ) | 0x1000;
+            float value;
+            memcpy( &value, &f, sizeof(value) );
+            floats.push_back( value );
+        }
+        for ( size_t i=0; i<halves.size(); ++i )
+        {
+            float single;
+            halfToFloat( &halves[i], &single, 1 );
+            if ( bits( bulk_floats[i] )!=bits( single ) )
+                fail( "halfToFloat paths", halves[i], bits( bulk_floats[i] ), bits( single ) );
+        }
+
+        std::vector<boost::uint16_t> bulk_halves( floats.size() );
+        floatToHalf( &floats[0], &bulk_halves[0], floats.size() );
+        for ( size_t i=0; i<floats.size(); ++i )
+        {
+            boost::uint16_t single;
+            floatToHalf( &floats[i], &single, 1 );
+            if ( bulk_halves[i]!=single )
+                fail( "floatToHalf paths", bits( floats[i] ), bulk_halves[i], single );
+        }
+    }
+}
+
+int main()
+{
+    testRoundTrip();
+    testPathsMatch();
+
+    if ( failures )
+    {
+        printf( "%d failures\n", failures );
+        return 1;
+    }
+    printf( "ok\n" );
+    return 0;
+}